@@ -0,0 +1,128 @@
+#include "audio.hpp"
+
+AudioOutput::AudioOutput()
+{
+    m_Head = 0;
+    m_Tail = 0;
+
+    m_SampleClock = 0;
+    m_Buzzer = false;
+
+    // square wave, the first half of the period high
+    for(int i = 0; i < AUDIO_PATTERN_BITS / 8; i++) m_Pattern[i] = (i < AUDIO_PATTERN_BITS / 16) ? 0xff : 0x00;
+    m_Phase = 0;
+    m_PhaseStep = uint32_t((uint64_t(AUDIO_TONE_HZ) * AUDIO_PATTERN_BITS << 16) / AUDIO_SAMPLE_RATE);
+
+    m_Underruns = 0;
+    m_MinQueued = AUDIO_RING_SIZE;
+    m_TrimChunks = 0;
+    m_Trimmed = 0;
+    m_PeakQueued = 0;
+
+    initialize(1, AUDIO_SAMPLE_RATE);
+}
+
+AudioOutput::~AudioOutput()
+{
+    // the stream thread calls onGetData(), stop it before the members go away
+    stop();
+}
+
+uint64_t AudioOutput::sampleAt(uint64_t cycle, unsigned int cyclesperframe)
+{
+    return cycle * (AUDIO_SAMPLE_RATE / TIMER_FREQUENCY) / cyclesperframe;
+}
+
+void AudioOutput::renderSamples(uint64_t until)
+{
+    uint32_t head = m_Head.load(std::memory_order_relaxed);
+    uint32_t tail = m_Tail.load(std::memory_order_acquire);
+
+    for(; m_SampleClock < until; m_SampleClock++)
+    {
+        int16_t sample = 0;
+
+        if(m_Buzzer)
+        {
+            unsigned int bit = m_Phase >> 16;
+            sample = (m_Pattern[bit >> 3] >> (7 - (bit & 0x7)) & 0x1) ? AUDIO_VOLUME : -AUDIO_VOLUME;
+        }
+        m_Phase = (m_Phase + m_PhaseStep) & ((AUDIO_PATTERN_BITS << 16) - 1);
+
+        // a full ring means the audio thread stalled, drop the sample and keep the clock going
+        if(head - tail < AUDIO_RING_SIZE) m_Ring[head++ & (AUDIO_RING_SIZE - 1)] = sample;
+    }
+
+    m_Head.store(head, std::memory_order_release);
+}
+
+void AudioOutput::render(const SoundEvent *events, unsigned int count, uint64_t cycle, unsigned int cyclesperframe)
+{
+    uint64_t until = sampleAt(cycle, cyclesperframe);
+
+    // the guest clock went back or jumped further than the ring holds, carry on from here
+    if(until < m_SampleClock || until - m_SampleClock > AUDIO_RING_SIZE) m_SampleClock = until;
+
+    // each edge switches the buzzer at its own sample, edges from before a resync only set the state
+    for(unsigned int i = 0; i < count; i++)
+    {
+        uint64_t at = sampleAt(events[i].cycle, cyclesperframe);
+        if(at > until) at = until;
+
+        renderSamples(at);
+        m_Buzzer = events[i].on;
+    }
+
+    renderSamples(until);
+}
+
+bool AudioOutput::onGetData(Chunk &data)
+{
+    uint32_t tail = m_Tail.load(std::memory_order_relaxed);
+    uint32_t head = m_Head.load(std::memory_order_acquire);
+
+    if(head - tail > m_PeakQueued.load(std::memory_order_relaxed)) m_PeakQueued.store(head - tail, std::memory_order_relaxed);
+
+    // drop the oldest samples when more than the latency budget queued up
+    if(head - tail > AUDIO_MAX_QUEUED)
+    {
+        m_Trimmed.fetch_add(head - tail - AUDIO_MAX_QUEUED, std::memory_order_relaxed);
+        tail = head - AUDIO_MAX_QUEUED;
+    }
+
+    unsigned int n = 0;
+    for(; n < AUDIO_CHUNK_SAMPLES && tail != head; n++, tail++) m_Chunk[n] = m_Ring[tail & (AUDIO_RING_SIZE - 1)];
+
+    // samples that stayed queued through a whole window only add latency, keep a slice for the
+    // cpu thread's next batch and drop the rest
+    if(head - tail < m_MinQueued) m_MinQueued = head - tail;
+    if(++m_TrimChunks == AUDIO_TRIM_CHUNKS)
+    {
+        if(m_MinQueued > AUDIO_SLICE_SAMPLES)
+        {
+            m_Trimmed.fetch_add(m_MinQueued - AUDIO_SLICE_SAMPLES, std::memory_order_relaxed);
+            tail += m_MinQueued - AUDIO_SLICE_SAMPLES;
+        }
+        m_MinQueued = AUDIO_RING_SIZE;
+        m_TrimChunks = 0;
+    }
+
+    m_Tail.store(tail, std::memory_order_release);
+
+    // keep the stream going through pauses and stalls
+    if(n < AUDIO_CHUNK_SAMPLES)
+    {
+        for(; n < AUDIO_CHUNK_SAMPLES; n++) m_Chunk[n] = 0;
+        m_Underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    data.samples = m_Chunk;
+    data.sampleCount = AUDIO_CHUNK_SAMPLES;
+
+    return true;
+}
+
+void AudioOutput::onSeek(sf::Time timeOffset)
+{
+    // a live stream has nothing to seek in
+}
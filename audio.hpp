@@ -0,0 +1,84 @@
+#ifndef CLASS_AUDIO
+#define CLASS_AUDIO
+
+#include <atomic>
+#include <stdint.h>
+
+#include <SFML/Audio.hpp>
+
+#include "chip8core.hpp"
+
+// 800 samples per 60Hz guest frame
+#define AUDIO_SAMPLE_RATE 48000
+// samples handed to SFML per buffer, 5ms, it keeps 3 queued and refills them every 10ms
+#define AUDIO_CHUNK_SAMPLES 240
+// sample ring between the cpu thread and the audio thread, a power of 2
+#define AUDIO_RING_SIZE 4096
+// the cpu thread renders a slice of a guest frame at a time, 200 samples
+#define AUDIO_SLICE_SAMPLES (AUDIO_SAMPLE_RATE / TIMER_FREQUENCY / FRAME_SLICES)
+// a late stream thread can refill all 3 buffers at once, anything queued past that and a slice
+// is dropped straight away after a stall
+#define AUDIO_MAX_QUEUED (3 * AUDIO_CHUNK_SAMPLES + AUDIO_SLICE_SAMPLES)
+// chunks over which the ring never drained below a slice, the excess is standing latency and is dropped
+#define AUDIO_TRIM_CHUNKS 8
+// end to end, samples wait for their slice to be rendered, in the ring for the stream thread's 10ms
+// poll and behind the buffers already queued, about 17ms on average and 19ms at most
+
+// buzzer pitch and level
+#define AUDIO_TONE_HZ 440
+#define AUDIO_VOLUME 6000
+// bits in a waveform pattern, the xo-chip audio buffer size
+#define AUDIO_PATTERN_BITS 128
+
+// plays the buzzer on the host sound device
+// the cpu thread renders the guest's sound events into samples after every batch and pushes them
+// into a single producer, single consumer ring, SFML's stream thread pulls them out
+// nothing locks and nothing is allocated once the stream is playing
+class AudioOutput : public sf::SoundStream
+{
+private:
+
+    // ring, m_Head is only written by the cpu thread and m_Tail only by the audio thread
+    int16_t m_Ring[AUDIO_RING_SIZE];
+    std::atomic<uint32_t> m_Head;
+    std::atomic<uint32_t> m_Tail;
+
+    // cpu thread
+    // absolute sample the next rendered one is for, derived from the guest cycle
+    uint64_t m_SampleClock;
+    bool m_Buzzer;
+    // one bit per step, played AUDIO_PATTERN_BITS steps per period, the buzzer is half on and half off
+    uint8_t m_Pattern[AUDIO_PATTERN_BITS / 8];
+    // position in the pattern, 16.16 fixed point steps
+    uint32_t m_Phase;
+    uint32_t m_PhaseStep;
+    uint64_t sampleAt(uint64_t cycle, unsigned int cyclesperframe);
+    void renderSamples(uint64_t until);
+
+    // audio thread
+    int16_t m_Chunk[AUDIO_CHUNK_SAMPLES];
+    // chunks padded with silence because the cpu thread had not rendered enough
+    std::atomic<uint64_t> m_Underruns;
+    // lowest ring level left after a chunk over the current trim window
+    uint32_t m_MinQueued;
+    unsigned int m_TrimChunks;
+    std::atomic<uint64_t> m_Trimmed;
+    std::atomic<uint32_t> m_PeakQueued;
+
+    virtual bool onGetData(Chunk &data);
+    virtual void onSeek(sf::Time timeOffset);
+
+public:
+    AudioOutput();
+    ~AudioOutput();
+
+    // cpu thread, render up to cycle from the sound events of the batch that got there
+    // jumps in the guest clock from resets, loads and rewinds resync without playing the gap
+    void render(const SoundEvent *events, unsigned int count, uint64_t cycle, unsigned int cyclesperframe);
+
+    uint64_t getUnderruns() { return m_Underruns.load(std::memory_order_relaxed);}
+    // samples dropped to keep latency down, and the most the ring held when the stream thread pulled
+    uint64_t getTrimmed() { return m_Trimmed.load(std::memory_order_relaxed);}
+    uint32_t getPeakQueued() { return m_PeakQueued.load(std::memory_order_relaxed);}
+};
+#endif // CLASS_AUDIO
@@ -0,0 +1,197 @@
+#include "batch.hpp"
+#include "threadpool.hpp"
+#include "lockstep.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+// fnv-1a of the packed display words of every plane, laid out as MachineState::display
+static uint64_t hashDisplay(const uint64_t *rows)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(int w = 0; w < DISPLAY_PLANES * DISPLAY_HEIGHT * 2; w++)
+    {
+        for(int b = 7; b >= 0; b--)
+        {
+            hash ^= (rows[w] >> (b * 8)) & 0xff;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+
+    return hash;
+}
+
+bool readRomList(std::string listfile, std::vector<std::string> *roms)
+{
+    std::ifstream ifile;
+
+    ifile.open(listfile.c_str());
+
+    if(!ifile.is_open()) return false;
+
+    std::string line;
+    while(std::getline(ifile, line))
+    {
+        // strip windows line endings and trailing spaces
+        while(!line.empty() && (line[line.size()-1] == '\r' || line[line.size()-1] == ' ')) line.erase(line.size()-1);
+
+        if(line.empty() || line[0] == '#') continue;
+
+        roms->push_back(line);
+    }
+
+    ifile.close();
+
+    return true;
+}
+
+// data is NULL to load the rom from its file
+static void runBatchRom(const std::string &rom, const uint8_t *data, unsigned int size, const BatchOptions &options, BatchResult *result)
+{
+    result->rom = rom;
+    result->loaded = false;
+    result->halted = false;
+    result->cycles = 0;
+    result->frames = 0;
+    result->displayhash = 0;
+    result->ireg = 0;
+    result->pc = 0;
+    result->delay = 0;
+    result->sound = 0;
+    for(int i = 0; i < MAX_REGISTERS; i++) result->reg[i] = 0;
+
+    // machines are large, keep them off the worker stacks
+    Chip8Core *chip = new Chip8Core;
+    chip->setQuirks(options.quirks);
+
+    if(data ? chip->loadRom(data, size) : chip->loadRom(rom))
+    {
+        chip->setDispatchMode(options.engine);
+        chip->setSeed(options.seed);
+        chip->setCPUFrequency(options.hz);
+        chip->setCycleLimit(options.cycles);
+        chip->setFrameLimit(options.frames);
+        if(!options.cycles && !options.frames) chip->setFrameLimit(BATCH_DEFAULT_FRAMES);
+
+        chip->run();
+
+        result->loaded = true;
+        result->halted = !chip->limitReached();
+        result->cycles = chip->getCycleCount();
+        result->frames = chip->getFrameCount();
+
+        result->displayhash = hashDisplay(chip->getDisplayRows());
+
+        for(int i = 0; i < MAX_REGISTERS; i++) result->reg[i] = chip->getRegisters()[i];
+        result->ireg = chip->getIRegister();
+        result->pc = chip->getProgramCounter();
+        result->delay = chip->getDelayRegister();
+        result->sound = chip->getSoundRegister();
+    }
+
+    delete chip;
+}
+
+void runBatch(const std::vector<std::string> &roms, const BatchOptions &options, std::vector<BatchResult> *results)
+{
+    results->resize(roms.size());
+
+    // one job per rom, each worker only touches its own result slot
+    ThreadPool pool(options.threads);
+    pool.parallelFor(roms.size(), [&](unsigned int i)
+    {
+        runBatchRom(roms[i], NULL, 0, options, &(*results)[i]);
+    });
+}
+
+void runBatch(const RomArchive &archive, const BatchOptions &options, std::vector<BatchResult> *results)
+{
+    results->resize(archive.getCount());
+
+    // roms are used straight from the mapped archive
+    ThreadPool pool(options.threads);
+    pool.parallelFor(archive.getCount(), [&](unsigned int i)
+    {
+        runBatchRom(archive.getName(i), archive.getData(i), archive.getSize(i), options, &(*results)[i]);
+    });
+}
+
+bool runLockstep(const std::string &rom, const BatchOptions &options, std::vector<BatchResult> *results)
+{
+    // lanes hold a copy of memory each, keep the batch off the stack
+    LockstepBatch *batch = new LockstepBatch;
+
+    batch->setQuirks(options.quirks);
+
+    if(!batch->loadRom(rom))
+    {
+        // auto detection can pick a profile the lanes do not run
+        if(!LockstepBatch::supportsQuirks(batch->getQuirks())) std::cout << "Lockstep does not run the vip or xo-chip quirks " << rom << " needs\n";
+
+        delete batch;
+        return false;
+    }
+
+    batch->setCPUFrequency(options.hz);
+
+    if(options.cycles) batch->runCycles(options.cycles);
+    else batch->runFrames(options.frames ? options.frames : BATCH_DEFAULT_FRAMES);
+
+    results->resize(LOCKSTEP_LANES);
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        BatchResult &result = (*results)[lane];
+        std::stringstream name;
+        name << rom << ":" << lane;
+
+        result.rom = name.str();
+        result.loaded = true;
+        result.halted = batch->getHaltedLanes() >> lane & 0x1;
+        result.cycles = batch->getCycleCount(lane);
+        result.frames = batch->getFrameCount(lane);
+
+        result.displayhash = hashDisplay(batch->getDisplayRows(lane));
+
+        for(int i = 0; i < MAX_REGISTERS; i++) result.reg[i] = batch->getRegister(lane, i);
+        result.ireg = batch->getIRegister(lane);
+        result.pc = batch->getProgramCounter(lane);
+        result.delay = batch->getDelayRegister(lane);
+        result.sound = batch->getSoundRegister(lane);
+    }
+
+    uint64_t group = batch->getGroupInstructions();
+    uint64_t single = batch->getLaneInstructions();
+    std::cout << "Lockstep " << (batch->getAVX2() ? "avx2" : "scalar") << ", " << group << " of " << group + single << " instructions in groups\n";
+
+    delete batch;
+
+    return true;
+}
+
+void printBatchResults(const std::vector<BatchResult> &results, std::ostream &out)
+{
+    for(unsigned int i = 0; i < results.size(); i++)
+    {
+        const BatchResult &result = results[i];
+
+        out << result.rom;
+
+        if(!result.loaded)
+        {
+            out << " error\n";
+            continue;
+        }
+
+        out << std::dec << " cycles=" << result.cycles << " frames=" << result.frames;
+        out << (result.halted ? " halted" : " running");
+        out << std::hex << std::setfill('0');
+        out << " display=" << std::setw(16) << result.displayhash;
+        out << " pc=" << std::setw(4) << result.pc << " i=" << std::setw(4) << result.ireg;
+        out << " dt=" << std::setw(2) << int(result.delay) << " st=" << std::setw(2) << int(result.sound);
+        out << " v=";
+        for(int r = 0; r < MAX_REGISTERS; r++) out << std::setw(2) << int(result.reg[r]);
+        out << std::dec << std::setfill(' ') << "\n";
+    }
+}
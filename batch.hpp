@@ -0,0 +1,60 @@
+#ifndef BATCH_RUNNER
+#define BATCH_RUNNER
+
+#include <string>
+#include <vector>
+
+#include "chip8core.hpp"
+#include "romfile.hpp"
+
+// guest frames each rom runs for when no cycle or frame limit is given, 10 seconds at 60Hz
+#define BATCH_DEFAULT_FRAMES 600
+// rng seed of every machine when none is given, so repeated batches give the same results
+#define BATCH_DEFAULT_SEED 1
+
+// how every rom in a batch is run
+struct BatchOptions
+{
+    DISPATCH_MODE engine;
+    // QUIRKS_AUTO picks it for each rom
+    QUIRK_PROFILE quirks;
+    unsigned int hz;
+    uint64_t cycles;
+    uint64_t frames;
+    uint32_t seed;
+    // worker threads, 0 for one per core
+    unsigned int threads;
+};
+
+// final state of one rom
+struct BatchResult
+{
+    std::string rom;
+    bool loaded;
+    bool halted;
+    uint64_t cycles;
+    uint64_t frames;
+    // fnv-1a of the packed display rows of every plane
+    uint64_t displayhash;
+    uint8_t reg[MAX_REGISTERS];
+    uint16_t ireg;
+    uint16_t pc;
+    uint8_t delay;
+    uint8_t sound;
+};
+
+// read a list of rom files, one per line, blank lines and lines starting with # are skipped
+bool readRomList(std::string listfile, std::vector<std::string> *roms);
+
+// run every rom headless on a thread pool, results are in the same order as roms
+void runBatch(const std::vector<std::string> &roms, const BatchOptions &options, std::vector<BatchResult> *results);
+// same for every rom in an archive, in the order they were packed
+void runBatch(const RomArchive &archive, const BatchOptions &options, std::vector<BatchResult> *results);
+
+// run LOCKSTEP_LANES copies of one rom with different rng seeds in a LockstepBatch,
+// one result per lane
+bool runLockstep(const std::string &rom, const BatchOptions &options, std::vector<BatchResult> *results);
+
+// one line per rom with the display hash and a register dump
+void printBatchResults(const std::vector<BatchResult> &results, std::ostream &out);
+#endif // BATCH_RUNNER
@@ -0,0 +1,449 @@
+// benchmarks for the chip-8 core, run from the repository root
+//
+//   chip8bench [--roms DIR] [--out FILE] [--baseline FILE] [--threshold PCT]
+//
+// every benchmark is timed a few times and the fastest run is kept, results are written as json
+// and compared against a baseline written by an earlier run, slower than the threshold is a regression
+// before timing, every engine runs alu.rom to a frame limit and has to stop on it with the same state
+// bench/baseline.json only means something on the machine that wrote it, regenerate it with --out first
+//
+// workload roms in bench/
+//   alu.rom    register arithmetic, logic, shifts and I updates in a loop
+//   draw.rom   15, 8 and 4 line sprites at moving positions, clearing the screen every 256 passes
+//   calls.rom  a chain of 8 nested calls and returns
+//   timer.rom  sets the delay timer and spins on Fx07 until it runs out
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <chrono>
+
+#include "../chip8core.hpp"
+#include "../disasm.hpp"
+
+// each timing runs for at least this long, the best of BENCH_TRIALS is kept
+#define BENCH_MIN_TIME 0.1
+#define BENCH_TRIALS 3
+// default allowed slowdown against the baseline in percent
+#define BENCH_THRESHOLD 25
+
+struct BenchResult
+{
+    std::string name;
+    uint64_t ops;
+    double nsperop;
+};
+
+static const char *s_EngineNames[] = { "interpreter", "table", "goto", "threaded", "jit" };
+
+static std::vector<BenchResult> s_Results;
+
+// results of work that would otherwise be optimized away
+static volatile unsigned int s_Sink;
+
+static void addResult(std::string name, uint64_t ops, double seconds)
+{
+    BenchResult result;
+    result.name = name;
+    result.ops = ops;
+    result.nsperop = seconds * 1e9 / ops;
+
+    s_Results.push_back(result);
+
+    std::cout << std::left << std::setw(32) << name << std::right << std::fixed << std::setprecision(2);
+    std::cout << std::setw(10) << result.nsperop << " ns/op" << std::setw(14) << std::setprecision(0) << 1e9 / result.nsperop << " ops/sec\n";
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+// best time for job, which returns the ops it ran
+template <class Job> static void timeJob(std::string name, Job job)
+{
+    double best = 0;
+    uint64_t bestops = 0;
+
+    for(int trial = 0; trial < BENCH_TRIALS; trial++)
+    {
+        uint64_t ops = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        double seconds = 0;
+
+        while(seconds < BENCH_MIN_TIME)
+        {
+            ops += job();
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        if(!bestops || seconds / ops < best / bestops)
+        {
+            best = seconds;
+            bestops = ops;
+        }
+    }
+
+    addResult(name, bestops, best);
+}
+
+// a machine with one timer frame per a lot of instructions, so run() only measures the engine
+static Chip8Core *newMachine(DISPATCH_MODE engine)
+{
+    Chip8Core *chip = new Chip8Core;
+
+    chip->setDispatchMode(engine);
+    chip->setCPUFrequency(TIMER_FREQUENCY * 100000);
+    chip->setSeed(1);
+
+    return chip;
+}
+
+// run count instructions more, returns the instructions run
+static uint64_t runMore(Chip8Core *chip, uint64_t count)
+{
+    // a limit of 0 is no limit at all
+    if(!count) return 0;
+
+    chip->setCycleLimit(chip->getCycleCount() + count);
+    return chip->run();
+}
+
+static void benchDisassemble()
+{
+    timeJob("disassemble", [&]()
+    {
+        unsigned int len = 0;
+        for(unsigned int op = 0; op < 0x10000; op++) len += Chip8Core::disassemble(op).mnemonic.size();
+        s_Sink = len;
+        return uint64_t(0x10000);
+    });
+}
+
+// run a program at 0x200 with processInstruction(), the setup instructions are not timed
+static void benchProgram(std::string name, const std::vector<uint8_t> &program, unsigned int setup)
+{
+    Chip8Core *chip = newMachine(DISPATCH_INTERPRETER);
+    chip->loadProgram(&program[0], program.size());
+    runMore(chip, setup);
+
+    timeJob(name, [&]() { return runMore(chip, 100000);});
+
+    delete chip;
+}
+
+// opcodes repeated to fill most of memory and a jump back
+static void benchOpcode(std::string name, const std::vector<uint16_t> &setup, const std::vector<uint16_t> &body)
+{
+    std::vector<uint8_t> program;
+
+    for(unsigned int i = 0; i < setup.size(); i++)
+    {
+        program.push_back(setup[i] >> 8);
+        program.push_back(setup[i] & 0xff);
+    }
+
+    uint16_t loop = 0x200 + program.size();
+    while(program.size() + body.size() * 2 + 2 <= 0xc00)
+    {
+        for(unsigned int i = 0; i < body.size(); i++)
+        {
+            program.push_back(body[i] >> 8);
+            program.push_back(body[i] & 0xff);
+        }
+    }
+    program.push_back(0x10 | loop >> 8);
+    program.push_back(loop & 0xff);
+
+    benchProgram(name, program, setup.size());
+}
+
+static void benchOpcodes()
+{
+    std::vector<uint16_t> none;
+
+    benchOpcode("op_ld_kk", none, std::vector<uint16_t>(1, 0x6a5c));
+    benchOpcode("op_add_kk", none, std::vector<uint16_t>(1, 0x7a03));
+    benchOpcode("op_alu_xy", std::vector<uint16_t>(1, 0x6b07), std::vector<uint16_t>(1, 0x8ab4));
+    benchOpcode("op_shift", none, std::vector<uint16_t>(1, 0x8ab6));
+    benchOpcode("op_skip", none, std::vector<uint16_t>(1, 0x3a01));
+    benchOpcode("op_ld_i", none, std::vector<uint16_t>(1, 0xa300));
+    benchOpcode("op_add_i", std::vector<uint16_t>(1, 0xa000), std::vector<uint16_t>(1, 0xfa1e));
+    benchOpcode("op_rnd", none, std::vector<uint16_t>(1, 0xca7f));
+    benchOpcode("op_timer", none, std::vector<uint16_t>(1, 0xfa07));
+    benchOpcode("op_bcd", std::vector<uint16_t>(1, 0xae00), std::vector<uint16_t>(1, 0xfa33));
+    benchOpcode("op_store", std::vector<uint16_t>(1, 0xae00), std::vector<uint16_t>(1, 0xf755));
+    benchOpcode("op_load", std::vector<uint16_t>(1, 0xae00), std::vector<uint16_t>(1, 0xf765));
+    benchOpcode("op_cls", none, std::vector<uint16_t>(1, 0x00e0));
+
+    // sprites at an unaligned x so every row straddles two bytes
+    uint16_t setup[] = { 0x6a03, 0x6b05, 0xa000 };
+    uint8_t heights[] = { 1, 2, 4, 8, 15 };
+    for(int i = 0; i < 5; i++)
+    {
+        std::stringstream name;
+        name << "op_draw_h" << int(heights[i]);
+        benchOpcode(name.str(), std::vector<uint16_t>(setup, setup + 3), std::vector<uint16_t>(1, 0xdab0 | heights[i]));
+    }
+
+    // a lit screen cleared and redrawn
+    uint16_t drawcls[] = { 0xdabf, 0x00e0 };
+    benchOpcode("op_draw_h15_cls", std::vector<uint16_t>(setup, setup + 3), std::vector<uint16_t>(drawcls, drawcls + 2));
+
+    // hires, 16x16 sprites on one and on both planes
+    uint16_t hires[] = { 0x00ff, 0x6a03, 0x6b05, 0xa000, 0xf301 };
+    benchOpcode("op_draw_16x16", std::vector<uint16_t>(hires, hires + 4), std::vector<uint16_t>(1, 0xdab0));
+    benchOpcode("op_draw_16x16_planes2", std::vector<uint16_t>(hires, hires + 5), std::vector<uint16_t>(1, 0xdab0));
+
+    // scrolls of the whole hires screen
+    uint16_t scrolls[] = { 0x00c4, 0x00d4, 0x00fb, 0x00fc };
+    const char *scrollnames[] = { "op_scroll_down", "op_scroll_up", "op_scroll_right", "op_scroll_left" };
+    for(int i = 0; i < 4; i++) benchOpcode(scrollnames[i], std::vector<uint16_t>(hires, hires + 1), std::vector<uint16_t>(1, scrolls[i]));
+
+    // call 0x204, jump back to 0x200, return
+    uint8_t callret[] = { 0x22, 0x04, 0x12, 0x00, 0x00, 0xee };
+    benchProgram("op_call_ret", std::vector<uint8_t>(callret, callret + 6), 0);
+}
+
+static void benchAsm()
+{
+    // biggest rom there can be, random bytes so every opcode class shows up
+    const char *romfile = "bench_large.rom";
+    const char *asmfile = "bench_large.asm";
+    const unsigned int size = MAX_MEMORY - 0x200;
+
+    std::ofstream ofile(romfile, std::ios::binary);
+    uint32_t r = 1;
+    for(unsigned int i = 0; i < size; i++)
+    {
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        ofile.put(char(r));
+    }
+    ofile.close();
+
+    timeJob("asm_large", [&]()
+    {
+        // read, format and write like --asm-verbose does
+        std::vector<uint8_t> rom;
+        std::string text;
+
+        readROMFile(romfile, &rom);
+        formatROMASM(&rom[0], rom.size(), true, &text);
+        writeASMFile(asmfile, text);
+
+        return uint64_t(size / 2);
+    });
+
+    remove(romfile);
+    remove(asmfile);
+}
+
+static void benchWorkloads(std::string romdir)
+{
+    const char *roms[] = { "alu", "draw", "calls", "timer" };
+
+    for(int r = 0; r < 4; r++)
+    {
+        std::string romfile = romdir + "/" + roms[r] + ".rom";
+
+        for(int engine = DISPATCH_INTERPRETER; engine <= DISPATCH_JIT; engine++)
+        {
+            // the timer rom needs the nominal speed to poll at all
+            Chip8Core *chip = newMachine(DISPATCH_MODE(engine));
+            if(std::string(roms[r]) == "timer") chip->setCPUFrequency(CPU_FREQUENCY);
+
+            if(!chip->loadRom(romfile))
+            {
+                std::cout << "Error opening rom file:" << romfile << std::endl;
+                delete chip;
+                return;
+            }
+
+            // let the jit and threaded engines warm up before timing
+            runMore(chip, 100000);
+
+            std::string name = std::string("run_") + roms[r] + "_" + s_EngineNames[engine];
+            timeJob(name, [&]() { return runMore(chip, 1000000);});
+
+            delete chip;
+        }
+    }
+}
+
+// every engine stops exactly on the tick that reaches a frame limit and agrees on the state there,
+// batch runs compare these hashes, returns the number of mismatches
+static int checkFrameLimits(std::string romdir)
+{
+    const QUIRK_PROFILE profiles[] = { QUIRKS_MODERN, QUIRKS_VIP, QUIRKS_SCHIP, QUIRKS_XOCHIP };
+    const uint64_t limits[] = { 1, 10, 3000 };
+    std::string romfile = romdir + "/alu.rom";
+    int failures = 0;
+
+    for(int p = 0; p < 4; p++)
+    {
+        for(int l = 0; l < 3; l++)
+        {
+            uint64_t reference = 0;
+
+            // the threaded and jit engines both overrun batches through m_BatchOverrun, check them together
+            for(int engine = DISPATCH_INTERPRETER; engine <= DISPATCH_JIT; engine++)
+            {
+                // the nominal speed, few instructions per frame so blocks cross ticks
+                Chip8Core *chip = new Chip8Core;
+                chip->setDispatchMode(DISPATCH_MODE(engine));
+                chip->setQuirks(profiles[p]);
+                chip->setSeed(1);
+
+                if(!chip->loadRom(romfile))
+                {
+                    std::cout << "Error opening rom file:" << romfile << std::endl;
+                    delete chip;
+                    return failures + 1;
+                }
+
+                chip->setFrameLimit(limits[l]);
+                chip->run();
+
+                uint64_t hash = chip->hashState();
+                if(engine == DISPATCH_INTERPRETER) reference = hash;
+
+                if(chip->getCycleCount() != limits[l] * (CPU_FREQUENCY / TIMER_FREQUENCY) || hash != reference)
+                {
+                    std::cout << "FAILED frame limit " << limits[l] << " quirks " << p << " " << s_EngineNames[engine] << ": ";
+                    std::cout << chip->getCycleCount() << " cycles, hash " << std::hex << hash << std::dec << "\n";
+                    failures++;
+                }
+
+                delete chip;
+            }
+        }
+    }
+
+    return failures;
+}
+
+static bool writeJson(std::string filename)
+{
+    std::ofstream ofile(filename.c_str());
+
+    if(!ofile.is_open()) return false;
+
+    // one benchmark per line so readBaseline() does not need a json parser
+    ofile << "{\n  \"benchmarks\": [\n";
+    for(unsigned int i = 0; i < s_Results.size(); i++)
+    {
+        ofile << "    {\"name\": \"" << s_Results[i].name << "\", \"ops\": " << s_Results[i].ops;
+        ofile << ", \"ns_per_op\": " << std::fixed << std::setprecision(3) << s_Results[i].nsperop << "}";
+        ofile << (i + 1 < s_Results.size() ? ",\n" : "\n");
+    }
+    ofile << "  ]\n}\n";
+
+    return true;
+}
+
+static bool readBaseline(std::string filename, std::map<std::string, double> *baseline)
+{
+    std::ifstream ifile(filename.c_str());
+
+    if(!ifile.is_open()) return false;
+
+    std::string line;
+    while(std::getline(ifile, line))
+    {
+        size_t name = line.find("\"name\": \"");
+        size_t ns = line.find("\"ns_per_op\": ");
+        if(name == std::string::npos || ns == std::string::npos) continue;
+
+        name += 9;
+        (*baseline)[line.substr(name, line.find('"', name) - name)] = atof(line.c_str() + ns + 13);
+    }
+
+    return true;
+}
+
+// returns the number of regressions
+static int compareBaseline(const std::map<std::string, double> &baseline, double threshold)
+{
+    int regressions = 0;
+
+    std::cout << "\nAgainst baseline, positive is slower:\n";
+
+    for(unsigned int i = 0; i < s_Results.size(); i++)
+    {
+        std::map<std::string, double>::const_iterator it = baseline.find(s_Results[i].name);
+        if(it == baseline.end() || it->second <= 0) continue;
+
+        double change = (s_Results[i].nsperop / it->second - 1.0) * 100.0;
+        bool regressed = change > threshold;
+        if(regressed) regressions++;
+
+        std::cout << std::left << std::setw(32) << s_Results[i].name << std::right << std::fixed << std::setprecision(1);
+        std::cout << std::setw(8) << change << "%" << (regressed ? "  REGRESSION" : "") << "\n";
+        std::cout.unsetf(std::ios::floatfield);
+    }
+
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string romdir = "bench";
+    std::string outfile;
+    std::string baselinefile;
+    double threshold = BENCH_THRESHOLD;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasvalue = (i + 1 < argc);
+
+        if(arg == "--roms" && hasvalue) romdir = argv[++i];
+        else if(arg == "--out" && hasvalue) outfile = argv[++i];
+        else if(arg == "--baseline" && hasvalue) baselinefile = argv[++i];
+        else if(arg == "--threshold" && hasvalue) threshold = atof(argv[++i]);
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--roms DIR] [--out FILE] [--baseline FILE] [--threshold PCT]\n";
+            return 1;
+        }
+    }
+
+    // a wrong result is worse than a slow one, check before timing anything
+    int failures = checkFrameLimits(romdir);
+    if(failures)
+    {
+        std::cout << failures << " engine runs did not stop on the frame limit\n";
+        return 3;
+    }
+
+    benchDisassemble();
+    benchOpcodes();
+    benchAsm();
+    benchWorkloads(romdir);
+
+    if(!outfile.empty() && !writeJson(outfile))
+    {
+        std::cout << "Error opening file for writing:" << outfile << std::endl;
+        return 1;
+    }
+
+    if(!baselinefile.empty())
+    {
+        std::map<std::string, double> baseline;
+
+        if(!readBaseline(baselinefile, &baseline))
+        {
+            std::cout << "Error reading baseline:" << baselinefile << std::endl;
+            return 1;
+        }
+
+        int regressions = compareBaseline(baseline, threshold);
+        std::cout << regressions << " regressions over " << std::fixed << std::setprecision(1) << threshold << "%\n";
+
+        if(regressions) return 2;
+    }
+
+    return 0;
+}
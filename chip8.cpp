@@ -1,7 +1,13 @@
 #include "chip8.hpp"
+#include "rewind.hpp"
+#include "inputlog.hpp"
+#include "profiler.hpp"
+#include "latency.hpp"
+#include "disasm.hpp"
+#include "codemap.hpp"
+#include "audio.hpp"
 #include <math.h>
-#include <time.h>
-#include <fstream>
+#include <string.h>
 #include <sstream>
 #include <iomanip>
 
@@ -10,103 +16,144 @@
 
 Chip8::Chip8()
 {
-    // init random seed
-    srand( time(NULL));
-
     m_Screen = NULL;
     m_RenderInitialized = false;
-    m_CPUTickDelayCounter = 0;
     m_LastTickTime = 0;
+    m_BudgetRemainder = 0;
+    m_BudgetOverrun = 0;
     m_RunCPU = false;
     m_RunRender = false;
-    m_isPaused = false;
+    m_ResetRequested = false;
+    m_SaveRequested = false;
+    m_LoadRequested = false;
+    m_StepBackRequested = false;
     m_doStep = false;
     m_doRender = true;
+    m_PacingMode = PACING_VSYNC;
+    m_PacingHz = TIMER_FREQUENCY;
 
-    // init memory, registers, stack
-    for(int i = 0; i < MAX_MEMORY; i++) m_Mem[i] = 0x0;
-    for(int i = 0; i < MAX_REGISTERS; i++) m_Reg[i] = 0x0;
+    // the sound device is opened by start()
+    m_doAudio = true;
+    m_Audio = NULL;
 
-    m_IReg = 0x0;
-    m_DelayReg = 0x0;
-    m_SoundReg = 0x0;
-    m_PCounter = 0x0;
+    m_RewindHeld = false;
 
-    // init key state
-    m_KeyState = 0x0;
+    // labels for the debug overlay
+    m_CodeMap = NULL;
 
-    // initial instructions
-    // clear screen
-    m_Mem[0x00] = 0x00;
-    m_Mem[0x01] = 0xe0;
-    // jump to address 0x0200
-    m_Mem[0x02] = 0x12;
-    m_Mem[0x03] = 0x00;
+    // init frame buffers, the cpu starts on buffer 0, middle is 1, render reads 2
+    for(int i = 0; i < 3; i++) m_Frames[i] = DisplayFrame();
+    m_FrameBack = 0;
+    m_FrameState = 1;
+    m_FrameFront = 2;
 
+    // threads are created by start(), batch instances never need them
+    m_CPUThread = NULL;
+    m_RenderThread = NULL;
+}
 
-    // store fonts (80 bytes = 16 characters * 5 bytes) in memory
-    // store at mem 0x01af to allow for 80 bytes, stopping before 0x0200
-    for(int i = 0; i < 80; i++)
+Chip8::~Chip8()
+{
+    delete m_CPUThread;
+    delete m_RenderThread;
+    delete m_CodeMap;
+    delete m_Audio;
+}
+
+void Chip8::reset()
+{
+    // the cpu thread owns the machine state, let it reset between batches
+    if(m_RunCPU)
     {
-        m_Mem[FONT_ADDR + i] = sysfonts[i];
+        std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+        m_ResetRequested = true;
+        m_SchedulerWake.notify_all();
     }
+    else resetMachine();
+}
 
-
-    // init display
-    for(int i = 0; i < DISPLAY_HEIGHT; i++)
+void Chip8::quickSave()
+{
+    if(m_RunCPU)
     {
-        for(int n = 0; n < DISPLAY_WIDTH; n++) m_Display[i][n] = false;
+        std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+        m_SaveRequested = true;
+        m_SchedulerWake.notify_all();
     }
-
-    // create threads
-    m_CPUThread = new sf::Thread(&Chip8::CPULoop, this);
-    m_RenderThread = new sf::Thread(&Chip8::renderLoop, this);
+    else saveStateFile(STATE_QUICK_FILE);
 }
 
-Chip8::~Chip8()
+void Chip8::quickLoad()
 {
-
+    if(m_RunCPU)
+    {
+        std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+        m_LoadRequested = true;
+        m_SchedulerWake.notify_all();
+    }
+    else loadStateFile(STATE_QUICK_FILE);
 }
 
-void Chip8::reset()
+void Chip8::stepBack()
 {
-    m_Chip8Mutex.lock();
-    m_DelayMutex.lock();
-
-    // init random seed
-    srand( time(NULL));
-
-    // reset vars
-    m_CPUTickDelayCounter = 0;
-    m_LastTickTime = 0;
-
-    m_IReg = 0x0;
-    m_DelayReg = 0x0;
-    m_SoundReg = 0x0;
-    m_PCounter = 0x0;
-
-    // clear registers
-    for(int i = 0; i < MAX_REGISTERS; i++) m_Reg[i] = 0x0;
+    std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+    if(m_isPaused) m_StepBackRequested = true;
+    m_SchedulerWake.notify_all();
+}
 
-    // init key state
-    m_KeyState = 0x0;
+void Chip8::serviceRequests()
+{
+    // reset, save and load requested by the render thread, run between batches
+    if(m_ResetRequested)
+    {
+        m_ResetRequested = false;
+        Chip8Core::reset();
+        m_LastTickTime = 0;
+        if(m_doRender) publishFrame();
+    }
 
-    // clear display
-    for(int i = 0; i < DISPLAY_HEIGHT; i++)
+    if(m_SaveRequested)
     {
-        for(int n = 0; n < DISPLAY_WIDTH; n++) m_Display[i][n] = false;
+        m_SaveRequested = false;
+        if(saveStateFile(STATE_QUICK_FILE)) std::cout << "Saved state to " << STATE_QUICK_FILE << "\n";
+        else std::cout << "Error saving state file:" << STATE_QUICK_FILE << std::endl;
     }
 
-    // pop stack
-    while(!m_Stack.empty()) m_Stack.pop_back();
+    if(m_LoadRequested)
+    {
+        m_LoadRequested = false;
+        if(loadStateFile(STATE_QUICK_FILE))
+        {
+            std::cout << "Loaded state from " << STATE_QUICK_FILE << "\n";
+            if(m_doRender) publishFrame();
 
-    m_DelayMutex.unlock();
-    m_Chip8Mutex.unlock();
+            // the loaded state has its own history
+            if(m_Rewind) m_Rewind->clear();
+        }
+        else std::cout << "Error loading state file:" << STATE_QUICK_FILE << std::endl;
+    }
 
+    if(m_StepBackRequested)
+    {
+        m_StepBackRequested = false;
+        stepBackMachine();
+        if(m_doRender) publishFrame();
+    }
 }
 
 void Chip8::start()
 {
+    // create threads
+    if(!m_CPUThread) m_CPUThread = new sf::Thread(&Chip8::CPULoop, this);
+    if(!m_RenderThread) m_RenderThread = new sf::Thread(&Chip8::renderLoop, this);
+
+    // the stream plays silence until the cpu thread renders the first batch
+    if(m_doRender && m_doAudio && !m_Audio)
+    {
+        m_Audio = new AudioOutput;
+        m_Audio->play();
+    }
+
     m_CPUThread->launch();
     if(m_doRender) m_RenderThread->launch();
 
@@ -118,645 +165,115 @@ void Chip8::start()
         m_RenderThread->wait();
     }
 
+    if(m_Latency) m_Latency->printReport(std::cout);
+
+    if(m_Audio)
+    {
+        m_Audio->stop();
+        std::cout << "Audio underruns: " << m_Audio->getUnderruns() << ", trimmed " << m_Audio->getTrimmed() << " samples, ";
+        std::cout << "at most " << m_Audio->getPeakQueued() * 1000 / AUDIO_SAMPLE_RATE << "ms queued before the device buffers\n";
+        delete m_Audio;
+        m_Audio = NULL;
+    }
+
     std::cout << "Shutdown done.\n";
 }
 
 void Chip8::shutdown()
 {
     std::cout << "Shutting down...\n";
+
+    std::lock_guard<std::mutex> lock(m_SchedulerMutex);
     m_RunCPU = false;
     m_RunRender = false;
+    m_SchedulerWake.notify_all();
 }
 
-std::string Chip8::getDisassembledString(Instruction *inst)
+void Chip8::pause(bool npause)
 {
-    std::stringstream dss;
-
-    if(inst->mnemonic.empty()) inst->mnemonic = "UNK";
-
-    // memory address
-    dss << std::hex << std::setfill('0') << std::setw(4) << int(inst->addr) << " ";
-    // opcode
-    dss << std::setfill('0') << std::setw(4) << int(inst->opcode) << " ";
-    // mnemonic
-    dss << std::left << std::setfill(' ') << std::setw(7) << inst->mnemonic << " ";
-    // vars
-    dss << inst->vars;
-
-    return dss.str();
+    std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+    m_isPaused = npause;
+    m_SchedulerWake.notify_all();
 }
 
-Instruction Chip8::disassembleAtAddr(uint16_t addr)
+bool Chip8::step()
 {
-    // get opcode from memory address
-    uint16_t opcode = m_Mem[addr] << 8 | m_Mem[addr+1];
-
-    // disassemble opcode
-    Instruction inst = disassemble(opcode);
-
-    // store address
-    inst.addr = addr;
+    std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+    if(m_isPaused) m_doStep = true;
+    m_SchedulerWake.notify_all();
 
-    return inst;
+    return m_doStep;
 }
 
-Instruction Chip8::disassemble(uint16_t opcode)
+void Chip8::waitWhilePaused()
 {
-    Instruction dinst;
-
-    std::stringstream varss;
-
-    // set opcode
-    dinst.opcode = opcode;
-
-    // first nibble is op
-    dinst.op = (dinst.opcode & 0xf000) >> 12;
-    // the rest of the 12-bits can be a value or address
-    dinst.nnn = (dinst.opcode & 0x0fff);
-    // the last nibble
-    dinst.n = (dinst.opcode & 0x000f);
-    // second nibble
-    dinst.x = (dinst.opcode & 0x0f00) >> 8;
-    // third nibble
-    dinst.y = (dinst.opcode & 0x00f0) >> 4;
-    // last byte
-    dinst.kk = (dinst.opcode & 0x00ff);
-
-    if(dinst.op == 0x0)
-    {
-        // 00e0 - clear display
-        if(dinst.opcode == 0x00e0) dinst.mnemonic = "CLS";
-        // 00ee - return from subroutine, pop stack
-        else if(dinst.opcode == 0x00ee) dinst.mnemonic = "RET";
-    }
-    // jump - set program counter to nnn
-    else if(dinst.op == 0x1)
-    {
-        dinst.mnemonic = "JUMP";
-        varss << std::hex << "$" << std::setfill('0') << std::setw(4) << int(dinst.nnn);
-        dinst.vars = varss.str();
-    }
-    // call address - call subroutine at nnn
-    // put current pcounter on top of stack, then set pcounter to nnn
-    else if(dinst.op == 0x2)
-    {
-        dinst.mnemonic = "CALL";
-        varss << "$" << std::hex << std::setfill('0') << std::setw(4) << int(dinst.nnn);
-        dinst.vars = varss.str();
-    }
-    // skip if register x == kk, increment program counter by 2
-    else if(dinst.op == 0x3)
-    {
-        dinst.mnemonic = "SKIP.E";
-        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
-        dinst.vars = varss.str();
-    }
-    // skip if register x != kk, increment program counter by 2
-    else if(dinst.op == 0x4)
-    {
-        dinst.mnemonic = "SKIP.NE";
-        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
-        dinst.vars = varss.str();
-    }
-    // skip if register x is equal to register y
-    else if(dinst.op == 0x5)
-    {
-        dinst.mnemonic = "SKIP.E";
-        varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-        dinst.vars = varss.str();
-    }
-    // put value of kk into register x
-    else if(dinst.op == 0x6)
-    {
-        dinst.mnemonic = "MOV";
-        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
-        dinst.vars = varss.str();
-    }
-    // add kk to register x
-    else if(dinst.op == 0x7)
-    {
-        dinst.mnemonic = "ADD";
-        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
-        dinst.vars = varss.str();
-    }
-    // register operations
-    else if(dinst.op == 0x8)
-    {
-        // EQUAL, stores reg y into reg x
-        if(dinst.n == 0x0)
-        {
-            dinst.mnemonic = "MOV";
-            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-            dinst.vars = varss.str();
-        }
-        // OR, reg x = reg x OR reg y
-        else if(dinst.n == 0x1)
-        {
-            dinst.mnemonic = "OR";
-            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-            dinst.vars = varss.str();
-        }
-        // AND, reg x = reg x AND reg y
-        else if(dinst.n == 0x2)
-        {
-            dinst.mnemonic = "AND";
-            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-            dinst.vars = varss.str();
-        }
-        // XOR, reg x = reg x XOR reg y
-        else if(dinst.n == 0x3)
-        {
-            dinst.mnemonic = "XOR";
-            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-            dinst.vars = varss.str();
-        }
-        // ADD, reg x = reg x + reg y
-        else if(dinst.n == 0x4)
-        {
-            dinst.mnemonic = "ADD";
-            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-            dinst.vars = varss.str();
-        }
-        // SUB, reg x = vx - vy
-        else if(dinst.n == 0x5)
-        {
-            dinst.mnemonic = "SUB";
-            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-            dinst.vars = varss.str();
-        }
-        // SHR (shift right), vx = vx / 2
-        else if(dinst.n == 0x6)
-        {
-            dinst.mnemonic = "SHR";
-            varss << std::hex << "V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // SUBN, reg x = reg y - reg x
-        else if(dinst.n == 0x7)
-        {
-            dinst.mnemonic = "SUBB";
-            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-            dinst.vars = varss.str();
-
-        }
-        // SHL (shift left), reg x = reg x * 2
-        else if(dinst.n == 0xe)
-        {
-            dinst.mnemonic = "SHL";
-            varss << std::hex << "V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-    }
-    else if(dinst.op == 0x9)
-    {
-        dinst.mnemonic = "SKIP.NE";
-        varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
-        dinst.vars = varss.str();
-    }
-    // set register I = nnn
-    else if(dinst.op == 0xa)
-    {
-        dinst.mnemonic = "MOV";
-        varss << std::hex << "I, #$" << int(dinst.nnn);
-        dinst.vars = varss.str();
-    }
-    // JUMP to location nnn + v0
-    else if(dinst.op == 0xb)
-    {
-        dinst.mnemonic = "JUMP";
-        varss << std::hex << "V0, #$" << int(dinst.nnn);
-        dinst.vars = varss.str();
-
-    }
-    // RANDOM 0-255, then AND with kk and store in reg x
-    else if(dinst.op == 0xc)
-    {
-        dinst.mnemonic = "RNDMSK";
-        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
-        dinst.vars = varss.str();
-
-    }
-    // DRAW n-byte height sprite starting at mem location reg I at regx,regy pixels
-    else if(dinst.op == 0xd)
-    {
-        dinst.mnemonic = "DRW";
-        varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y) << ", #$" << int(dinst.n);
-        dinst.vars = varss.str();
-    }
-    else if(dinst.op == 0xe)
-    {
-        // skip next instruction if key value in reg x is pressed
-        if(dinst.kk == 0x9e)
-        {
-            dinst.mnemonic = "SKIP.KY";
-            varss << std::hex << "V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // skip next instruction if key value in reg x is not pressed
-        else if(dinst.kk == 0xa1)
-        {
-            dinst.mnemonic = "SKIP.KN";
-            varss << std::hex << "V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-    }
-    else if(dinst.op == 0xf)
-    {
-        // reg x = value of delay timer
-        if(dinst.kk == 0x07)
-        {
-            dinst.mnemonic = "MOV";
-            varss << std::hex << "V" << int(dinst.x) << ", DELAY";
-            dinst.vars = varss.str();
-        }
-        // wait for key press, then store key press in vx
-        else if(dinst.kk == 0x0a)
-        {
-            dinst.mnemonic = "WAITKEY";
-            varss << std::hex << "V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // set delay timer to value in reg x
-        else if(dinst.kk == 0x15)
-        {
-            dinst.mnemonic = "MOV";
-            varss << std::hex << "DELAY, V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // set sound timer to value of reg x
-        else if(dinst.kk == 0x18)
-        {
-            dinst.mnemonic = "MOV";
-            varss << std::hex << "SOUND, V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // values of reg I and reg x are added and stored in reg i
-        else if(dinst.kk == 0x1e)
-        {
-            dinst.mnemonic = "ADD";
-            varss << std::hex << "I, V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // font, set I to location of sprite associated with value in reg x
-        else if(dinst.kk == 0x29)
-        {
-            dinst.mnemonic = "FONT";
-            varss << std::hex << "I, V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // store BCD of vx in memory locations of I, I+1, and I+2
-        else if(dinst.kk == 0x33)
-        {
-            dinst.mnemonic = "MOV.BCD";
-            varss << std::hex << "V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // store register reg 0 through reg x in memory starting at location in reg i
-        else if(dinst.kk == 0x55)
-        {
-            dinst.mnemonic = "MOV.MEM";
-            varss << std::hex << "I, V" << int(dinst.x);
-            dinst.vars = varss.str();
-        }
-        // read values from memory starting at location i into registers reg 0 through reg x
-        else if(dinst.kk == 0x65)
-        {
-            dinst.mnemonic = "MOV.MEM";
-            varss << std::hex << "V" << int(dinst.x) << ", I";
-            dinst.vars = varss.str();
-        }
-    }
-
-    return dinst;
+    std::unique_lock<std::mutex> lock(m_SchedulerMutex);
+    while(m_isPaused && !m_doStep && !m_ResetRequested && !m_SaveRequested && !m_LoadRequested && !m_StepBackRequested && m_RunCPU) m_SchedulerWake.wait(lock);
 }
 
-bool Chip8::processInstruction(Instruction inst)
+void Chip8::publishFrame()
 {
-    m_Chip8Mutex.lock();
-    m_DelayMutex.lock();
+    DisplayFrame &frame = m_Frames[m_FrameBack];
 
-    // advance program counter
-    m_PCounter += 2;
+    memcpy(frame.rows, m_State->display, sizeof(frame.rows));
+    frame.hires = m_State->hires;
 
-    // if program counter reached the end of memory, decrement back and pause
-    if(m_PCounter >= MAX_MEMORY)
-    {
-        m_PCounter -=2;
-        m_isPaused = true;
-        return false;
-    }
+    for(int i = 0; i < MAX_REGISTERS; i++) frame.reg[i] = m_State->reg[i];
+    frame.ireg = m_State->ireg;
+    frame.pc = m_State->pc;
+    frame.delay = m_State->delay;
+    frame.sound = m_State->sound;
+    frame.keys = m_KeyState;
+    frame.ticktime = m_LastTickTime;
+    frame.generation = m_DisplayGeneration;
 
-    if(inst.op == 0x0)
-    {
-        // 00e0 - clear display
-        if(inst.opcode == 0x00e0)
-        {
-            for(int iy = 0; iy < DISPLAY_HEIGHT; iy++)
-                for(int nx = 0; nx < DISPLAY_WIDTH; nx++) m_Display[iy][nx] = false;
-        }
-        // 00ee - return from subroutine, pop stack
-        else if(inst.opcode == 0x00ee)
-        {
-            if(!m_Stack.empty())
-            {
-                m_PCounter = m_Stack.back();
-                m_Stack.pop_back();
-            }
-            else m_isPaused = true;
-        }
-    }
-    // jump - set program counter to nnn
-    else if(inst.op == 0x1)
-    {
-        m_PCounter = inst.nnn;
-    }
-    // call address - call subroutine at nnn
-    // put current pcounter on top of stack, then set pcounter to nnn
-    else if(inst.op == 0x2)
-    {
-        m_Stack.push_back(m_PCounter);
-        m_PCounter = inst.nnn;
-    }
-    // skip if register x == kk, increment program counter by 2
-    else if(inst.op == 0x3)
-    {
-        if(m_Reg[inst.x] == inst.kk) m_PCounter += 2;
-    }
-    // skip if register x != kk, increment program counter by 2
-    else if(inst.op == 0x4)
-    {
-        if(m_Reg[inst.x] != inst.kk) m_PCounter += 2;
-    }
-    // skip if register x is equal to register y
-    else if(inst.op == 0x5)
-    {
-        if(m_Reg[inst.x] == m_Reg[inst.y]) m_PCounter += 2;
-    }
-    // put value of kk into register x
-    else if(inst.op == 0x6)
-    {
-        m_Reg[inst.x] = inst.kk;
-    }
-    // add kk to register x
-    else if(inst.op == 0x7)
-    {
-        m_Reg[inst.x] = m_Reg[inst.x] + inst.kk;
-    }
-    // register operations
-    else if(inst.op == 0x8)
-    {
-        // EQUAL, stores reg y into reg x
-        if(inst.n == 0x0)
-        {
-            m_Reg[inst.x] = m_Reg[inst.y];
-        }
-        // OR, reg x = reg x OR reg y
-        else if(inst.n == 0x1)
-        {
-            m_Reg[inst.x] = m_Reg[inst.x] | m_Reg[inst.y];
-        }
-        // AND, reg x = reg x AND reg y
-        else if(inst.n == 0x2)
-        {
-            m_Reg[inst.x] = m_Reg[inst.x] & m_Reg[inst.y];
-        }
-        // XOR, reg x = reg x XOR reg y
-        else if(inst.n == 0x3)
-        {
-            m_Reg[inst.x] = m_Reg[inst.x] ^ m_Reg[inst.y];
-        }
-        // ADD, reg x = reg x + reg y
-        else if(inst.n == 0x4)
-        {
-            unsigned int result = m_Reg[inst.x] + m_Reg[inst.y];
-
-            // if result overflows register
-            if(result > 0xff)
-            {
-                // set result to lower 8 bits
-                result = result & 0xff;
-                // set carry flag
-                m_Reg[0xf] = 0x1;
-            }
-            else m_Reg[0xf] = 0x0;
+    frame.stacksize = m_State->stacksize;
+    for(int i = 0; i < frame.stacksize; i++) frame.stack[i] = m_State->stack[i];
 
-            m_Reg[inst.x] = result;
-        }
-        // SUB, reg x = vx - vy
-        else if(inst.n == 0x5)
-        {
-            // set not borrow flag if reg x > reg y
-            if(m_Reg[inst.x] > m_Reg[inst.y]) m_Reg[0xf] = 0x1;
-            else m_Reg[0xf] = 0x0;
-
-            m_Reg[inst.x] = m_Reg[inst.x] - m_Reg[inst.y];
-        }
-        // SHR (shift right), vx = vx / 2
-        else if(inst.n == 0x6)
-        {
-            // if odd number
-            if(m_Reg[inst.x] & 0x1) m_Reg[0xf] = 0x1;
-            else m_Reg[0xf] = 0x0;
+    for(int i = 0; i < 16; i++) frame.code[i] = (m_State->pc + i < memorySize(m_State->quirks)) ? m_State->mem[m_State->pc + i] : 0x0;
 
-            m_Reg[inst.x] = m_Reg[inst.x] >> 1;
-        }
-        // SUBN, reg x = reg y - reg x
-        else if(inst.n == 0x7)
-        {
-            // set not borrow flag if reg y > reg x
-            if(m_Reg[inst.y] > m_Reg[inst.x]) m_Reg[0xf] = 0x1;
-            else m_Reg[0xf] = 0x0;
-
-            m_Reg[inst.x] = m_Reg[inst.y] - m_Reg[inst.x];
-        }
-        // SHL (shift left), reg x = reg x * 2
-        else if(inst.n == 0xe)
-        {
-            if(0x80 & m_Reg[inst.x]) m_Reg[0xf] = 0x1;
-            else m_Reg[0xf] = 0x0;
-
-            m_Reg[inst.x] = m_Reg[inst.x] << 1;
-        }
-    }
-    else if(inst.op == 0x9)
-    {
-        // skip next instruction if reg x != reg y
-        if(inst.n == 0x0)
-        {
-            if(m_Reg[inst.x] != m_Reg[inst.y]) m_PCounter += 2;
-        }
-    }
-    // set register I = nnn
-    else if(inst.op == 0xa)
-    {
-        m_IReg = inst.nnn;
-    }
-    // JUMP to location nnn + v0
-    else if(inst.op == 0xb)
-    {
-        m_PCounter = inst.nnn + m_Reg[0x0];
-    }
-    // RANDOM 0-255, then AND with kk and store in reg x
-    else if(inst.op == 0xc)
+    frame.profiled = m_Profiler != NULL;
+    if(m_Profiler)
     {
-        m_Reg[inst.x] = (rand()%256)&inst.kk;
+        m_Profiler->getHeatmap(frame.heat, HEATMAP_MEMORY);
+        m_Profiler->getHottest(frame.hot, PROFILE_HOT_ADDRS);
     }
-    // DRAW n-byte height sprite starting at mem location reg I at regx,regy pixels
-    else if(inst.op == 0xd)
-    {
-        // check bounds of register x and register y
-        if(m_Reg[inst.x] >= 0 && m_Reg[inst.y] >= 0 && m_Reg[inst.x] < DISPLAY_WIDTH && m_Reg[inst.y] < DISPLAY_HEIGHT)
-        {
-            // for each sprite row
-            for(int ny = 0; ny < inst.n; ny++)
-            {
-                // for each pixel in row
-                for(int nx = 0; nx < 8; nx++)
-                {
-                    // current pixel
-                    int px = nx + m_Reg[inst.x];
-                    int py = ny + m_Reg[inst.y];
-
-                    // check sprite bit for pixel on or off
-                    bool pon = (m_Mem[m_IReg + ny] >> (7-nx)) & 0x1;
-
-                    // wrap pixel coordinates
-                    // note : for now, not implementing wrapping
-                    if(px >= DISPLAY_WIDTH) continue;
-                    if(py >= DISPLAY_HEIGHT) continue;
 
-                    // XOR pixel state with display
-                    if(pon != m_Display[py][px]) m_Display[py][px] = true;
-                    else m_Display[py][px] = false;
-
-
-                }
-            }
-        }
-    }
-    else if(inst.op == 0xe)
-    {
-        // skip next instruction if key value in reg x is pressed
-        if(inst.kk == 0x9e)
-        {
-            if( m_KeyState >> m_Reg[inst.x] & 0x01 ) m_PCounter += 2;
-        }
-        // skip next instruction if key value in reg x is not pressed
-        else if(inst.kk == 0xa1)
-        {
-            if( !(m_KeyState >> m_Reg[inst.x] & 0x01) ) m_PCounter += 2;
-        }
-    }
-    else if(inst.op == 0xf)
-    {
-        // reg x = value of delay timer
-        if(inst.kk == 0x07)
-        {
-            m_Reg[inst.x] = m_DelayReg;
-        }
-        // wait for key press, then store key press in vx
-        else if(inst.kk == 0x0a)
-        {
-            // if no keys are pressed, do not advance program counter
-            if(m_KeyState == 0x00) m_PCounter -= 2;
-            // else store keystate in vx
-            m_Reg[inst.x] = m_KeyState;
-        }
-        // set delay timer to value in reg x
-        else if(inst.kk == 0x15)
-        {
-            m_DelayReg = m_Reg[inst.x];
-        }
-        // set sound timer to value of reg x
-        else if(inst.kk == 0x18)
-        {
-            m_SoundReg = m_Reg[inst.x];
-        }
-        // values of reg I and reg x are added and stored in reg i
-        else if(inst.kk == 0x1e)
-        {
-            m_IReg += m_IReg + m_Reg[inst.x];
-        }
-        // font, set I to location of sprite associated with value in reg x
-        else if(inst.kk == 0x29)
-        {
-            if(m_Reg[inst.x] <= 0xf)
-            {
-                m_IReg = FONT_ADDR + (m_Reg[inst.x]*5);
-            }
-
-        }
-        // store BCD of vx in memory locations of I, I+1, and I+2
-        else if(inst.kk == 0x33)
-        {
-            // binary coded decimal
-            uint8_t val = m_Reg[inst.x];
-            // ones
-            m_Mem[m_IReg] = val%10;
-            // tens
-            m_Mem[m_IReg+1] = (val/10)%10;
-            // hundreds
-            m_Mem[m_IReg+2] = (val/10/10)%10;
-        }
-        // store register reg 0 through reg x in memory starting at location in reg i
-        else if(inst.kk == 0x55)
-        {
-            if(m_Reg[inst.x] < MAX_REGISTERS)
-            {
-                for(int j = 0; j <= m_Reg[inst.x]; j++)  m_Mem[m_IReg + j] = m_Reg[j];
-            }
-
-        }
-        // read values from memory starting at location i into registers reg 0 through reg x
-        else if(inst.kk == 0x65)
-        {
-            if(m_Reg[inst.x] < MAX_REGISTERS)
-            {
-                for(int j = 0; j <= m_Reg[inst.x]; j++)  m_Reg[j] = m_Mem[m_IReg + j];
-            }
-        }
-    }
-
-    m_Chip8Mutex.unlock();
-    m_DelayMutex.unlock();
-
-    return true;
+    // hand the filled buffer over and take back the old middle one
+    uint8_t prev = m_FrameState.exchange(m_FrameBack | 0x4, std::memory_order_acq_rel);
+    m_FrameBack = prev & 0x3;
 }
 
-bool Chip8::executeNextInstruction()
+const DisplayFrame &Chip8::acquireFrame(bool *fresh)
 {
-    if( processInstruction( disassembleAtAddr(m_PCounter) ) )
+    bool swapped = false;
+
+    // swap in the newest frame if there is one, else keep showing the current one
+    if(m_FrameState.load(std::memory_order_relaxed) & 0x4)
     {
-        return true;
+        uint8_t prev = m_FrameState.exchange(m_FrameFront, std::memory_order_acq_rel);
+        m_FrameFront = prev & 0x3;
+        swapped = true;
     }
 
-    return false;
+    if(fresh) *fresh = swapped;
+
+    return m_Frames[m_FrameFront];
 }
 
-bool Chip8::loadRom(std::string filename, uint16_t addr)
+Instruction Chip8::disassembleAtAddr(uint16_t addr)
 {
+    // get opcode from memory address
+    uint16_t opcode = getMemAt(addr) << 8 | getMemAt(addr + 1);
 
-    std::ifstream ifile;
-
-    ifile.open(filename.c_str(), std::ios::binary);
-
-    if(!ifile.is_open()) return false;
-
-    m_Chip8Mutex.lock();
-    while(!ifile.eof())
-    {
-        unsigned char b;
-
-        b = ifile.get();
-
-        m_Mem[addr] = uint8_t(b);
-        addr++;
-    }
-    m_Chip8Mutex.unlock();
+    // disassemble opcode
+    Instruction inst = disassemble(opcode);
+    if(m_CodeMap) m_CodeMap->labelInstruction(&inst);
 
-    ifile.close();
+    // store address
+    inst.addr = addr;
 
-    return true;
+    return inst;
 }
 
 bool Chip8::initRender()
@@ -765,79 +282,207 @@ bool Chip8::initRender()
 
     // create render window
     m_Screen = new sf::RenderWindow(sf::VideoMode(DISPLAY_WIDTH * DISPLAY_SCALE, DISPLAY_HEIGHT * DISPLAY_SCALE, 32), "Chip-8");
+    m_Screen->setVerticalSyncEnabled(m_PacingMode == PACING_VSYNC);
 
     m_Font.loadFromFile("font.ttf");
 
+    // screen texture, one texel per chip-8 pixel scaled up by the sprite
+    // lores only uses the top left of it, see updateScreenTexture()
+    m_ScreenTexture.create(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    m_ScreenTexture.setSmooth(false);
+    m_ScreenSprite.setTexture(m_ScreenTexture, true);
+    m_ScreenSprite.setScale(DISPLAY_SCALE, DISPLAY_SCALE);
+
+    // profiler heatmap, 32 bytes a row fills the strip left of the debug pane
+    m_HeatTexture.create(32, HEATMAP_MEMORY / 32);
+    m_HeatTexture.setSmooth(false);
+    m_HeatSprite.setTexture(m_HeatTexture, true);
+    m_HeatSprite.setScale(2, 2);
+
     m_RenderInitialized = true;
 
     return true;
 }
 
+bool Chip8::setFramePacing(PACING_MODE mode, unsigned int hz)
+{
+    // vsync is set up with the window
+    if(m_RenderInitialized || hz == 0) return false;
+
+    m_PacingMode = mode;
+    m_PacingHz = hz;
+
+    return true;
+}
 
 void Chip8::CPULoop()
 {
     m_RunCPU = true;
 
+    sf::Clock runclock;
+    uint64_t startcycles = m_State->cycles;
+    uint64_t startframes = m_State->frames;
+
+    // absolute deadline of the next 60Hz frame, so sleep overshoot does not accumulate
+    const sf::Int64 frametime = 1000000 / TIMER_FREQUENCY;
+    sf::Clock schedclock;
+    sf::Int64 nextframe = 0;
+    sf::Int64 lastpublish = 0;
+    const sf::Int64 slicetime = frametime / FRAME_SLICES;
+    unsigned int slice = 0;
+
+    m_CPUClock.restart();
+
     while(m_RunCPU)
     {
+        if(limitReached())
+        {
+            shutdown();
+            break;
+        }
+
+        serviceRequests();
 
         if(m_isPaused)
         {
-            if(m_doStep)
+            // nothing can resume a halted cpu without a render window
+            if(!m_doRender)
             {
-                // process current instruction at program counter
-                executeNextInstruction();
-
-                // tick for delay counter
-                m_CPUTickDelayCounter++;
-                // delay counter 60Hz (540Hz / 60Hz = 9)
-                if(m_CPUTickDelayCounter >= 9)
-                {
-                    m_CPUTickDelayCounter = 0;
+                std::cout << "CPU halted at 0x" << std::hex << m_State->pc << std::dec << ".\n";
+                shutdown();
+                break;
+            }
 
-                    m_DelayMutex.lock();
-                    if(m_DelayReg > 0) m_DelayReg--;
-                    if(m_SoundReg > 0) m_SoundReg--;
-                    m_DelayMutex.unlock();
+            // sleep until unpaused, stepped or shut down
+            waitWhilePaused();
 
-                }
+            if(m_doStep)
+            {
+                // process current instruction at program counter
+                advanceGuestClock( executeInstructions(1) );
                 m_doStep = false;
+                renderAudio();
+
+                publishFrame();
             }
 
+            // do not try to catch up on the time spent paused
+            nextframe = schedclock.getElapsedTime().asMicroseconds();
+            m_CPUClock.restart();
             continue;
         }
         else m_doStep = false;
 
-        // 1 cpu tick
-        if(m_CPUClock.getElapsedTime().asMicroseconds() >= 1851.8)
+        // turbo, run a whole timer frame per batch as fast as the host allows
+        if(m_CPUFrequency == 0)
         {
-            // process current instruction at program counter
-            executeNextInstruction();
-
-            // tick for delay counter
-            m_CPUTickDelayCounter++;
-            // delay counter 60Hz (540Hz / 60Hz = 9)
-            if(m_CPUTickDelayCounter >= 9)
+            // rewinding goes back one frame per frame shown
+            if(m_RewindHeld && m_Rewind)
             {
-                m_CPUTickDelayCounter = 0;
+                rewindFrame();
+                renderAudio();
+                if(m_doRender) publishFrame();
+                sf::sleep(sf::microseconds(frametime));
+                continue;
+            }
+
+            unsigned int executed = runCycles(m_InstructionsPerFrame);
+            renderAudio();
 
-                m_DelayMutex.lock();
-                if(m_DelayReg > 0) m_DelayReg--;
-                if(m_SoundReg > 0) m_SoundReg--;
-                m_DelayMutex.unlock();
+            if(executed) m_LastTickTime = double(m_CPUClock.getElapsedTime().asMicroseconds()) / executed;
+            m_CPUClock.restart();
 
+            // the render thread can not show more than 60 frames a second anyway,
+            // and rewind snapshots at the same rate instead of every guest frame
+            if(schedclock.getElapsedTime().asMicroseconds() - lastpublish >= frametime)
+            {
+                recordRewind();
+                if(m_doRender) publishFrame();
+                lastpublish = schedclock.getElapsedTime().asMicroseconds();
             }
+            continue;
+        }
 
-            m_LastTickTime = m_CPUClock.getElapsedTime().asMicroseconds();
+        // run one slice worth of instructions, carrying the remainder so any frequency averages out
+        unsigned int budget = (m_CPUFrequency + m_BudgetRemainder) / (TIMER_FREQUENCY * FRAME_SLICES);
+        m_BudgetRemainder = (m_CPUFrequency + m_BudgetRemainder) % (TIMER_FREQUENCY * FRAME_SLICES);
 
-            m_CPUClock.restart();
+        // rewind and the render thread still go by whole frames, on the last slice of each
+        bool framedone = ++slice == FRAME_SLICES;
+        if(framedone) slice = 0;
+
+        // a block that ran past the last budget already spent part of this one
+        if(budget > m_BudgetOverrun)
+        {
+            budget -= m_BudgetOverrun;
+            m_BudgetOverrun = 0;
+        }
+        else
+        {
+            m_BudgetOverrun -= budget;
+            budget = 0;
+        }
+
+        unsigned int executed = 0;
+
+        // rewinding goes back one guest frame per frame, as fast as the game ran forward
+        if(m_RewindHeld && m_Rewind)
+        {
+            if(framedone) rewindFrame();
+        }
+        else if(budget)
+        {
+            executed = runCycles(budget);
+            if(executed > budget) m_BudgetOverrun += executed - budget;
+            if(framedone) recordRewind();
         }
+
+        // before publishing, the audio ring is the tighter deadline
+        renderAudio();
+        if(m_doRender && framedone) publishFrame();
+
+        // sleep until the next slice deadline
+        nextframe += slicetime;
+        sf::Int64 now = schedclock.getElapsedTime().asMicroseconds();
+
+        // too far behind, drop the missed frames instead of running them all at once
+        if(now - nextframe > MAX_CATCHUP_FRAMES * frametime) nextframe = now;
+        else if(nextframe > now) sf::sleep(sf::microseconds(nextframe - now));
+
+        if(executed) m_LastTickTime = double(m_CPUClock.getElapsedTime().asMicroseconds()) / executed;
+        m_CPUClock.restart();
+    }
+
+    if(m_InputLog && m_InputLog->isRecording())
+    {
+        stopRecording();
+        std::cout << "Recorded " << m_InputLog->getEventCount() << " input events, state hash " << std::hex << hashState() << std::dec << "\n";
+    }
+
+    double elapsed = runclock.getElapsedTime().asSeconds();
+    uint64_t cycles = m_State->cycles - startcycles;
+    uint64_t frames = m_State->frames - startframes;
+
+    std::cout << "Executed " << cycles << " instructions, " << frames << " guest frames in " << elapsed << "s\n";
+    if(elapsed > 0)
+    {
+        std::cout << std::fixed << std::setprecision(0) << cycles / elapsed << " instructions/sec, ";
+        std::cout << frames / elapsed << " guest frames/sec\n";
+        std::cout.unsetf(std::ios::floatfield);
     }
 
     std::cout << "CPU thread exiting...\n";
 
 }
 
+void Chip8::renderAudio()
+{
+    if(m_Audio) m_Audio->render(getSoundEvents(), getSoundEventCount(), m_State->cycles, m_InstructionsPerFrame);
+
+    // drained even when muted so they do not pile up
+    clearSoundEvents();
+}
+
 void Chip8::renderLoop()
 {
     bool doDrawDbg = false;
@@ -851,23 +496,34 @@ void Chip8::renderLoop()
     initRender();
     m_RunRender = true;
 
-    // create pixel used for "stamping"
-    sf::RectangleShape spixel(sf::Vector2f(DISPLAY_SCALE, DISPLAY_SCALE));
+    // display generation in the screen texture
+    uint32_t uploaded = 0;
+    bool textureValid = false;
+    // present even if the display did not change, window was exposed or overlay toggled
+    bool redraw = true;
+
+    // fixed rate deadlines in microseconds
+    sf::Clock paceclock;
+    sf::Int64 presenttime = 1000000 / m_PacingHz;
+    sf::Int64 nextpresent = 0;
 
     while(m_RunRender)
     {
-        m_Screen->clear();
-
         sf::Event event;
 
-        // check if chip-8 key is pressed
-        m_KeyState = 0x0;
+        // check if chip-8 key is pressed, store once so the cpu never sees a partial state
+        uint16_t keystate = 0x0;
         for(int i = 0; i < 16; i++)
-            m_KeyState |= sf::Keyboard::isKeyPressed(keys[i]) << i;
+            keystate |= sf::Keyboard::isKeyPressed(keys[i]) << i;
+        uint16_t lastkeystate = m_KeyState.exchange(keystate);
+        // after the store, so the cpu is sure to latch the change it is told about
+        if(m_Latency && keystate != lastkeystate) m_Latency->keyChanged();
+        m_RewindHeld = sf::Keyboard::isKeyPressed(sf::Keyboard::BackSpace);
 
         while(m_Screen->pollEvent(event))
         {
             if(event.type == sf::Event::Closed) shutdown();
+            else if(event.type == sf::Event::Resized || event.type == sf::Event::GainedFocus) redraw = true;
             else if(event.type == sf::Event::KeyPressed)
             {
                 switch(event.key.code)
@@ -876,7 +532,7 @@ void Chip8::renderLoop()
                     shutdown();
                     break;
                 case sf::Keyboard::P:
-                    m_isPaused = !m_isPaused;
+                    pause(!m_isPaused);
                     break;
                 case sf::Keyboard::S:
                     step();
@@ -884,8 +540,18 @@ void Chip8::renderLoop()
                 case sf::Keyboard::R:
                     reset();
                     break;
+                case sf::Keyboard::W:
+                    stepBack();
+                    break;
+                case sf::Keyboard::F5:
+                    quickSave();
+                    break;
+                case sf::Keyboard::F9:
+                    quickLoad();
+                    break;
                 case sf::Keyboard::F1:
                     doDrawDbg = !doDrawDbg;
+                    redraw = true;
                     break;
                 default:
                     break;
@@ -895,33 +561,83 @@ void Chip8::renderLoop()
         }
 
         // update
+        bool fresh;
+        const DisplayFrame &frame = acquireFrame(&fresh);
 
-        // draw
-        //m_Chip8Mutex.lock();
-        for(int i = 0; i < DISPLAY_HEIGHT; i++)
+        // only upload when the cpu changed the display since the last upload
+        bool changed = !textureValid || frame.generation != uploaded;
+        if(changed)
         {
-            for(int n = 0; n < DISPLAY_WIDTH; n++)
-            {
-                if(m_Display[i][n])
-                {
-                    spixel.setPosition(sf::Vector2f( n*DISPLAY_SCALE, i*DISPLAY_SCALE));
-                    m_Screen->draw(spixel);
-                }
-            }
+            updateScreenTexture(frame);
+            uploaded = frame.generation;
+            textureValid = true;
+        }
+
+        // the overlay shows live state, redraw it with every new frame
+        bool present = changed || redraw || (doDrawDbg && fresh);
+
+        if(present)
+        {
+            // draw, one texture upload and one draw call whatever is on screen
+            m_Screen->clear();
+            m_Screen->draw(m_ScreenSprite);
+
+            // if drawing debug window
+            if(doDrawDbg) drawDebug(frame);
+
+            // update screen, blocks until the refresh with vsync
+            m_Screen->display();
+            redraw = false;
+
+            if(m_Latency) m_Latency->presented(uploaded);
         }
-        //m_Chip8Mutex.unlock();
 
-        // if drawing debug window
-        if(doDrawDbg) drawDebug();
+        if(m_PacingMode == PACING_FIXED)
+        {
+            // sleep to the next absolute deadline, start over if we fell a frame behind
+            nextpresent += presenttime;
+            sf::Int64 now = paceclock.getElapsedTime().asMicroseconds();
 
-        // update screen
-        m_Screen->display();
+            if(nextpresent > now) sf::sleep(sf::microseconds(nextpresent - now));
+            else if(now - nextpresent > presenttime) nextpresent = now;
+        }
+        // nothing was presented so display() did not wait, poll for the next frame
+        else if(!present) sf::sleep(sf::milliseconds(RENDER_POLL_INTERVAL));
     }
 
     std::cout << "Render thread exiting...\n";
 }
 
-void Chip8::drawDebug()
+void Chip8::updateScreenTexture(const DisplayFrame &frame)
+{
+    // colour index is bit n from plane n: black, white, light and dark grey
+    static const sf::Uint8 palette[1 << DISPLAY_PLANES] = { 0x00, 0xff, 0xaa, 0x55 };
+    const int width = frame.hires ? DISPLAY_WIDTH : LORES_WIDTH;
+    const int height = frame.hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+    sf::Uint8 *texel = m_PixelBuffer;
+
+    for(int i = 0; i < height; i++)
+    {
+        for(int n = 0; n < width; n++)
+        {
+            int colour = 0;
+            for(int p = 0; p < DISPLAY_PLANES; p++) colour |= ((frame.rows[p][i][n >> 6] >> (63 - (n & 63))) & 0x1) << p;
+
+            texel[0] = palette[colour];
+            texel[1] = palette[colour];
+            texel[2] = palette[colour];
+            texel[3] = 0xff;
+            texel += 4;
+        }
+    }
+
+    // lores is packed into the top left corner of the texture and drawn at twice the scale
+    m_ScreenTexture.update(m_PixelBuffer, width, height, 0, 0);
+    m_ScreenSprite.setTextureRect(sf::IntRect(0, 0, width, height));
+    m_ScreenSprite.setScale(DISPLAY_SCALE * DISPLAY_WIDTH / width, DISPLAY_SCALE * DISPLAY_WIDTH / width);
+}
+
+void Chip8::drawDebug(const DisplayFrame &frame)
 {
     const sf::Color bgcol(0,0,128,240);
     const sf::Color bg2col(20,20,20,100);
@@ -942,9 +658,9 @@ void Chip8::drawDebug()
 
     // top line
     std::stringstream topliness;
-    topliness << std::hex << "PC: 0x" << std::setfill('0') << std::setw(4) << int(m_PCounter) << " ";
-    topliness << "VI: 0x" << std::setfill('0') << std::setw(4) << int(m_IReg) << " ";
-    if(!m_isPaused) topliness << std::dec << int(pow( (m_LastTickTime / 1000000), -1));
+    topliness << std::hex << "PC: 0x" << std::setfill('0') << std::setw(4) << int(frame.pc) << " ";
+    topliness << "VI: 0x" << std::setfill('0') << std::setw(4) << int(frame.ireg) << " ";
+    if(!m_isPaused) topliness << std::dec << int(pow( (frame.ticktime / 1000000), -1));
     else topliness << "---";
     topliness << "Hz" << std::hex;
     sf::Text toplinetxt(topliness.str(), m_Font, fontsize);
@@ -953,21 +669,45 @@ void Chip8::drawDebug()
 
     // second line
     std::stringstream sliness;
-    sliness << std::hex << "DC: 0x" << std::setfill('0') << std::setw(2) << int(m_DelayReg) << " ";
-    sliness << "SC: 0x" << std::setfill('0') << std::setw(2) << int(m_SoundReg) << " ";
-    sliness << "K: " << int(m_KeyState) << " ";
-    //sliness << "STACK_SIZE: " << std::dec << m_Stack.size() << std::hex;
+    sliness << std::hex << "DC: 0x" << std::setfill('0') << std::setw(2) << int(frame.delay) << " ";
+    sliness << "SC: 0x" << std::setfill('0') << std::setw(2) << int(frame.sound) << " ";
+    sliness << "K: " << int(frame.keys) << " ";
+    //sliness << "STACK_SIZE: " << std::dec << m_State->stacksize << std::hex;
     sf::Text slinetxt(sliness.str(), m_Font, fontsize);
     slinetxt.setPosition(drect.left + 8, drect.top + 16);
     m_Screen->draw(slinetxt);
 
+    // profiler, executions in red, reads in green and writes in blue per memory byte
+    if(frame.profiled)
+    {
+        for(int i = 0; i < HEATMAP_MEMORY; i++)
+        {
+            m_HeatPixels[i*4] = frame.heat[i*3];
+            m_HeatPixels[i*4+1] = frame.heat[i*3+1];
+            m_HeatPixels[i*4+2] = frame.heat[i*3+2];
+            m_HeatPixels[i*4+3] = 0xff;
+        }
+        m_HeatTexture.update(m_HeatPixels);
+        m_Screen->draw(m_HeatSprite);
+
+        std::stringstream hotss;
+        hotss << "HOT:";
+        for(int i = 0; i < PROFILE_HOT_ADDRS && frame.hot[i] < MAX_MEMORY; i++)
+        {
+            hotss << " 0x" << std::hex << std::setfill('0') << std::setw(4) << int(frame.hot[i]);
+        }
+        sf::Text hottxt(hotss.str(), m_Font, fontsize);
+        hottxt.setPosition(drect.left + 8, drect.top + 30);
+        m_Screen->draw(hottxt);
+    }
+
     // stack
     std::stringstream stackss;
-    stackss << "STACK: " << std::dec << std::setfill('0') << std::setw(2) << m_Stack.size() << std::hex << std::endl;
+    stackss << "STACK: " << std::dec << std::setfill('0') << std::setw(2) << int(frame.stacksize) << std::hex << std::endl;
     stackss << "---------\n";
-    for(int i = 0; i < int(m_Stack.size()); i++)
+    for(int i = 0; i < int(frame.stacksize); i++)
     {
-        stackss << "0x" << std::hex << std::setfill('0') << std::setw(4) << int(m_Stack[i]) << std::endl;
+        stackss << "0x" << std::hex << std::setfill('0') << std::setw(4) << int(frame.stack[i]) << std::endl;
     }
     sf::Text stacktxt(stackss.str(), m_Font, fontsize);
     stacktxt.setPosition(drect.left + drect.width - 80, 0);
@@ -977,11 +717,21 @@ void Chip8::drawDebug()
     // opcodes
     for(int i = 0; i < 8; i++)
     {
-        if(m_PCounter + i*2 >= MAX_MEMORY) continue;
+        if(frame.pc + i*2 >= MAX_MEMORY) continue;
+
+        Instruction ti = disassemble(frame.code[i*2] << 8 | frame.code[i*2+1]);
+        ti.addr = frame.pc + i*2;
 
-        Instruction ti = disassembleAtAddr(m_PCounter + i*2);
+        // name jump, call and data targets, and the line itself when it starts a subroutine or block
+        std::string line;
+        if(m_CodeMap)
+        {
+            m_CodeMap->labelInstruction(&ti);
+            line = m_CodeMap->getLabel(ti.addr);
+        }
+        line = getDisassembledString(&ti) + (line.empty() ? "" : "  <" + line + ">");
 
-        sf::Text octxt(getDisassembledString(&ti), m_Font, fontsize);
+        sf::Text octxt(line, m_Font, fontsize);
         octxt.setPosition(drect.left + 8, drect.top + 50 + i*15);
         if(i == 0) octxt.setFillColor(sf::Color(255,255,0));
         m_Screen->draw(octxt);
@@ -991,7 +741,7 @@ void Chip8::drawDebug()
     std::stringstream regss;
     for(int i = 0; i < MAX_REGISTERS; i++)
     {
-        regss << "V" << std::hex << i << ":" << std::setfill('0') << std::setw(2) << int(m_Reg[i]) << " ";
+        regss << "V" << std::hex << i << ":" << std::setfill('0') << std::setw(2) << int(frame.reg[i]) << " ";
         if(i == 7) regss << "\n";
     }
     sf::Text regtxt(regss.str(), m_Font, fontsize);
@@ -1013,104 +763,52 @@ void Chip8::drawDebug()
 
 }
 
-bool Chip8::disassembleRomToASM(std::string romfile, std::string asmfile, bool verbose)
+bool Chip8::loadCodeMap(std::string romfile)
 {
-    std::ifstream ifile;
-    std::ofstream ofile;
+    std::vector<uint8_t> rom;
 
-    uint16_t offset = 0x200;
-    std::vector<Instruction> instructions;
-    std::vector<uint16_t> labels;
+    if(!readROMFile(romfile, &rom)) return false;
 
-    // attemp to open files for reading and writing
-    ifile.open(romfile.c_str(), std::ios::binary);
-    if(!ifile.is_open())
+    if(!m_CodeMap) m_CodeMap = new CodeMap;
+    if(!m_CodeMap->loadOrAnalyse(romfile, rom.empty() ? NULL : &rom[0], rom.size()))
     {
-        std::cout << "Error opening rom file:" << romfile << std::endl;
-        return false;
+        std::cout << "Analysed " << romfile << ", " << m_CodeMap->getBlocks().size() << " basic blocks\n";
     }
 
-    ofile.open(asmfile.c_str());
-    if(!ofile.is_open())
+    return true;
+}
+
+bool Chip8::disassembleRomToASM(std::string romfile, std::string asmfile, bool verbose)
+{
+    std::vector<uint8_t> rom;
+    std::string text;
+
+    if(!readROMFile(romfile, &rom))
     {
-        std::cout << "Erorr opening file for writing:" << asmfile << std::endl;
-        ifile.close();
+        std::cout << "Error opening rom file:" << romfile << std::endl;
         return false;
     }
 
-    while(!ifile.eof())
-    {
-        char bytes[2];
-        uint16_t opcode;
-        Instruction inst;
-
-        ifile.get(bytes[0]);
-        ifile.get(bytes[1]);
-
-        opcode = (unsigned char)(bytes[0]) << 8 | (unsigned char)(bytes[1]);
-
-        // add disassembled opcode instruction to list
-        inst = disassemble(opcode);
-        instructions.push_back( inst );
-
-        if(verbose)
-        {
-            ofile << std::right << std::hex << std::setw(4) << std::setfill('0') << offset;
-            ofile << std::hex << "  " << std::setw(4) << std::setfill('0') << opcode << "  ";
-            ofile << std::hex << std::left << std::setfill(' ') << std::setw(10) << inst.mnemonic << inst.vars << std::endl;
-        }
-
-        offset += 2;
-    }
+    const uint8_t *data = rom.empty() ? NULL : &rom[0];
 
+    // the plain listing needs the code map, from the sidecar if it is up to date
+    CodeMap *map = NULL;
     if(!verbose)
     {
-        // pass through all instructions and find labels (from calls and jumps) in instructions
-        for(int i = 0; i < int(instructions.size()); i++)
-        {
-            // if instruction is specifying an address, add to labels list
-            if(instructions[i].mnemonic == "CALL" || instructions[i].mnemonic == "JUMP")
-            {
-                bool alreadyexists = false;
-
-                // make sure there is not already a label at this address
-                for(int n = 0; n < int(labels.size()); n++)
-                {
-                    if(labels[n] == instructions[i].nnn) alreadyexists = true;
-                }
-
-                if(!alreadyexists)
-                {
-                    std::stringstream labelss;
-
-                    labels.push_back( instructions[i].nnn);
-
-                    labelss << "label_" << std::dec << labels.size();
-                    instructions[i].vars = labelss.str();
-                }
-
-            }
-        }
-
-        // pass through instructions again and identify label locations
-        for(int i = 0; i < int(instructions.size()); i++)
-        {
-            for(int n = 0; n < int(labels.size()); n++)
-            {
-                if(labels[n] == i*2 + 0x200)
-                {
-                    ofile << std::endl << "label_" << std::dec << n+1 << ":\n";
-                }
-            }
+        map = new CodeMap;
+        map->loadOrAnalyse(romfile, data, rom.size());
+    }
 
-            // write assembly string
-            ofile << "    " << std::hex << std::left << std::setfill(' ') << std::setw(10) << instructions[i].mnemonic << instructions[i].vars << std::endl;
-        }
+    formatROMASM(data, rom.size(), verbose, &text, map);
+    delete map;
 
+    if(!writeASMFile(asmfile, text))
+    {
+        std::cout << "Error opening file for writing:" << asmfile << std::endl;
+        return false;
     }
 
-    ofile.close();
-    ifile.close();
-
     std::cout << "Disassembled " << romfile << " to " << asmfile << ".\n";
+
+    return true;
 }
@@ -1,125 +1,119 @@
 #ifndef CLASS_CHIP8
 #define CLASS_CHIP8
 
-#include <cstdlib>
-#include <iostream>
-#include <vector>
+#include <mutex>
+#include <condition_variable>
 
 #include <SFML/Graphics.hpp>
 
-#define MAX_MEMORY 4096
-#define MAX_REGISTERS 16
-#define MAX_STACK 16
-
-#define DISPLAY_WIDTH 64
-#define DISPLAY_HEIGHT 32
-
-#define FONT_ADDR 0x1af
-
-#define DISPLAY_SCALE 8
-
-const uint8_t sysfonts[] = {
-                            0xF0,0x90,0x90,0x90,0xF0, // 0
-                            0x20,0x60,0x20,0x20,0x70, // 1
-                            0xF0,0x10,0xF0,0x80,0xF0, // 2
-                            0xF0,0x10,0xF0,0x10,0xF0, // 3
-                            0x90,0x90,0xF0,0x10,0x10, // 4
-                            0xF0,0x80,0xF0,0x10,0xF0, // 5
-                            0xF0,0x80,0xF0,0x90,0xF0, // 6
-                            0xF0,0x10,0x20,0x40,0x40, // 7
-                            0xF0,0x90,0xF0,0x90,0xF0, // 8
-                            0xF0,0x90,0xF0,0x10,0xF0, // 9
-                            0xF0,0x90,0xF0,0x90,0x90, // a
-                            0xE0,0x90,0xE0,0x90,0xE0, // b
-                            0xF0,0x80,0x80,0x80,0xF0, // c
-                            0xE0,0x90,0x90,0x90,0xE0, // d
-                            0xF0,0x80,0xF0,0x80,0xF0, // e
-                            0xF0,0x80,0xF0,0x80,0x80  // f
-                                                    };
-
-struct Instruction
-{
-    // short description of instruction
-    std::string mnemonic;
-    // what the instruction affects (registers, etc)
-    std::string vars;
-    // store address of instruction
-    uint16_t addr;
-    // original program counter
-    uint16_t opcode;
-    // first nibble is operation
-    uint8_t op;
-    // the rest of the 12-bits can be a value or address
-    uint16_t nnn;
-    // the last nibble
-    uint8_t n;
-    // second nibble
-    uint8_t x;
-    // third nibble
-    uint8_t y;
-    // last byte
-    uint8_t kk;
-};
+#include "chip8core.hpp"
 
-class Chip8
-{
-private:
+// window pixels per hires pixel, lores pixels are drawn twice as large
+#define DISPLAY_SCALE 4
 
-    // CHIP-8 Memory
-    // chip-8 max memory (4096) 0x000-0xfff
-    // first 512 bytes (0x000-0x1ff) reserved for interpreter
-    uint8_t m_Mem[MAX_MEMORY];
+// frames the scheduler will run back to back to catch up before dropping them
+#define MAX_CATCHUP_FRAMES 5
 
+// how often the render thread polls for a new frame when it skipped a present, in ms
+#define RENDER_POLL_INTERVAL 1
 
-    // CHIP-8 Registers
-    // registers 0x0 - 0xf
-    // register 0xf should not be used, internal flag register
-    uint8_t m_Reg[MAX_REGISTERS];
-    // register I generally used to store addresses, usually only lowest 12 bits used
-    uint16_t m_IReg;
-    // delay register, 60Hz decrement until 0.  non-zero = delay register is active
-    uint8_t m_DelayReg;
-    // sound register.  60Hz decrement until 0.  non-zero = sound buzzer is active
-    uint8_t m_SoundReg;
-    // program counter 16-bit register (points to currently executing address)
-    uint16_t m_PCounter;
+// quick save slot for the F5/F9 keys
+#define STATE_QUICK_FILE "quick.state"
 
-    // stack, stores addresses that interpreter should be returned to when finished
-    // chip-8 allows 16 nested subroutines
-    std::vector<uint16_t> m_Stack;
+class CodeMap;
+class AudioOutput;
 
+// hottest addresses shown in the debug overlay while profiling
+#define PROFILE_HOT_ADDRS 4
+// memory the profiler heatmap covers, the chip-8 address space fits the strip beside the overlay
+#define HEATMAP_MEMORY 4096
 
+// completed frame handed from the cpu thread to the render thread,
+// with the machine state the debug overlay shows
+struct DisplayFrame
+{
+    // packed display rows of every plane, see MachineState::display
+    uint64_t rows[DISPLAY_PLANES][DISPLAY_HEIGHT][2];
+    bool hires;
+    uint8_t reg[MAX_REGISTERS];
+    uint16_t ireg;
+    uint16_t pc;
+    uint8_t delay;
+    uint8_t sound;
+    uint16_t keys;
+    uint16_t stack[MAX_STACK];
+    uint8_t stacksize;
+    // memory at the program counter, 8 opcodes
+    uint8_t code[16];
+    double ticktime;
+    // display generation, see Chip8Core::m_DisplayGeneration
+    uint32_t generation;
+    // profiler heatmap, 3 bytes per address for executions, reads and writes, only set while profiling
+    bool profiled;
+    uint8_t heat[HEATMAP_MEMORY * 3];
+    uint32_t hot[PROFILE_HOT_ADDRS];
+};
+
+// when the render thread presents, every mode skips frames the display did not change in
+enum PACING_MODE
+{
+    // present on the monitor refresh
+    PACING_VSYNC,
+    // present at a fixed rate without vsync
+    PACING_FIXED,
+    // present as soon as the cpu changes the display, lowest latency, may tear
+    PACING_ON_CHANGE
+};
 
-    // display, pixels are either on or off.  display is a 64x32 pixel array
-    // sprites are always 8-bits width, and up to 15 lines in height
-    bool m_Display[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+// SFML front end, runs the machine on a cpu thread paced to the guest clock and shows it on a render thread
+class Chip8 : public Chip8Core
+{
+private:
 
-    // keyboard, keypad only has 0-9, a-f keys
-    uint16_t m_KeyState;
+    // rewind key is held down
+    std::atomic<bool> m_RewindHeld;
 
     // thread control
+    // nothing on the instruction path locks, the render thread only reads published frames
     sf::Thread *m_CPUThread;
     sf::Thread *m_RenderThread;
-    sf::Mutex m_Chip8Mutex;
-    sf::Mutex m_DelayMutex;
-    bool m_RunCPU;
-    bool m_RunRender;
-
+    std::atomic<bool> m_RunCPU;
+    std::atomic<bool> m_RunRender;
+    std::atomic<bool> m_ResetRequested;
+    std::atomic<bool> m_SaveRequested;
+    std::atomic<bool> m_LoadRequested;
+    std::atomic<bool> m_StepBackRequested;
+    void serviceRequests();
+
+    // triple buffered frames, the cpu fills m_FrameBack and swaps it with the
+    // middle buffer, the render thread swaps m_FrameFront with the middle buffer
+    DisplayFrame m_Frames[3];
+    // middle buffer index in bits 0-1, bit 2 set when it holds an unread frame
+    std::atomic<uint8_t> m_FrameState;
+    uint8_t m_FrameBack;
+    uint8_t m_FrameFront;
+    void publishFrame();
+    const DisplayFrame &acquireFrame(bool *fresh = NULL);
 
     // processing
     sf::Clock m_CPUClock;
-    int m_CPUTickDelayCounter;
     double m_LastTickTime;
-    bool m_isPaused;
-    bool m_doStep;
-    bool processInstruction(Instruction inst);
-    bool executeNextInstruction();
+
+    // scheduler
+    // instructions left over when the frequency is not a multiple of 60Hz
+    unsigned int m_BudgetRemainder;
+    // instructions the last block ran past its budget, taken off the next one
+    unsigned int m_BudgetOverrun;
+    // cpu thread sleeps on this while paused
+    std::mutex m_SchedulerMutex;
+    std::condition_variable m_SchedulerWake;
+    void waitWhilePaused();
+    std::atomic<bool> m_doStep;
     void CPULoop();
 
-    // decoding
-    Instruction disassemble(uint16_t opcode);
     Instruction disassembleAtAddr(uint16_t addr);
-    std::string getDisassembledString(Instruction *inst);
+    // code map the overlay labels come from, NULL without one
+    CodeMap *m_CodeMap;
 
     // SFML Rendering
     bool m_doRender;
@@ -127,43 +121,49 @@ private:
     bool m_RenderInitialized;
     sf::RenderWindow *m_Screen;
     sf::Font m_Font;
+    // display expanded to RGBA, uploaded to a texture and drawn as one scaled sprite
+    sf::Uint8 m_PixelBuffer[DISPLAY_WIDTH * DISPLAY_HEIGHT * 4];
+    sf::Texture m_ScreenTexture;
+    sf::Sprite m_ScreenSprite;
+    void updateScreenTexture(const DisplayFrame &frame);
+    // profiler heatmap for the debug overlay, one texel per memory byte
+    sf::Uint8 m_HeatPixels[HEATMAP_MEMORY * 4];
+    sf::Texture m_HeatTexture;
+    sf::Sprite m_HeatSprite;
+    // frame pacing, m_PacingHz is used by PACING_FIXED
+    PACING_MODE m_PacingMode;
+    unsigned int m_PacingHz;
     void renderLoop();
-    void drawDebug();
+    void drawDebug(const DisplayFrame &frame);
+
+    // buzzer, only played with a render window, NULL while not running
+    bool m_doAudio;
+    AudioOutput *m_Audio;
+    // hand the sound events of the last batch to the audio output, called by the cpu thread after every batch
+    void renderAudio();
 
 public:
     Chip8();
     ~Chip8();
 
-    typedef bool (*pointer_to_display)[DISPLAY_WIDTH];
-
-    // get display
-    unsigned int getDisplayWidth() { return DISPLAY_WIDTH;}
-    unsigned int getDisplayHeight() { return DISPLAY_HEIGHT;}
-    pointer_to_display getDisplay() { return m_Display;}
-
-    // get memory
-    uint16_t getProgramCounter() { return m_PCounter;}
-    uint8_t getMemAt(uint16_t addr) { return m_Mem[addr];}
-
-    // get registers
-    uint8_t *getRegisters() { return m_Reg;}
-    uint16_t getIRegister() { return m_IReg;}
-    uint8_t getDelayRegister() { return m_DelayReg;}
-    uint8_t getSoundRegister() { return m_SoundReg;}
-
-    // get stack
-    std::vector<uint16_t> getStack() { return m_Stack;}
+    // code map of the rom for labels in the debug overlay, from its sidecar or analysed, set before start()
+    bool loadCodeMap(std::string romfile);
 
     // interface
-    bool loadRom(std::string filename, uint16_t addr = 0x200);
     bool disassembleRomToASM(std::string romfile, std::string asmfile, bool verbose = false);
     bool disableRender() {if(m_RenderInitialized) return false;  else m_doRender = false; return true;}
+    bool disableAudio() {if(m_Audio) return false; else m_doAudio = false; return true;}
     void start();
-    void setKeyState(uint8_t keypressed) { m_KeyState = keypressed;}
+    bool setFramePacing(PACING_MODE mode, unsigned int hz = TIMER_FREQUENCY);
+    PACING_MODE getFramePacing() { return m_PacingMode;}
+    // these hand the work to the cpu thread while it runs
     void reset();
-    void pause(bool npause) {m_isPaused = npause;}
-    bool isPaused() { return m_isPaused;}
-    bool step() { if(m_isPaused) m_doStep = true;  return m_doStep;}
+    void quickSave();
+    void quickLoad();
+    // undo the last instruction while paused
+    void stepBack();
+    void pause(bool npause);
+    bool step();
     void shutdown();
 };
 #endif // CLASS_CHIP8
@@ -0,0 +1,2581 @@
+#include "chip8core.hpp"
+#include "rewind.hpp"
+#include "inputlog.hpp"
+#include "profiler.hpp"
+#include "latency.hpp"
+#include "romfile.hpp"
+#include "codemap.hpp"
+#include <time.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <new>
+
+// the horizontal scroll kernels shift whole 128-bit rows
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// opcode field extraction used by the dispatch handlers
+#define OP_NNN(opcode) ((opcode) & 0x0fff)
+#define OP_N(opcode) ((opcode) & 0x000f)
+#define OP_X(opcode) (((opcode) & 0x0f00) >> 8)
+#define OP_Y(opcode) (((opcode) & 0x00f0) >> 4)
+#define OP_KK(opcode) ((opcode) & 0x00ff)
+
+// longest basic block the threaded translator will build
+#define MAX_BLOCK_INSTRUCTIONS 32
+
+uint8_t Chip8Core::s_OpTable[0x10000];
+
+Chip8Core::Chip8Core()
+{
+    // opcode table is shared, build it once
+    static const bool optablebuilt = buildOpTable();
+    (void)optablebuilt;
+
+    // zero the whole state so saved snapshots compare byte for byte, 4KB of memory until a profile needs more
+    m_State = allocState(QUIRKS_MODERN);
+    m_State->quirks = QUIRKS_MODERN;
+
+    // init random seed
+    m_Seed = uint32_t(time(NULL)) | 0x1;
+    m_State->rng = m_Seed;
+    m_InputLog = NULL;
+
+    m_DispatchMode = DISPATCH_GOTO;
+    m_QuirkMode = QUIRKS_AUTO;
+
+    m_State->tickcounter = 0;
+    m_State->cycles = 0;
+    m_State->frames = 0;
+    m_CycleLimit = 0;
+    m_FrameLimit = 0;
+    setCPUFrequency(CPU_FREQUENCY);
+    m_isPaused = false;
+
+    // init registers, stack
+    for(int i = 0; i < MAX_REGISTERS; i++) m_State->reg[i] = 0x0;
+
+    m_State->ireg = 0x0;
+    m_State->delay = 0x0;
+    m_State->sound = 0x0;
+    m_State->pc = 0x0;
+
+    // init key state
+    m_KeyState = 0x0;
+    m_LatchKeys = true;
+    m_BatchOverrun = 0;
+    m_Stops = NULL;
+
+    // rewind is set up on request
+    m_Rewind = NULL;
+    m_DirtyBlocks = ~0ULL;
+
+    m_Buzzer = false;
+    m_SoundEventCount = 0;
+
+    // so are profiling and latency measurements
+    m_Profiler = NULL;
+    m_Latency = NULL;
+
+    // initial instructions
+    // clear screen
+    m_State->mem[0x00] = 0x00;
+    m_State->mem[0x01] = 0xe0;
+    // jump to address 0x0200
+    m_State->mem[0x02] = 0x12;
+    m_State->mem[0x03] = 0x00;
+
+
+    // store fonts (80 bytes = 16 characters * 5 bytes) in memory
+    // store at mem 0x01af to allow for 80 bytes, stopping before 0x0200
+    for(int i = 0; i < 80; i++)
+    {
+        m_State->mem[FONT_ADDR + i] = sysfonts[i];
+    }
+    // and the 160 bytes of big digits for Fx30 below them
+    for(int i = 0; i < 160; i++) m_State->mem[BIG_FONT_ADDR + i] = bigfonts[i];
+
+
+    // nothing has been decoded or translated yet
+    m_DecodeCache.resize(CHIP8_MEMORY);
+    invalidateDecodeCache(0x0, CHIP8_MEMORY);
+    m_BlockCache.resize(CHIP8_MEMORY, NULL);
+    m_BlockCoverage.resize(CHIP8_MEMORY, 0);
+    initJit();
+
+    // init display, lores drawing to the first plane
+    m_DisplayGeneration = 0;
+    m_State->hires = 0;
+    m_State->planes = 0x1;
+    clearDisplay();
+}
+
+Chip8Core::~Chip8Core()
+{
+    // a replay without its end marker would stop at the last event
+    stopRecording();
+
+    delete m_Rewind;
+    delete m_InputLog;
+    delete m_Profiler;
+    delete m_Latency;
+
+    flushBlocks();
+    freeJit();
+
+    free(m_State);
+}
+
+MachineState *allocState(int profile)
+{
+    return (MachineState*)calloc(1, stateSize(profile));
+}
+
+MachineState *resizeState(MachineState *state, int profile)
+{
+    unsigned int oldsize = stateSize(state->quirks);
+    unsigned int newsize = stateSize(profile);
+
+    if(oldsize == newsize) return state;
+
+    MachineState *resized = (MachineState*)realloc(state, newsize);
+    if(!resized) throw std::bad_alloc();
+
+    // memory the old profile could not address starts out zero
+    if(newsize > oldsize) memset((uint8_t*)resized + oldsize, 0, newsize - oldsize);
+
+    return resized;
+}
+
+MachineState *readState(std::istream &in, uint32_t size)
+{
+    if(size != stateSize(QUIRKS_MODERN) && size != stateSize(QUIRKS_XOCHIP)) return NULL;
+
+    MachineState *state = (MachineState*)malloc(size);
+    in.read((char*)state, size);
+
+    // a short read, or memory that does not match the profile
+    if(!in || state->quirks >= QUIRKS_COUNT || stateSize(state->quirks) != size)
+    {
+        free(state);
+        return NULL;
+    }
+
+    return state;
+}
+
+void Chip8Core::reset()
+{
+    resetMachine();
+
+    // a replay resets at the same cycle with the same seed
+    if(m_InputLog) m_InputLog->writeReset(m_State->cycles, m_State->rng);
+}
+
+template<Chip8Core::OpHandler H> void Chip8Core::tableOp(Chip8Core *chip, uint16_t opcode)
+{
+    (chip->*H)(opcode);
+}
+
+// handler table of one quirk profile, in OPCODE_ID order
+#define OP_HANDLERS(P) { \
+    &tableOp<&Chip8Core::opUNK>, &tableOp<&Chip8Core::opCLS>, &tableOp<&Chip8Core::opRET>, &tableOp<&Chip8Core::opJP>, \
+    &tableOp<&Chip8Core::opCALL>, &tableOp<&Chip8Core::opSE_KK<P> >, &tableOp<&Chip8Core::opSNE_KK<P> >, &tableOp<&Chip8Core::opSE_XY<P> >, \
+    &tableOp<&Chip8Core::opLD_KK>, &tableOp<&Chip8Core::opADD_KK>, &tableOp<&Chip8Core::opLD_XY>, &tableOp<&Chip8Core::opOR<P> >, \
+    &tableOp<&Chip8Core::opAND<P> >, &tableOp<&Chip8Core::opXOR<P> >, &tableOp<&Chip8Core::opADD_XY>, &tableOp<&Chip8Core::opSUB>, \
+    &tableOp<&Chip8Core::opSHR<P> >, &tableOp<&Chip8Core::opSUBN>, &tableOp<&Chip8Core::opSHL<P> >, &tableOp<&Chip8Core::opSNE_XY<P> >, \
+    &tableOp<&Chip8Core::opLD_I>, &tableOp<&Chip8Core::opJP_V0<P> >, &tableOp<&Chip8Core::opRND>, &tableOp<&Chip8Core::opDRW<P> >, \
+    &tableOp<&Chip8Core::opSKP<P> >, &tableOp<&Chip8Core::opSKNP<P> >, &tableOp<&Chip8Core::opLD_VX_DT>, &tableOp<&Chip8Core::opLD_K>, \
+    &tableOp<&Chip8Core::opLD_DT>, &tableOp<&Chip8Core::opLD_ST>, &tableOp<&Chip8Core::opADD_I>, &tableOp<&Chip8Core::opLD_F>, \
+    &tableOp<&Chip8Core::opLD_B<P> >, &tableOp<&Chip8Core::opLD_MEM<P> >, &tableOp<&Chip8Core::opLD_REG<P> >, &tableOp<&Chip8Core::opSCD>, \
+    &tableOp<&Chip8Core::opSCU>, &tableOp<&Chip8Core::opSCR>, &tableOp<&Chip8Core::opSCL>, &tableOp<&Chip8Core::opEXIT>, \
+    &tableOp<&Chip8Core::opLOW>, &tableOp<&Chip8Core::opHIGH>, &tableOp<&Chip8Core::opLD_HF>, &tableOp<&Chip8Core::opPLANE>, \
+    &tableOp<&Chip8Core::opLD_LONG> }
+
+const Chip8Core::TableHandler Chip8Core::s_OpHandlers[QUIRKS_COUNT][OPID_COUNT] = {
+    OP_HANDLERS(QUIRKS_MODERN), OP_HANDLERS(QUIRKS_VIP), OP_HANDLERS(QUIRKS_SCHIP), OP_HANDLERS(QUIRKS_XOCHIP)
+};
+
+void Chip8Core::setRewind(bool enable)
+{
+    if(enable && !m_Rewind)
+    {
+        m_Rewind = new RewindBuffer;
+        m_DirtyBlocks = ~0ULL;
+    }
+    else if(!enable)
+    {
+        delete m_Rewind;
+        m_Rewind = NULL;
+    }
+}
+
+void Chip8Core::setProfiling(bool enable)
+{
+    if(enable && !m_Profiler) m_Profiler = new Profiler;
+    else if(!enable)
+    {
+        delete m_Profiler;
+        m_Profiler = NULL;
+    }
+}
+
+void Chip8Core::setLatencyTracking(bool enable)
+{
+    if(enable && !m_Latency) m_Latency = new LatencyTracker;
+    else if(!enable)
+    {
+        delete m_Latency;
+        m_Latency = NULL;
+    }
+}
+
+bool Chip8Core::writeProfile(std::string filename)
+{
+    if(!m_Profiler) return false;
+
+    return m_Profiler->writeReport(filename, this);
+}
+
+void Chip8Core::recordRewind()
+{
+    if(m_Rewind) m_Rewind->record(*m_State, &m_DirtyBlocks);
+}
+
+bool Chip8Core::rewindFrame()
+{
+    if(!m_Rewind || m_State->cycles == 0) return false;
+
+    // the newest snapshot before now, the one taken at the current cycle is this frame
+    const MachineState *state = m_Rewind->restore(m_State->cycles - 1);
+    if(!state) return false;
+
+    loadState(*state);
+    // the keyframe may be older than the blocks marked since
+    m_DirtyBlocks = ~0ULL;
+
+    return true;
+}
+
+void Chip8Core::stepBackMachine()
+{
+    if(m_State->cycles == 0) return;
+
+    uint64_t target = m_State->cycles - 1;
+
+    if(!rewindFrame()) return;
+
+    // run forward from the snapshot to one instruction before where we were,
+    // holding the keys the snapshot latched
+    bool latch = m_LatchKeys;
+    m_LatchKeys = false;
+    while(m_State->cycles < target && runCycles(target - m_State->cycles, true));
+    m_LatchKeys = latch;
+}
+
+void Chip8Core::resetMachine()
+{
+    // init random seed
+    m_State->rng = m_Seed;
+
+    // reset vars
+    m_State->tickcounter = 0;
+
+    m_State->ireg = 0x0;
+    m_State->delay = 0x0;
+    m_State->sound = 0x0;
+    m_State->pc = 0x0;
+
+    // clear registers
+    for(int i = 0; i < MAX_REGISTERS; i++) m_State->reg[i] = 0x0;
+
+    // init key state
+    m_KeyState = 0x0;
+    m_State->keys = 0x0;
+
+    // clear every plane and go back to lores drawing to the first one
+    m_State->hires = 0;
+    m_State->planes = (1 << DISPLAY_PLANES) - 1;
+    clearDisplay();
+    m_State->planes = 0x1;
+
+    // pop stack
+    m_State->stacksize = 0;
+}
+
+std::string Chip8Core::getDisassembledString(Instruction *inst)
+{
+    std::stringstream dss;
+
+    if(inst->mnemonic.empty()) inst->mnemonic = "UNK";
+
+    // memory address
+    dss << std::hex << std::setfill('0') << std::setw(4) << int(inst->addr) << " ";
+    // opcode
+    dss << std::setfill('0') << std::setw(4) << int(inst->opcode) << " ";
+    // mnemonic
+    dss << std::left << std::setfill(' ') << std::setw(7) << inst->mnemonic << " ";
+    // vars
+    dss << inst->vars;
+
+    return dss.str();
+}
+
+void Chip8Core::decode(uint16_t opcode, DecodedInstruction *dinst)
+{
+    // set opcode
+    dinst->opcode = opcode;
+
+    // first nibble is op
+    dinst->op = (opcode & 0xf000) >> 12;
+    // the rest of the 12-bits can be a value or address
+    dinst->nnn = (opcode & 0x0fff);
+    // the last nibble
+    dinst->n = (opcode & 0x000f);
+    // second nibble
+    dinst->x = (opcode & 0x0f00) >> 8;
+    // third nibble
+    dinst->y = (opcode & 0x00f0) >> 4;
+    // last byte
+    dinst->kk = (opcode & 0x00ff);
+
+    dinst->valid = true;
+}
+
+const DecodedInstruction &Chip8Core::fetchInstruction(uint16_t addr)
+{
+    DecodedInstruction &cinst = m_DecodeCache[addr];
+
+    // decode on first use, the entry stays valid until memory under it is written
+    if(!cinst.valid)
+    {
+        uint8_t lo = (addr + 1u < m_DecodeCache.size()) ? m_State->mem[addr+1] : 0x0;
+        decode(m_State->mem[addr] << 8 | lo, &cinst);
+    }
+
+    return cinst;
+}
+
+void Chip8Core::invalidateDecodeCache(uint16_t addr, unsigned int len)
+{
+    // an opcode starting one byte before the write also reads the first written byte
+    int start = int(addr) - 1;
+    int end = int(addr) + len;
+
+    if(start < 0) start = 0;
+    if(end > int(m_DecodeCache.size())) end = m_DecodeCache.size();
+
+    for(int i = start; i < end; i++) m_DecodeCache[i].valid = false;
+}
+
+void Chip8Core::invalidateCode(uint16_t addr, unsigned int len)
+{
+    const unsigned int memsize = memorySize(m_State->quirks);
+    const unsigned int blocksize = memsize / DIRTY_BLOCKS;
+
+    // writes from I wrap at the end of memory
+    if(addr + len > memsize)
+    {
+        invalidateCode(0, addr + len - memsize);
+        len = addr < memsize ? memsize - addr : 0;
+    }
+
+    // mark the blocks for the rewind delta
+    if(len) for(unsigned int b = addr / blocksize; b <= (addr + len - 1) / blocksize && b < DIRTY_BLOCKS; b++) m_DirtyBlocks |= 1ULL << b;
+
+    invalidateDecodeCache(addr, len);
+    invalidateBlocks(addr, len);
+    invalidateJit(addr, len);
+}
+
+Instruction Chip8Core::disassemble(uint16_t opcode)
+{
+    Instruction dinst;
+
+    std::stringstream varss;
+
+    decode(opcode, &dinst);
+
+    if(dinst.op == 0x0)
+    {
+        // 00e0 - clear display
+        if(dinst.opcode == 0x00e0) dinst.mnemonic = "CLS";
+        // 00ee - return from subroutine, pop stack
+        else if(dinst.opcode == 0x00ee) dinst.mnemonic = "RET";
+        // 00cn / 00dn - scroll the display down / up n rows
+        else if((dinst.opcode & 0xfff0) == 0x00c0 || (dinst.opcode & 0xfff0) == 0x00d0)
+        {
+            dinst.mnemonic = (dinst.opcode & 0xfff0) == 0x00c0 ? "SCRL.D" : "SCRL.U";
+            varss << std::hex << "#$" << int(dinst.n);
+            dinst.vars = varss.str();
+        }
+        // 00fb / 00fc - scroll the display right / left 4 columns
+        else if(dinst.opcode == 0x00fb) dinst.mnemonic = "SCRL.R";
+        else if(dinst.opcode == 0x00fc) dinst.mnemonic = "SCRL.L";
+        // 00fd - exit the interpreter
+        else if(dinst.opcode == 0x00fd) dinst.mnemonic = "EXIT";
+        // 00fe / 00ff - 64x32 / 128x64 display
+        else if(dinst.opcode == 0x00fe) dinst.mnemonic = "LORES";
+        else if(dinst.opcode == 0x00ff) dinst.mnemonic = "HIRES";
+    }
+    // jump - set program counter to nnn
+    else if(dinst.op == 0x1)
+    {
+        dinst.mnemonic = "JUMP";
+        varss << std::hex << "$" << std::setfill('0') << std::setw(4) << int(dinst.nnn);
+        dinst.vars = varss.str();
+    }
+    // call address - call subroutine at nnn
+    // put current pcounter on top of stack, then set pcounter to nnn
+    else if(dinst.op == 0x2)
+    {
+        dinst.mnemonic = "CALL";
+        varss << "$" << std::hex << std::setfill('0') << std::setw(4) << int(dinst.nnn);
+        dinst.vars = varss.str();
+    }
+    // skip if register x == kk, increment program counter by 2
+    else if(dinst.op == 0x3)
+    {
+        dinst.mnemonic = "SKIP.E";
+        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
+        dinst.vars = varss.str();
+    }
+    // skip if register x != kk, increment program counter by 2
+    else if(dinst.op == 0x4)
+    {
+        dinst.mnemonic = "SKIP.NE";
+        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
+        dinst.vars = varss.str();
+    }
+    // skip if register x is equal to register y
+    else if(dinst.op == 0x5)
+    {
+        dinst.mnemonic = "SKIP.E";
+        varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+        dinst.vars = varss.str();
+    }
+    // put value of kk into register x
+    else if(dinst.op == 0x6)
+    {
+        dinst.mnemonic = "MOV";
+        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
+        dinst.vars = varss.str();
+    }
+    // add kk to register x
+    else if(dinst.op == 0x7)
+    {
+        dinst.mnemonic = "ADD";
+        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
+        dinst.vars = varss.str();
+    }
+    // register operations
+    else if(dinst.op == 0x8)
+    {
+        // EQUAL, stores reg y into reg x
+        if(dinst.n == 0x0)
+        {
+            dinst.mnemonic = "MOV";
+            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+            dinst.vars = varss.str();
+        }
+        // OR, reg x = reg x OR reg y
+        else if(dinst.n == 0x1)
+        {
+            dinst.mnemonic = "OR";
+            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+            dinst.vars = varss.str();
+        }
+        // AND, reg x = reg x AND reg y
+        else if(dinst.n == 0x2)
+        {
+            dinst.mnemonic = "AND";
+            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+            dinst.vars = varss.str();
+        }
+        // XOR, reg x = reg x XOR reg y
+        else if(dinst.n == 0x3)
+        {
+            dinst.mnemonic = "XOR";
+            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+            dinst.vars = varss.str();
+        }
+        // ADD, reg x = reg x + reg y
+        else if(dinst.n == 0x4)
+        {
+            dinst.mnemonic = "ADD";
+            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+            dinst.vars = varss.str();
+        }
+        // SUB, reg x = vx - vy
+        else if(dinst.n == 0x5)
+        {
+            dinst.mnemonic = "SUB";
+            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+            dinst.vars = varss.str();
+        }
+        // SHR (shift right), vx = vx / 2
+        else if(dinst.n == 0x6)
+        {
+            dinst.mnemonic = "SHR";
+            varss << std::hex << "V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // SUBN, reg x = reg y - reg x
+        else if(dinst.n == 0x7)
+        {
+            dinst.mnemonic = "SUBB";
+            varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+            dinst.vars = varss.str();
+
+        }
+        // SHL (shift left), reg x = reg x * 2
+        else if(dinst.n == 0xe)
+        {
+            dinst.mnemonic = "SHL";
+            varss << std::hex << "V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+    }
+    else if(dinst.op == 0x9)
+    {
+        dinst.mnemonic = "SKIP.NE";
+        varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y);
+        dinst.vars = varss.str();
+    }
+    // set register I = nnn
+    else if(dinst.op == 0xa)
+    {
+        dinst.mnemonic = "MOV";
+        varss << std::hex << "I, #$" << int(dinst.nnn);
+        dinst.vars = varss.str();
+    }
+    // JUMP to location nnn + v0
+    else if(dinst.op == 0xb)
+    {
+        dinst.mnemonic = "JUMP";
+        varss << std::hex << "V0, #$" << int(dinst.nnn);
+        dinst.vars = varss.str();
+
+    }
+    // RANDOM 0-255, then AND with kk and store in reg x
+    else if(dinst.op == 0xc)
+    {
+        dinst.mnemonic = "RNDMSK";
+        varss << std::hex << "V" << int(dinst.x) << ", #$" << int(dinst.kk);
+        dinst.vars = varss.str();
+
+    }
+    // DRAW n-byte height sprite starting at mem location reg I at regx,regy pixels
+    else if(dinst.op == 0xd)
+    {
+        dinst.mnemonic = "DRW";
+        varss << std::hex << "V" << int(dinst.x) << ", V" << int(dinst.y) << ", #$" << int(dinst.n);
+        dinst.vars = varss.str();
+    }
+    else if(dinst.op == 0xe)
+    {
+        // skip next instruction if key value in reg x is pressed
+        if(dinst.kk == 0x9e)
+        {
+            dinst.mnemonic = "SKIP.KY";
+            varss << std::hex << "V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // skip next instruction if key value in reg x is not pressed
+        else if(dinst.kk == 0xa1)
+        {
+            dinst.mnemonic = "SKIP.KN";
+            varss << std::hex << "V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+    }
+    else if(dinst.op == 0xf)
+    {
+        // reg x = value of delay timer
+        if(dinst.kk == 0x07)
+        {
+            dinst.mnemonic = "MOV";
+            varss << std::hex << "V" << int(dinst.x) << ", DELAY";
+            dinst.vars = varss.str();
+        }
+        // wait for key press, then store key press in vx
+        else if(dinst.kk == 0x0a)
+        {
+            dinst.mnemonic = "WAITKEY";
+            varss << std::hex << "V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // set delay timer to value in reg x
+        else if(dinst.kk == 0x15)
+        {
+            dinst.mnemonic = "MOV";
+            varss << std::hex << "DELAY, V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // set sound timer to value of reg x
+        else if(dinst.kk == 0x18)
+        {
+            dinst.mnemonic = "MOV";
+            varss << std::hex << "SOUND, V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // values of reg I and reg x are added and stored in reg i
+        else if(dinst.kk == 0x1e)
+        {
+            dinst.mnemonic = "ADD";
+            varss << std::hex << "I, V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // font, set I to location of sprite associated with value in reg x
+        else if(dinst.kk == 0x29)
+        {
+            dinst.mnemonic = "FONT";
+            varss << std::hex << "I, V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // big font, set I to the 8x10 digit in reg x
+        else if(dinst.kk == 0x30)
+        {
+            dinst.mnemonic = "FONT.HI";
+            varss << std::hex << "I, V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // f000 nnnn - set I to the 16-bit address in the next word
+        else if(dinst.opcode == 0xf000)
+        {
+            dinst.mnemonic = "MOV.L";
+            dinst.vars = "I";
+        }
+        // fn01 - select the planes drawing works on
+        else if(dinst.kk == 0x01)
+        {
+            dinst.mnemonic = "PLANE";
+            varss << std::hex << "#$" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // store BCD of vx in memory locations of I, I+1, and I+2
+        else if(dinst.kk == 0x33)
+        {
+            dinst.mnemonic = "MOV.BCD";
+            varss << std::hex << "V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // store register reg 0 through reg x in memory starting at location in reg i
+        else if(dinst.kk == 0x55)
+        {
+            dinst.mnemonic = "MOV.MEM";
+            varss << std::hex << "I, V" << int(dinst.x);
+            dinst.vars = varss.str();
+        }
+        // read values from memory starting at location i into registers reg 0 through reg x
+        else if(dinst.kk == 0x65)
+        {
+            dinst.mnemonic = "MOV.MEM";
+            varss << std::hex << "V" << int(dinst.x) << ", I";
+            dinst.vars = varss.str();
+        }
+    }
+
+    return dinst;
+}
+
+template<int P> bool Chip8Core::processInstruction(const DecodedInstruction &inst)
+{
+    // advance program counter
+    m_State->pc += 2;
+
+    if(inst.op == 0x0)
+    {
+        // 00e0 - clear display
+        if(inst.opcode == 0x00e0)
+        {
+            clearDisplay();
+        }
+        // 00ee - return from subroutine, pop stack
+        else if(inst.opcode == 0x00ee)
+        {
+            if(m_State->stacksize) m_State->pc = m_State->stack[--m_State->stacksize];
+            else m_isPaused = true;
+        }
+        // 00cn - scroll down n rows
+        else if((inst.opcode & 0xfff0) == 0x00c0)
+        {
+            scrollDown(inst.n);
+        }
+        // 00dn - scroll up n rows
+        else if((inst.opcode & 0xfff0) == 0x00d0)
+        {
+            scrollUp(inst.n);
+        }
+        // 00fb - scroll right 4 columns
+        else if(inst.opcode == 0x00fb)
+        {
+            scrollRight(4);
+        }
+        // 00fc - scroll left 4 columns
+        else if(inst.opcode == 0x00fc)
+        {
+            scrollLeft(4);
+        }
+        // 00fd - exit, stops the cpu like returning from an empty stack
+        else if(inst.opcode == 0x00fd)
+        {
+            m_isPaused = true;
+        }
+        // 00fe / 00ff - 64x32 / 128x64 display
+        else if(inst.opcode == 0x00fe)
+        {
+            setHires(false);
+        }
+        else if(inst.opcode == 0x00ff)
+        {
+            setHires(true);
+        }
+    }
+    // jump - set program counter to nnn
+    else if(inst.op == 0x1)
+    {
+        m_State->pc = inst.nnn;
+    }
+    // call address - call subroutine at nnn
+    // put current pcounter on top of stack, then set pcounter to nnn
+    else if(inst.op == 0x2)
+    {
+        // stack is fixed size, overflowing it stops the cpu like returning from an empty one
+        if(m_State->stacksize < MAX_STACK)
+        {
+            m_State->stack[m_State->stacksize++] = m_State->pc;
+            m_State->pc = inst.nnn;
+        }
+        else m_isPaused = true;
+    }
+    // skip if register x == kk, increment program counter by 2
+    else if(inst.op == 0x3)
+    {
+        if(m_State->reg[inst.x] == inst.kk) skip<P>();
+    }
+    // skip if register x != kk, increment program counter by 2
+    else if(inst.op == 0x4)
+    {
+        if(m_State->reg[inst.x] != inst.kk) skip<P>();
+    }
+    // skip if register x is equal to register y
+    else if(inst.op == 0x5)
+    {
+        if(m_State->reg[inst.x] == m_State->reg[inst.y]) skip<P>();
+    }
+    // put value of kk into register x
+    else if(inst.op == 0x6)
+    {
+        m_State->reg[inst.x] = inst.kk;
+    }
+    // add kk to register x
+    else if(inst.op == 0x7)
+    {
+        m_State->reg[inst.x] = m_State->reg[inst.x] + inst.kk;
+    }
+    // register operations
+    else if(inst.op == 0x8)
+    {
+        // EQUAL, stores reg y into reg x
+        if(inst.n == 0x0)
+        {
+            m_State->reg[inst.x] = m_State->reg[inst.y];
+        }
+        // OR, reg x = reg x OR reg y
+        else if(inst.n == 0x1)
+        {
+            m_State->reg[inst.x] = m_State->reg[inst.x] | m_State->reg[inst.y];
+            if(quirkFlags(P) & QUIRK_VF_RESET) m_State->reg[0xf] = 0x0;
+        }
+        // AND, reg x = reg x AND reg y
+        else if(inst.n == 0x2)
+        {
+            m_State->reg[inst.x] = m_State->reg[inst.x] & m_State->reg[inst.y];
+            if(quirkFlags(P) & QUIRK_VF_RESET) m_State->reg[0xf] = 0x0;
+        }
+        // XOR, reg x = reg x XOR reg y
+        else if(inst.n == 0x3)
+        {
+            m_State->reg[inst.x] = m_State->reg[inst.x] ^ m_State->reg[inst.y];
+            if(quirkFlags(P) & QUIRK_VF_RESET) m_State->reg[0xf] = 0x0;
+        }
+        // ADD, reg x = reg x + reg y
+        else if(inst.n == 0x4)
+        {
+            unsigned int result = m_State->reg[inst.x] + m_State->reg[inst.y];
+
+            // if result overflows register
+            if(result > 0xff)
+            {
+                // set result to lower 8 bits
+                result = result & 0xff;
+                // set carry flag
+                m_State->reg[0xf] = 0x1;
+            }
+            else m_State->reg[0xf] = 0x0;
+
+            m_State->reg[inst.x] = result;
+        }
+        // SUB, reg x = vx - vy
+        else if(inst.n == 0x5)
+        {
+            // set not borrow flag if reg x > reg y
+            if(m_State->reg[inst.x] > m_State->reg[inst.y]) m_State->reg[0xf] = 0x1;
+            else m_State->reg[0xf] = 0x0;
+
+            m_State->reg[inst.x] = m_State->reg[inst.x] - m_State->reg[inst.y];
+        }
+        // SHR (shift right), vx = vx / 2, or vx = vy / 2 when shifting vy
+        else if(inst.n == 0x6)
+        {
+            uint8_t src = (quirkFlags(P) & QUIRK_SHIFT_VY) ? inst.y : inst.x;
+
+            // if odd number
+            if(m_State->reg[src] & 0x1) m_State->reg[0xf] = 0x1;
+            else m_State->reg[0xf] = 0x0;
+
+            m_State->reg[inst.x] = m_State->reg[src] >> 1;
+        }
+        // SUBN, reg x = reg y - reg x
+        else if(inst.n == 0x7)
+        {
+            // set not borrow flag if reg y > reg x
+            if(m_State->reg[inst.y] > m_State->reg[inst.x]) m_State->reg[0xf] = 0x1;
+            else m_State->reg[0xf] = 0x0;
+
+            m_State->reg[inst.x] = m_State->reg[inst.y] - m_State->reg[inst.x];
+        }
+        // SHL (shift left), reg x = reg x * 2, or reg y * 2 when shifting vy
+        else if(inst.n == 0xe)
+        {
+            uint8_t src = (quirkFlags(P) & QUIRK_SHIFT_VY) ? inst.y : inst.x;
+
+            if(0x80 & m_State->reg[src]) m_State->reg[0xf] = 0x1;
+            else m_State->reg[0xf] = 0x0;
+
+            m_State->reg[inst.x] = m_State->reg[src] << 1;
+        }
+    }
+    else if(inst.op == 0x9)
+    {
+        // skip next instruction if reg x != reg y
+        if(inst.n == 0x0)
+        {
+            if(m_State->reg[inst.x] != m_State->reg[inst.y]) skip<P>();
+        }
+    }
+    // set register I = nnn
+    else if(inst.op == 0xa)
+    {
+        m_State->ireg = inst.nnn;
+    }
+    // JUMP to location nnn + v0, or xnn + vx
+    else if(inst.op == 0xb)
+    {
+        if(quirkFlags(P) & QUIRK_JUMP_VX) m_State->pc = inst.nnn + m_State->reg[inst.x];
+        else m_State->pc = inst.nnn + m_State->reg[0x0];
+    }
+    // RANDOM 0-255, then AND with kk and store in reg x
+    else if(inst.op == 0xc)
+    {
+        m_State->reg[inst.x] = nextRandom()&inst.kk;
+    }
+    // DRAW n-byte height sprite starting at mem location reg I at regx,regy pixels
+    // n of 0 draws a 16x16 sprite of 2 bytes per row on super-chip and xo-chip
+    else if(inst.op == 0xd)
+    {
+        // set collision flag if any lit pixel was erased
+        m_State->reg[0xf] = drawSprite<P>(m_State->reg[inst.x], m_State->reg[inst.y], inst.n);
+    }
+    else if(inst.op == 0xe)
+    {
+        // skip next instruction if key value in reg x is pressed
+        if(inst.kk == 0x9e)
+        {
+            if( m_State->keys >> m_State->reg[inst.x] & 0x01 ) skip<P>();
+        }
+        // skip next instruction if key value in reg x is not pressed
+        else if(inst.kk == 0xa1)
+        {
+            if( !(m_State->keys >> m_State->reg[inst.x] & 0x01) ) skip<P>();
+        }
+    }
+    else if(inst.op == 0xf)
+    {
+        // f000 nnnn - I = the next word, which is stepped over
+        if(inst.opcode == 0xf000)
+        {
+            m_State->ireg = m_State->mem[m_State->pc] << 8 | m_State->mem[(m_State->pc + 1) & (memorySize(P) - 1)];
+            m_State->pc += 2;
+        }
+        // fn01 - select the planes drawing works on
+        else if(inst.kk == 0x01)
+        {
+            m_State->planes = inst.x & ((1 << DISPLAY_PLANES) - 1);
+        }
+        // reg x = value of delay timer
+        else if(inst.kk == 0x07)
+        {
+            m_State->reg[inst.x] = m_State->delay;
+        }
+        // wait for key press, then store key press in vx
+        else if(inst.kk == 0x0a)
+        {
+            // if no keys are pressed, do not advance program counter
+            if(m_State->keys == 0x00) m_State->pc -= 2;
+            // else store keystate in vx
+            m_State->reg[inst.x] = m_State->keys;
+        }
+        // set delay timer to value in reg x
+        else if(inst.kk == 0x15)
+        {
+            m_State->delay = m_State->reg[inst.x];
+        }
+        // set sound timer to value of reg x
+        else if(inst.kk == 0x18)
+        {
+            m_State->sound = m_State->reg[inst.x];
+        }
+        // values of reg I and reg x are added and stored in reg i
+        else if(inst.kk == 0x1e)
+        {
+            m_State->ireg += m_State->reg[inst.x];
+        }
+        // font, set I to location of sprite associated with the low nibble of reg x
+        else if(inst.kk == 0x29)
+        {
+            m_State->ireg = FONT_ADDR + (m_State->reg[inst.x] & 0xf)*5;
+        }
+        // big font, set I to the 8x10 digit in the low nibble of reg x
+        else if(inst.kk == 0x30)
+        {
+            m_State->ireg = BIG_FONT_ADDR + (m_State->reg[inst.x] & 0xf)*10;
+        }
+        // store BCD of vx in memory locations of I, I+1, and I+2
+        else if(inst.kk == 0x33)
+        {
+            // binary coded decimal
+            uint8_t val = m_State->reg[inst.x];
+            // memory from I wraps at the end
+            uint16_t addr = m_State->ireg & (memorySize(P) - 1);
+            // hundreds
+            m_State->mem[addr] = val/100;
+            // tens
+            m_State->mem[(addr+1) & (memorySize(P) - 1)] = (val/10)%10;
+            // ones
+            m_State->mem[(addr+2) & (memorySize(P) - 1)] = val%10;
+
+            invalidateCode(addr, 3);
+        }
+        // store register reg 0 through reg x in memory starting at location in reg i
+        else if(inst.kk == 0x55)
+        {
+            uint16_t addr = m_State->ireg & (memorySize(P) - 1);
+
+            for(int j = 0; j <= inst.x; j++)  m_State->mem[(addr + j) & (memorySize(P) - 1)] = m_State->reg[j];
+
+            invalidateCode(addr, inst.x + 1);
+            if(quirkFlags(P) & QUIRK_LOAD_STORE_I) m_State->ireg += inst.x + 1;
+        }
+        // read values from memory starting at location i into registers reg 0 through reg x
+        else if(inst.kk == 0x65)
+        {
+            for(int j = 0; j <= inst.x; j++)  m_State->reg[j] = m_State->mem[(m_State->ireg + j) & (memorySize(P) - 1)];
+
+            if(quirkFlags(P) & QUIRK_LOAD_STORE_I) m_State->ireg += inst.x + 1;
+        }
+    }
+
+    return true;
+}
+
+inline void Chip8Core::clearDisplay()
+{
+    uint64_t lit = 0x0;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++)
+    {
+        if(!(m_State->planes >> p & 0x1)) continue;
+
+        uint64_t *words = m_State->display[p][0];
+        for(int i = 0; i < DISPLAY_HEIGHT * 2; i++)
+        {
+            lit |= words[i];
+            words[i] = 0x0;
+        }
+    }
+
+    // clearing a blank screen is not a change
+    if(lit) m_DisplayGeneration++;
+}
+
+template<int P> inline bool Chip8Core::drawSprite(uint8_t x, uint8_t y, uint8_t height)
+{
+    const bool wrap = quirkFlags(P) & QUIRK_WRAP;
+    const unsigned int width = m_State->hires ? DISPLAY_WIDTH : LORES_WIDTH;
+    const unsigned int screenheight = m_State->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+
+    // Dxy0 is 16 rows of 2 bytes where the profile has big sprites and draws nothing elsewhere
+    const unsigned int bytes = height ? 1 : 2;
+    if(!height)
+    {
+        if(!(quirkFlags(P) & QUIRK_BIG_SPRITE)) return false;
+        height = 16;
+    }
+
+    if(wrap)
+    {
+        x %= width;
+        y %= screenheight;
+    }
+    // sprites starting off screen are not drawn
+    else if(x >= width || y >= screenheight) return false;
+
+    uint64_t collision = 0x0;
+    // any set sprite bit flips a pixel
+    uint64_t drawn = 0x0;
+
+    // most draws are 8 pixel lores sprites on the first plane, clipped rows stay in the first word of the row
+    if(!wrap && !m_State->hires && m_State->planes == 0x1 && bytes == 1)
+    {
+        unsigned int rows = std::min(unsigned(height), unsigned(LORES_HEIGHT - y));
+
+        for(unsigned int ny = 0; ny < rows; ny++)
+        {
+            uint64_t bits = (uint64_t(m_State->mem[(m_State->ireg + ny) & (memorySize(P) - 1)]) << 56) >> x;
+            uint64_t &row = m_State->display[0][y + ny][0];
+
+            collision |= row & bits;
+            drawn |= bits;
+            row ^= bits;
+        }
+
+        if(drawn) m_DisplayGeneration++;
+
+        return collision != 0;
+    }
+    // each selected plane takes the next sprite in memory
+    uint16_t addr = m_State->ireg;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++)
+    {
+        if(!(m_State->planes >> p & 0x1)) continue;
+
+        for(unsigned int ny = 0; ny < height; ny++)
+        {
+            unsigned int py = y + ny;
+
+            // rows past the bottom are clipped or wrapped to the top
+            if(py >= screenheight)
+            {
+                if(!wrap) break;
+                py -= screenheight;
+            }
+
+            // sprite row in the top bytes, column 0 is the most significant bit
+            uint64_t sprite = uint64_t(m_State->mem[(addr + ny * bytes) & (memorySize(P) - 1)]) << 56;
+            if(bytes == 2) sprite |= uint64_t(m_State->mem[(addr + ny * 2 + 1) & (memorySize(P) - 1)]) << 48;
+
+            // split over the two words of the row, shifting right clips the columns past the right edge
+            uint64_t hi, lo;
+            if(x < 64)
+            {
+                hi = sprite >> x;
+                lo = x ? sprite << (64 - x) : 0x0;
+            }
+            else
+            {
+                hi = 0x0;
+                lo = sprite >> (x - 64);
+            }
+
+            // lores rows end at the first word, what spilled into the second wraps to column 0
+            if(width == LORES_WIDTH)
+            {
+                if(wrap) hi |= lo;
+                lo = 0x0;
+            }
+            // hires rows wrap what went past column 127
+            else if(wrap && x > DISPLAY_WIDTH - 16) hi |= sprite << (DISPLAY_WIDTH - x);
+
+            uint64_t *row = m_State->display[p][py];
+            collision |= (row[0] & hi) | (row[1] & lo);
+            drawn |= hi | lo;
+            row[0] ^= hi;
+            row[1] ^= lo;
+        }
+
+        addr += height * bytes;
+    }
+
+    if(drawn) m_DisplayGeneration++;
+
+    return collision != 0;
+}
+
+void Chip8Core::scrollDown(unsigned int rows)
+{
+    const unsigned int height = m_State->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+
+    if(!rows) return;
+    if(rows > height) rows = height;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++)
+    {
+        if(!(m_State->planes >> p & 0x1)) continue;
+
+        uint64_t (*display)[2] = m_State->display[p];
+        memmove(display[rows], display[0], (height - rows) * sizeof(display[0]));
+        memset(display[0], 0, rows * sizeof(display[0]));
+    }
+
+    m_DisplayGeneration++;
+}
+
+void Chip8Core::scrollUp(unsigned int rows)
+{
+    const unsigned int height = m_State->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+
+    if(!rows) return;
+    if(rows > height) rows = height;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++)
+    {
+        if(!(m_State->planes >> p & 0x1)) continue;
+
+        uint64_t (*display)[2] = m_State->display[p];
+        memmove(display[0], display[rows], (height - rows) * sizeof(display[0]));
+        memset(display[height - rows], 0, rows * sizeof(display[0]));
+    }
+
+    m_DisplayGeneration++;
+}
+
+void Chip8Core::scrollRight(unsigned int cols)
+{
+    const unsigned int height = m_State->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+    // lores rows drop what moves past column 63
+    const uint64_t keep = m_State->hires ? ~0ULL : 0x0;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++)
+    {
+        if(!(m_State->planes >> p & 0x1)) continue;
+
+#if defined(__SSE2__)
+        // column 0 is the top bit of the first word, moving right is a 128-bit right shift
+        const __m128i count = _mm_cvtsi32_si128(cols);
+        const __m128i carry = _mm_cvtsi32_si128(64 - cols);
+        const __m128i mask = _mm_set_epi64x(keep, ~0ULL);
+
+        for(unsigned int i = 0; i < height; i++)
+        {
+            __m128i *row = (__m128i*)m_State->display[p][i];
+            __m128i v = _mm_loadu_si128(row);
+            // bits leaving the first word enter the top of the second
+            __m128i spill = _mm_slli_si128(_mm_sll_epi64(v, carry), 8);
+            _mm_storeu_si128(row, _mm_and_si128(_mm_or_si128(_mm_srl_epi64(v, count), spill), mask));
+        }
+#else
+        for(unsigned int i = 0; i < height; i++)
+        {
+            uint64_t *row = m_State->display[p][i];
+            row[1] = ((row[1] >> cols) | (row[0] << (64 - cols))) & keep;
+            row[0] >>= cols;
+        }
+#endif
+    }
+
+    m_DisplayGeneration++;
+}
+
+void Chip8Core::scrollLeft(unsigned int cols)
+{
+    const unsigned int height = m_State->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++)
+    {
+        if(!(m_State->planes >> p & 0x1)) continue;
+
+#if defined(__SSE2__)
+        // a 128-bit left shift, lores rows have nothing in the second word to bring in
+        const __m128i count = _mm_cvtsi32_si128(cols);
+        const __m128i carry = _mm_cvtsi32_si128(64 - cols);
+
+        for(unsigned int i = 0; i < height; i++)
+        {
+            __m128i *row = (__m128i*)m_State->display[p][i];
+            __m128i v = _mm_loadu_si128(row);
+            // bits leaving the top of the second word enter the bottom of the first
+            __m128i spill = _mm_srli_si128(_mm_srl_epi64(v, carry), 8);
+            _mm_storeu_si128(row, _mm_or_si128(_mm_sll_epi64(v, count), spill));
+        }
+#else
+        for(unsigned int i = 0; i < height; i++)
+        {
+            uint64_t *row = m_State->display[p][i];
+            row[0] = (row[0] << cols) | (row[1] >> (64 - cols));
+            row[1] <<= cols;
+        }
+#endif
+    }
+
+    m_DisplayGeneration++;
+}
+
+void Chip8Core::setHires(bool hires)
+{
+    uint8_t planes = m_State->planes;
+
+    // switching resolution clears every plane
+    m_State->hires = hires;
+    m_State->planes = (1 << DISPLAY_PLANES) - 1;
+    clearDisplay();
+    m_State->planes = planes;
+}
+
+bool Chip8Core::buildOpTable()
+{
+    for(int opcode = 0; opcode < 0x10000; opcode++)
+    {
+        uint8_t id = OPID_UNK;
+
+        switch(opcode >> 12)
+        {
+        case 0x0:
+            if(opcode == 0x00e0) id = OPID_CLS;
+            else if(opcode == 0x00ee) id = OPID_RET;
+            else if((opcode & 0xfff0) == 0x00c0) id = OPID_SCD;
+            else if((opcode & 0xfff0) == 0x00d0) id = OPID_SCU;
+            else if(opcode == 0x00fb) id = OPID_SCR;
+            else if(opcode == 0x00fc) id = OPID_SCL;
+            else if(opcode == 0x00fd) id = OPID_EXIT;
+            else if(opcode == 0x00fe) id = OPID_LOW;
+            else if(opcode == 0x00ff) id = OPID_HIGH;
+            break;
+        case 0x1: id = OPID_JP; break;
+        case 0x2: id = OPID_CALL; break;
+        case 0x3: id = OPID_SE_KK; break;
+        case 0x4: id = OPID_SNE_KK; break;
+        case 0x5: id = OPID_SE_XY; break;
+        case 0x6: id = OPID_LD_KK; break;
+        case 0x7: id = OPID_ADD_KK; break;
+        case 0x8:
+        {
+            static const uint8_t aluids[16] = { OPID_LD_XY, OPID_OR, OPID_AND, OPID_XOR, OPID_ADD_XY, OPID_SUB, OPID_SHR, OPID_SUBN,
+                                                OPID_UNK, OPID_UNK, OPID_UNK, OPID_UNK, OPID_UNK, OPID_UNK, OPID_SHL, OPID_UNK };
+            id = aluids[OP_N(opcode)];
+            break;
+        }
+        case 0x9: if(OP_N(opcode) == 0x0) id = OPID_SNE_XY; break;
+        case 0xa: id = OPID_LD_I; break;
+        case 0xb: id = OPID_JP_V0; break;
+        case 0xc: id = OPID_RND; break;
+        case 0xd: id = OPID_DRW; break;
+        case 0xe:
+            if(OP_KK(opcode) == 0x9e) id = OPID_SKP;
+            else if(OP_KK(opcode) == 0xa1) id = OPID_SKNP;
+            break;
+        case 0xf:
+            if(opcode == 0xf000)
+            {
+                id = OPID_LD_LONG;
+                break;
+            }
+
+            switch(OP_KK(opcode))
+            {
+            case 0x01: id = OPID_PLANE; break;
+            case 0x07: id = OPID_LD_VX_DT; break;
+            case 0x0a: id = OPID_LD_K; break;
+            case 0x15: id = OPID_LD_DT; break;
+            case 0x18: id = OPID_LD_ST; break;
+            case 0x1e: id = OPID_ADD_I; break;
+            case 0x29: id = OPID_LD_F; break;
+            case 0x30: id = OPID_LD_HF; break;
+            case 0x33: id = OPID_LD_B; break;
+            case 0x55: id = OPID_LD_MEM; break;
+            case 0x65: id = OPID_LD_REG; break;
+            }
+            break;
+        }
+
+        s_OpTable[opcode] = id;
+    }
+
+    return true;
+}
+
+inline void Chip8Core::opUNK(uint16_t opcode)
+{
+    // unknown opcodes are skipped
+}
+
+inline void Chip8Core::opCLS(uint16_t opcode)
+{
+    clearDisplay();
+}
+
+inline void Chip8Core::opRET(uint16_t opcode)
+{
+    if(m_State->stacksize) m_State->pc = m_State->stack[--m_State->stacksize];
+    else m_isPaused = true;
+}
+
+inline void Chip8Core::opJP(uint16_t opcode)
+{
+    m_State->pc = OP_NNN(opcode);
+}
+
+inline void Chip8Core::opCALL(uint16_t opcode)
+{
+    if(m_State->stacksize < MAX_STACK)
+    {
+        m_State->stack[m_State->stacksize++] = m_State->pc;
+        m_State->pc = OP_NNN(opcode);
+    }
+    else m_isPaused = true;
+}
+
+template<int P> inline void Chip8Core::skip()
+{
+    // a skipped f000 steps over its address word too
+    if((quirkFlags(P) & QUIRK_LONG_SKIP) && m_State->mem[m_State->pc] == 0xf0 && m_State->mem[(m_State->pc + 1) & (memorySize(P) - 1)] == 0x00) m_State->pc += 4;
+    else m_State->pc += 2;
+}
+
+template<int P> inline void Chip8Core::opSE_KK(uint16_t opcode)
+{
+    if(m_State->reg[OP_X(opcode)] == OP_KK(opcode)) skip<P>();
+}
+
+template<int P> inline void Chip8Core::opSNE_KK(uint16_t opcode)
+{
+    if(m_State->reg[OP_X(opcode)] != OP_KK(opcode)) skip<P>();
+}
+
+template<int P> inline void Chip8Core::opSE_XY(uint16_t opcode)
+{
+    if(m_State->reg[OP_X(opcode)] == m_State->reg[OP_Y(opcode)]) skip<P>();
+}
+
+inline void Chip8Core::opLD_KK(uint16_t opcode)
+{
+    m_State->reg[OP_X(opcode)] = OP_KK(opcode);
+}
+
+inline void Chip8Core::opADD_KK(uint16_t opcode)
+{
+    m_State->reg[OP_X(opcode)] += OP_KK(opcode);
+}
+
+inline void Chip8Core::opLD_XY(uint16_t opcode)
+{
+    m_State->reg[OP_X(opcode)] = m_State->reg[OP_Y(opcode)];
+}
+
+template<int P> inline void Chip8Core::opOR(uint16_t opcode)
+{
+    m_State->reg[OP_X(opcode)] |= m_State->reg[OP_Y(opcode)];
+    if(quirkFlags(P) & QUIRK_VF_RESET) m_State->reg[0xf] = 0x0;
+}
+
+template<int P> inline void Chip8Core::opAND(uint16_t opcode)
+{
+    m_State->reg[OP_X(opcode)] &= m_State->reg[OP_Y(opcode)];
+    if(quirkFlags(P) & QUIRK_VF_RESET) m_State->reg[0xf] = 0x0;
+}
+
+template<int P> inline void Chip8Core::opXOR(uint16_t opcode)
+{
+    m_State->reg[OP_X(opcode)] ^= m_State->reg[OP_Y(opcode)];
+    if(quirkFlags(P) & QUIRK_VF_RESET) m_State->reg[0xf] = 0x0;
+}
+
+inline void Chip8Core::opADD_XY(uint16_t opcode)
+{
+    unsigned int result = m_State->reg[OP_X(opcode)] + m_State->reg[OP_Y(opcode)];
+
+    // carry flag is written before the result, same as the interpreter
+    m_State->reg[0xf] = (result > 0xff);
+    m_State->reg[OP_X(opcode)] = result & 0xff;
+}
+
+inline void Chip8Core::opSUB(uint16_t opcode)
+{
+    uint8_t vx = m_State->reg[OP_X(opcode)];
+    uint8_t vy = m_State->reg[OP_Y(opcode)];
+
+    m_State->reg[0xf] = (vx > vy);
+    m_State->reg[OP_X(opcode)] = m_State->reg[OP_X(opcode)] - m_State->reg[OP_Y(opcode)];
+}
+
+template<int P> inline void Chip8Core::opSHR(uint16_t opcode)
+{
+    // flag is written before the result, so shifting into vf keeps the result
+    uint8_t src = (quirkFlags(P) & QUIRK_SHIFT_VY) ? OP_Y(opcode) : OP_X(opcode);
+
+    m_State->reg[0xf] = m_State->reg[src] & 0x1;
+    m_State->reg[OP_X(opcode)] = m_State->reg[src] >> 1;
+}
+
+inline void Chip8Core::opSUBN(uint16_t opcode)
+{
+    uint8_t vx = m_State->reg[OP_X(opcode)];
+    uint8_t vy = m_State->reg[OP_Y(opcode)];
+
+    m_State->reg[0xf] = (vy > vx);
+    m_State->reg[OP_X(opcode)] = m_State->reg[OP_Y(opcode)] - m_State->reg[OP_X(opcode)];
+}
+
+template<int P> inline void Chip8Core::opSHL(uint16_t opcode)
+{
+    uint8_t src = (quirkFlags(P) & QUIRK_SHIFT_VY) ? OP_Y(opcode) : OP_X(opcode);
+
+    m_State->reg[0xf] = (m_State->reg[src] & 0x80) >> 7;
+    m_State->reg[OP_X(opcode)] = m_State->reg[src] << 1;
+}
+
+template<int P> inline void Chip8Core::opSNE_XY(uint16_t opcode)
+{
+    if(m_State->reg[OP_X(opcode)] != m_State->reg[OP_Y(opcode)]) skip<P>();
+}
+
+inline void Chip8Core::opLD_I(uint16_t opcode)
+{
+    m_State->ireg = OP_NNN(opcode);
+}
+
+template<int P> inline void Chip8Core::opJP_V0(uint16_t opcode)
+{
+    // Bxnn adds the register named by the top nibble of the address
+    if(quirkFlags(P) & QUIRK_JUMP_VX) m_State->pc = OP_NNN(opcode) + m_State->reg[OP_X(opcode)];
+    else m_State->pc = OP_NNN(opcode) + m_State->reg[0x0];
+}
+
+inline void Chip8Core::opRND(uint16_t opcode)
+{
+    m_State->reg[OP_X(opcode)] = nextRandom() & OP_KK(opcode);
+}
+
+template<int P> inline void Chip8Core::opDRW(uint16_t opcode)
+{
+    m_State->reg[0xf] = drawSprite<P>(m_State->reg[OP_X(opcode)], m_State->reg[OP_Y(opcode)], OP_N(opcode));
+}
+
+template<int P> inline void Chip8Core::opSKP(uint16_t opcode)
+{
+    if( m_State->keys >> m_State->reg[OP_X(opcode)] & 0x01 ) skip<P>();
+}
+
+template<int P> inline void Chip8Core::opSKNP(uint16_t opcode)
+{
+    if( !(m_State->keys >> m_State->reg[OP_X(opcode)] & 0x01) ) skip<P>();
+}
+
+inline void Chip8Core::opLD_VX_DT(uint16_t opcode)
+{
+    m_State->reg[OP_X(opcode)] = m_State->delay;
+}
+
+inline void Chip8Core::opLD_K(uint16_t opcode)
+{
+    // if no keys are pressed, do not advance program counter
+    if(m_State->keys == 0x00) m_State->pc -= 2;
+    m_State->reg[OP_X(opcode)] = m_State->keys;
+}
+
+inline void Chip8Core::opLD_DT(uint16_t opcode)
+{
+    m_State->delay = m_State->reg[OP_X(opcode)];
+}
+
+inline void Chip8Core::opLD_ST(uint16_t opcode)
+{
+    m_State->sound = m_State->reg[OP_X(opcode)];
+}
+
+inline void Chip8Core::opADD_I(uint16_t opcode)
+{
+    m_State->ireg += m_State->reg[OP_X(opcode)];
+}
+
+inline void Chip8Core::opLD_F(uint16_t opcode)
+{
+    // only the low nibble picks the digit
+    m_State->ireg = FONT_ADDR + (m_State->reg[OP_X(opcode)] & 0xf)*5;
+}
+
+template<int P> inline void Chip8Core::opLD_B(uint16_t opcode)
+{
+    uint8_t val = m_State->reg[OP_X(opcode)];
+    uint16_t addr = m_State->ireg & (memorySize(P) - 1);
+
+    // hundreds at I, ones at I+2
+    m_State->mem[addr] = val/100;
+    m_State->mem[(addr+1) & (memorySize(P) - 1)] = (val/10)%10;
+    m_State->mem[(addr+2) & (memorySize(P) - 1)] = val%10;
+
+    invalidateCode(addr, 3);
+}
+
+template<int P> inline void Chip8Core::opLD_MEM(uint16_t opcode)
+{
+    uint8_t x = OP_X(opcode);
+    uint16_t addr = m_State->ireg & (memorySize(P) - 1);
+
+    for(int j = 0; j <= x; j++)  m_State->mem[(addr + j) & (memorySize(P) - 1)] = m_State->reg[j];
+
+    invalidateCode(addr, x + 1);
+    if(quirkFlags(P) & QUIRK_LOAD_STORE_I) m_State->ireg += x + 1;
+}
+
+template<int P> inline void Chip8Core::opLD_REG(uint16_t opcode)
+{
+    uint8_t x = OP_X(opcode);
+
+    for(int j = 0; j <= x; j++)  m_State->reg[j] = m_State->mem[(m_State->ireg + j) & (memorySize(P) - 1)];
+
+    if(quirkFlags(P) & QUIRK_LOAD_STORE_I) m_State->ireg += x + 1;
+}
+
+inline void Chip8Core::opSCD(uint16_t opcode)
+{
+    scrollDown(OP_N(opcode));
+}
+
+inline void Chip8Core::opSCU(uint16_t opcode)
+{
+    scrollUp(OP_N(opcode));
+}
+
+inline void Chip8Core::opSCR(uint16_t opcode)
+{
+    scrollRight(4);
+}
+
+inline void Chip8Core::opSCL(uint16_t opcode)
+{
+    scrollLeft(4);
+}
+
+inline void Chip8Core::opEXIT(uint16_t opcode)
+{
+    m_isPaused = true;
+}
+
+inline void Chip8Core::opLOW(uint16_t opcode)
+{
+    setHires(false);
+}
+
+inline void Chip8Core::opHIGH(uint16_t opcode)
+{
+    setHires(true);
+}
+
+inline void Chip8Core::opLD_HF(uint16_t opcode)
+{
+    m_State->ireg = BIG_FONT_ADDR + (m_State->reg[OP_X(opcode)] & 0xf)*10;
+}
+
+inline void Chip8Core::opPLANE(uint16_t opcode)
+{
+    m_State->planes = OP_X(opcode) & ((1 << DISPLAY_PLANES) - 1);
+}
+
+inline void Chip8Core::opLD_LONG(uint16_t opcode)
+{
+    m_State->ireg = m_State->mem[m_State->pc] << 8 | m_State->mem[(m_State->pc + 1) & (memorySize(m_State->quirks) - 1)];
+    m_State->pc += 2;
+}
+
+template<int P> unsigned int Chip8Core::executeInterpreter(unsigned int count)
+{
+    bool waspaused = m_isPaused;
+    unsigned int executed = 0;
+
+    while(executed < count)
+    {
+        // if program counter reached the end of memory, pause without running the last word
+        if(m_State->pc >= memorySize(P) - 2)
+        {
+            m_isPaused = true;
+            break;
+        }
+
+        if(!processInstruction<P>( fetchInstruction(m_State->pc) )) break;
+        executed++;
+
+        // stop the batch if the instruction paused the cpu
+        if(m_isPaused && !waspaused) break;
+    }
+
+    return executed;
+}
+
+template<int P> unsigned int Chip8Core::executeTable(unsigned int count)
+{
+    bool waspaused = m_isPaused;
+    unsigned int executed = 0;
+
+    while(executed < count)
+    {
+        // if program counter reached the end of memory, pause
+        if(m_State->pc >= memorySize(P) - 2)
+        {
+            m_isPaused = true;
+            break;
+        }
+
+        uint16_t opcode = m_State->mem[m_State->pc] << 8 | m_State->mem[m_State->pc+1];
+        m_State->pc += 2;
+
+        s_OpHandlers[P][s_OpTable[opcode]](this, opcode);
+        executed++;
+
+        // stop the batch if the instruction paused the cpu
+        if(m_isPaused && !waspaused) break;
+    }
+
+    return executed;
+}
+
+template<int P, bool STOPS> unsigned int Chip8Core::executeGoto(unsigned int count)
+{
+#if defined(__GNUC__)
+    // labels in OPCODE_ID order
+    static void *const labels[OPID_COUNT] = {
+        &&op_unk, &&op_cls, &&op_ret, &&op_jp, &&op_call, &&op_se_kk, &&op_sne_kk, &&op_se_xy,
+        &&op_ld_kk, &&op_add_kk, &&op_ld_xy, &&op_or, &&op_and, &&op_xor, &&op_add_xy, &&op_sub,
+        &&op_shr, &&op_subn, &&op_shl, &&op_sne_xy, &&op_ld_i, &&op_jp_v0, &&op_rnd, &&op_drw,
+        &&op_skp, &&op_sknp, &&op_ld_vx_dt, &&op_ld_k, &&op_ld_dt, &&op_ld_st, &&op_add_i, &&op_ld_f,
+        &&op_ld_b, &&op_ld_mem, &&op_ld_reg, &&op_scd, &&op_scu, &&op_scr, &&op_scl, &&op_exit,
+        &&op_low, &&op_high, &&op_ld_hf, &&op_plane, &&op_ld_long
+    };
+
+    bool waspaused = m_isPaused;
+    unsigned int executed = 0;
+    uint16_t opcode;
+
+    // fetch next opcode and jump straight to its handler
+    #define DISPATCH() \
+        if(executed >= count) goto done; \
+        if(m_State->pc >= memorySize(P) - 2) goto overflow; \
+        if(STOPS && executed && m_Stops[m_State->pc]) goto done; \
+        opcode = m_State->mem[m_State->pc] << 8 | m_State->mem[m_State->pc+1]; \
+        m_State->pc += 2; \
+        executed++; \
+        goto *labels[s_OpTable[opcode]]
+
+    DISPATCH();
+
+    op_unk: DISPATCH();
+    op_cls: opCLS(opcode); DISPATCH();
+    op_ret: opRET(opcode); if(m_isPaused && !waspaused) goto done; DISPATCH();
+    op_jp: opJP(opcode); DISPATCH();
+    op_call: opCALL(opcode); if(m_isPaused && !waspaused) goto done; DISPATCH();
+    op_se_kk: opSE_KK<P>(opcode); DISPATCH();
+    op_sne_kk: opSNE_KK<P>(opcode); DISPATCH();
+    op_se_xy: opSE_XY<P>(opcode); DISPATCH();
+    op_ld_kk: opLD_KK(opcode); DISPATCH();
+    op_add_kk: opADD_KK(opcode); DISPATCH();
+    op_ld_xy: opLD_XY(opcode); DISPATCH();
+    op_or: opOR<P>(opcode); DISPATCH();
+    op_and: opAND<P>(opcode); DISPATCH();
+    op_xor: opXOR<P>(opcode); DISPATCH();
+    op_add_xy: opADD_XY(opcode); DISPATCH();
+    op_sub: opSUB(opcode); DISPATCH();
+    op_shr: opSHR<P>(opcode); DISPATCH();
+    op_subn: opSUBN(opcode); DISPATCH();
+    op_shl: opSHL<P>(opcode); DISPATCH();
+    op_sne_xy: opSNE_XY<P>(opcode); DISPATCH();
+    op_ld_i: opLD_I(opcode); DISPATCH();
+    op_jp_v0: opJP_V0<P>(opcode); DISPATCH();
+    op_rnd: opRND(opcode); DISPATCH();
+    op_drw: opDRW<P>(opcode); DISPATCH();
+    op_skp: opSKP<P>(opcode); DISPATCH();
+    op_sknp: opSKNP<P>(opcode); DISPATCH();
+    op_ld_vx_dt: opLD_VX_DT(opcode); DISPATCH();
+    op_ld_k: opLD_K(opcode); DISPATCH();
+    op_ld_dt: opLD_DT(opcode); DISPATCH();
+    op_ld_st: opLD_ST(opcode); DISPATCH();
+    op_add_i: opADD_I(opcode); DISPATCH();
+    op_ld_f: opLD_F(opcode); DISPATCH();
+    op_ld_b: opLD_B<P>(opcode); DISPATCH();
+    op_ld_mem: opLD_MEM<P>(opcode); DISPATCH();
+    op_ld_reg: opLD_REG<P>(opcode); DISPATCH();
+    op_scd: opSCD(opcode); DISPATCH();
+    op_scu: opSCU(opcode); DISPATCH();
+    op_scr: opSCR(opcode); DISPATCH();
+    op_scl: opSCL(opcode); DISPATCH();
+    op_exit: opEXIT(opcode); if(m_isPaused && !waspaused) goto done; DISPATCH();
+    op_low: opLOW(opcode); DISPATCH();
+    op_high: opHIGH(opcode); DISPATCH();
+    op_ld_hf: opLD_HF(opcode); DISPATCH();
+    op_plane: opPLANE(opcode); DISPATCH();
+    op_ld_long: opLD_LONG(opcode); DISPATCH();
+
+    #undef DISPATCH
+
+overflow:
+    // program counter reached the end of memory, pause
+    m_isPaused = true;
+done:
+    return executed;
+#else
+    return executeTable<P>(count);
+#endif
+}
+
+template<Chip8Core::OpHandler H> void Chip8Core::threadedOp(Chip8Core *chip, const ThreadedOp *op)
+{
+    (chip->*H)(op->opcode);
+}
+
+template<Chip8Core::OpHandler A, Chip8Core::OpHandler B> void Chip8Core::threadedFused(Chip8Core *chip, const ThreadedOp *op)
+{
+    (chip->*A)(op->opcode);
+    (chip->*B)(op->opcode2);
+}
+
+// threaded handlers of one quirk profile, in OPCODE_ID order
+#define THREADED_HANDLERS(P) { \
+    &threadedOp<&Chip8Core::opUNK>, &threadedOp<&Chip8Core::opCLS>, &threadedOp<&Chip8Core::opRET>, &threadedOp<&Chip8Core::opJP>, \
+    &threadedOp<&Chip8Core::opCALL>, &threadedOp<&Chip8Core::opSE_KK<P> >, &threadedOp<&Chip8Core::opSNE_KK<P> >, &threadedOp<&Chip8Core::opSE_XY<P> >, \
+    &threadedOp<&Chip8Core::opLD_KK>, &threadedOp<&Chip8Core::opADD_KK>, &threadedOp<&Chip8Core::opLD_XY>, &threadedOp<&Chip8Core::opOR<P> >, \
+    &threadedOp<&Chip8Core::opAND<P> >, &threadedOp<&Chip8Core::opXOR<P> >, &threadedOp<&Chip8Core::opADD_XY>, &threadedOp<&Chip8Core::opSUB>, \
+    &threadedOp<&Chip8Core::opSHR<P> >, &threadedOp<&Chip8Core::opSUBN>, &threadedOp<&Chip8Core::opSHL<P> >, &threadedOp<&Chip8Core::opSNE_XY<P> >, \
+    &threadedOp<&Chip8Core::opLD_I>, &threadedOp<&Chip8Core::opJP_V0<P> >, &threadedOp<&Chip8Core::opRND>, &threadedOp<&Chip8Core::opDRW<P> >, \
+    &threadedOp<&Chip8Core::opSKP<P> >, &threadedOp<&Chip8Core::opSKNP<P> >, &threadedOp<&Chip8Core::opLD_VX_DT>, &threadedOp<&Chip8Core::opLD_K>, \
+    &threadedOp<&Chip8Core::opLD_DT>, &threadedOp<&Chip8Core::opLD_ST>, &threadedOp<&Chip8Core::opADD_I>, &threadedOp<&Chip8Core::opLD_F>, \
+    &threadedOp<&Chip8Core::opLD_B<P> >, &threadedOp<&Chip8Core::opLD_MEM<P> >, &threadedOp<&Chip8Core::opLD_REG<P> >, &threadedOp<&Chip8Core::opSCD>, \
+    &threadedOp<&Chip8Core::opSCU>, &threadedOp<&Chip8Core::opSCR>, &threadedOp<&Chip8Core::opSCL>, &threadedOp<&Chip8Core::opEXIT>, \
+    &threadedOp<&Chip8Core::opLOW>, &threadedOp<&Chip8Core::opHIGH>, &threadedOp<&Chip8Core::opLD_HF>, &threadedOp<&Chip8Core::opPLANE>, \
+    &threadedOp<&Chip8Core::opLD_LONG> }
+
+const ThreadedHandler Chip8Core::s_ThreadedHandlers[QUIRKS_COUNT][OPID_COUNT] = {
+    THREADED_HANDLERS(QUIRKS_MODERN), THREADED_HANDLERS(QUIRKS_VIP), THREADED_HANDLERS(QUIRKS_SCHIP), THREADED_HANDLERS(QUIRKS_XOCHIP)
+};
+
+// instructions that end a basic block: control flow, key waits, memory writes and long loads
+static bool isBlockTerminator(uint8_t id)
+{
+    switch(id)
+    {
+    case OPID_RET: case OPID_JP: case OPID_CALL: case OPID_JP_V0: case OPID_EXIT:
+    case OPID_SE_KK: case OPID_SNE_KK: case OPID_SE_XY: case OPID_SNE_XY: case OPID_SKP: case OPID_SKNP:
+    case OPID_LD_K: case OPID_LD_B: case OPID_LD_MEM: case OPID_LD_LONG:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Chip8Core::isTickSensitive(uint8_t id)
+{
+    switch(id)
+    {
+    case OPID_LD_VX_DT: case OPID_LD_DT: case OPID_LD_ST:
+    case OPID_SKP: case OPID_SKNP: case OPID_LD_K:
+        return true;
+    default:
+        return false;
+    }
+}
+
+template<int P> ThreadedBlock *Chip8Core::translateBlock(uint16_t start)
+{
+    // leave the end of memory to the table engine so it pauses the same way
+    if(start >= memorySize(P) - 2) return NULL;
+
+    ThreadedBlock *blk = new ThreadedBlock;
+    blk->start = start;
+    blk->instructions = 0;
+    blk->overrun = true;
+
+    uint16_t addr = start;
+    bool terminated = false;
+
+    while(!terminated && addr < memorySize(P) - 2 && blk->instructions < MAX_BLOCK_INSTRUCTIONS)
+    {
+        ThreadedOp top;
+        top.opcode = m_State->mem[addr] << 8 | m_State->mem[addr+1];
+        top.opcode2 = 0x0;
+
+        uint8_t id = s_OpTable[top.opcode];
+        top.handler = s_ThreadedHandlers[P][id];
+        terminated = isBlockTerminator(id);
+        if(isTickSensitive(id)) blk->overrun = false;
+        addr += 2;
+        blk->instructions++;
+
+        // fuse common pairs into superinstructions
+        if(!terminated && addr < memorySize(P) - 2 && blk->instructions < MAX_BLOCK_INSTRUCTIONS)
+        {
+            uint16_t nextopcode = m_State->mem[addr] << 8 | m_State->mem[addr+1];
+            uint8_t nid = s_OpTable[nextopcode];
+            ThreadedHandler fused = NULL;
+
+            // load register then point I at sprite / data
+            if(id == OPID_LD_KK && nid == OPID_LD_I) fused = &threadedFused<&Chip8Core::opLD_KK, &Chip8Core::opLD_I>;
+            // delay timer polling loop
+            else if(id == OPID_LD_VX_DT && nid == OPID_SE_KK) fused = &threadedFused<&Chip8Core::opLD_VX_DT, &Chip8Core::opSE_KK<P> >;
+            else if(id == OPID_LD_VX_DT && nid == OPID_SNE_KK) fused = &threadedFused<&Chip8Core::opLD_VX_DT, &Chip8Core::opSNE_KK<P> >;
+            // move sprite then draw it
+            else if(id == OPID_ADD_KK && nid == OPID_DRW) fused = &threadedFused<&Chip8Core::opADD_KK, &Chip8Core::opDRW<P> >;
+
+            if(fused)
+            {
+                top.handler = fused;
+                top.opcode2 = nextopcode;
+                terminated = isBlockTerminator(nid);
+                if(isTickSensitive(nid)) blk->overrun = false;
+                addr += 2;
+                blk->instructions++;
+            }
+        }
+
+        blk->ops.push_back(top);
+    }
+
+    blk->end = addr;
+
+    for(int i = blk->start; i < blk->end; i++) m_BlockCoverage[i]++;
+    m_BlockCache[start] = blk;
+    m_Blocks.push_back(blk);
+
+    return blk;
+}
+
+void Chip8Core::invalidateBlocks(uint16_t addr, unsigned int len)
+{
+    int end = int(addr) + len;
+    if(end > int(m_BlockCoverage.size())) end = m_BlockCoverage.size();
+
+    // most writes land in data, only scan the blocks if a written byte is code
+    bool covered = false;
+    for(int i = addr; i < end; i++)
+    {
+        if(m_BlockCoverage[i])
+        {
+            covered = true;
+            break;
+        }
+    }
+    if(!covered) return;
+
+    for(int i = 0; i < int(m_Blocks.size()); )
+    {
+        ThreadedBlock *blk = m_Blocks[i];
+
+        if(blk->start < end && blk->end > addr)
+        {
+            for(int n = blk->start; n < blk->end; n++) m_BlockCoverage[n]--;
+            m_BlockCache[blk->start] = NULL;
+
+            // the writing block may still be running, free it later
+            m_RetiredBlocks.push_back(blk);
+            m_Blocks[i] = m_Blocks.back();
+            m_Blocks.pop_back();
+        }
+        else i++;
+    }
+}
+
+void Chip8Core::flushBlocks()
+{
+    for(int i = 0; i < int(m_Blocks.size()); i++)
+    {
+        m_BlockCache[m_Blocks[i]->start] = NULL;
+        delete m_Blocks[i];
+    }
+    for(int i = 0; i < int(m_RetiredBlocks.size()); i++) delete m_RetiredBlocks[i];
+
+    m_Blocks.clear();
+    m_RetiredBlocks.clear();
+
+    // sized for the memory of the current profile
+    m_BlockCache.assign(memorySize(m_State->quirks), NULL);
+    m_BlockCoverage.assign(memorySize(m_State->quirks), 0);
+}
+
+template<int P> unsigned int Chip8Core::executeThreaded(unsigned int count)
+{
+    bool waspaused = m_isPaused;
+    unsigned int executed = 0;
+
+    // no block is running between batches
+    if(!m_RetiredBlocks.empty())
+    {
+        for(int i = 0; i < int(m_RetiredBlocks.size()); i++) delete m_RetiredBlocks[i];
+        m_RetiredBlocks.clear();
+    }
+
+    while(executed < count)
+    {
+        ThreadedBlock *blk = NULL;
+
+        if(m_State->pc < memorySize(P) - 2)
+        {
+            blk = m_BlockCache[m_State->pc];
+            if(!blk) blk = translateBlock<P>(m_State->pc);
+        }
+
+        // finish with single instructions if the block does not fit the budget, blocks that
+        // leave the timers and keys alone may run past it and the guest clock catches up after them
+        if(!blk || blk->instructions > count - executed + (blk->overrun ? m_BatchOverrun : 0))
+        {
+            executed += executeTable<P>(count - executed);
+            break;
+        }
+
+        // only the last op of a block can read the program counter
+        m_State->pc = blk->end;
+
+        const ThreadedOp *op = &blk->ops[0];
+        const ThreadedOp *opend = op + blk->ops.size();
+        for(; op != opend; ++op) op->handler(this, op);
+
+        executed += blk->instructions;
+
+        // stop the batch if the instruction paused the cpu
+        if(m_isPaused && !waspaused) break;
+    }
+
+    return executed;
+}
+
+void Chip8Core::profileInstruction(uint16_t opcode, uint8_t id)
+{
+    m_Profiler->countInstruction(m_State->pc, id);
+
+    // data the instruction is about to touch, same bounds as the handlers
+    uint8_t count = OP_X(opcode) + 1;
+
+    if(id == OPID_DRW)
+    {
+        uint8_t x = m_State->reg[OP_X(opcode)];
+        uint8_t y = m_State->reg[OP_Y(opcode)];
+        // Dxy0 fetches 16 rows of 2 bytes
+        unsigned int height = OP_N(opcode) ? OP_N(opcode) : 16;
+        unsigned int bytes = OP_N(opcode) ? 1 : 2;
+        unsigned int rows = height;
+        unsigned int planes = (m_State->planes & 0x1) + (m_State->planes >> 1 & 0x1);
+
+        // Dxy0 without big sprites draws nothing
+        if(!OP_N(opcode) && !(quirkFlags(m_State->quirks) & QUIRK_BIG_SPRITE)) rows = 0;
+        // clipped sprites stop fetching at the bottom edge, sprites starting off screen fetch nothing
+        else if(!(quirkFlags(m_State->quirks) & QUIRK_WRAP))
+        {
+            if(x >= getDisplayWidth() || y >= getDisplayHeight()) rows = 0;
+            else if(y + rows > getDisplayHeight()) rows = getDisplayHeight() - y;
+        }
+
+        // each selected plane reads the next sprite, only the last one is counted up to the clip
+        if(rows && planes) m_Profiler->countReads(m_State->ireg, ((planes - 1) * height + rows) * bytes);
+    }
+    else if(id == OPID_LD_B) m_Profiler->countWrites(m_State->ireg, 3);
+    else if(id == OPID_LD_MEM) m_Profiler->countWrites(m_State->ireg, count);
+    else if(id == OPID_LD_REG) m_Profiler->countReads(m_State->ireg, count);
+    else if(id == OPID_CALL && m_State->stacksize < MAX_STACK) m_Profiler->countCall(OP_NNN(opcode), m_State->stacksize + 1);
+}
+
+template<int P> unsigned int Chip8Core::executeInstrumented(unsigned int count)
+{
+    bool waspaused = m_isPaused;
+    unsigned int executed = 0;
+
+    // executeTable() with every instruction looked at first
+    while(executed < count)
+    {
+        // if program counter reached the end of memory, pause
+        if(m_State->pc >= memorySize(P) - 2)
+        {
+            m_isPaused = true;
+            break;
+        }
+
+        uint16_t opcode = m_State->mem[m_State->pc] << 8 | m_State->mem[m_State->pc+1];
+        uint8_t id = s_OpTable[opcode];
+
+        if(m_Profiler) profileInstruction(opcode, id);
+        // first instruction to read the keys after a key change
+        if(m_Latency && (id == OPID_SKP || id == OPID_SKNP || id == OPID_LD_K)) m_Latency->observed(m_DisplayGeneration);
+        m_State->pc += 2;
+
+        s_OpHandlers[P][id](this, opcode);
+        executed++;
+
+        // stop the batch if the instruction paused the cpu
+        if(m_isPaused && !waspaused) break;
+    }
+
+    return executed;
+}
+
+template<int P> unsigned int Chip8Core::executeProfile(unsigned int count)
+{
+    // one check per batch is all profiling and latency measurement cost when they are off
+    if(m_Profiler || (m_Latency && m_Latency->isWaiting())) return executeInstrumented<P>(count);
+    else if(m_DispatchMode == DISPATCH_JIT) return executeJit<P>(count);
+    else if(m_DispatchMode == DISPATCH_THREADED) return executeThreaded<P>(count);
+    else if(m_DispatchMode == DISPATCH_GOTO) return executeGoto<P>(count);
+    else if(m_DispatchMode == DISPATCH_TABLE) return executeTable<P>(count);
+    else return executeInterpreter<P>(count);
+}
+
+unsigned int Chip8Core::executeInstructions(unsigned int count)
+{
+    unsigned int executed = 0;
+
+    // the guest sees one key state for the whole batch
+    if(m_LatchKeys)
+    {
+        // before reading the keys, a change seen here is in the state read below
+        if(m_Latency) m_Latency->latched();
+
+        uint16_t keys = m_KeyState;
+        if(m_InputLog && keys != m_State->keys) m_InputLog->writeKeys(m_State->cycles, keys);
+        m_State->keys = keys;
+    }
+
+    // the quirk profile is looked at once per batch, the engines have it compiled in
+    switch(m_State->quirks)
+    {
+    case QUIRKS_VIP: executed = executeProfile<QUIRKS_VIP>(count); break;
+    case QUIRKS_SCHIP: executed = executeProfile<QUIRKS_SCHIP>(count); break;
+    case QUIRKS_XOCHIP: executed = executeProfile<QUIRKS_XOCHIP>(count); break;
+    default: executed = executeProfile<QUIRKS_MODERN>(count); break;
+    }
+
+    if(m_Latency) m_Latency->displayChanged(m_DisplayGeneration);
+
+    return executed;
+}
+
+bool Chip8Core::executeNextInstruction()
+{
+    return executeInstructions(1) == 1;
+}
+
+bool Chip8Core::loadRom(std::string filename, uint16_t addr)
+{
+    MappedFile file;
+
+    if(!file.open(filename)) return false;
+
+    return loadRom(file.getData(), file.getSize(), addr);
+}
+
+bool Chip8Core::loadRom(const uint8_t *data, unsigned int size, uint16_t addr)
+{
+    // the profile decides how much memory there is to load into
+    uint8_t profile = m_QuirkMode == QUIRKS_AUTO ? detectQuirks(data, size, addr) : m_QuirkMode;
+    if(addr >= memorySize(profile) || size > memorySize(profile) - addr) return false;
+
+    applyQuirks(profile);
+    loadProgram(data, size, addr);
+
+    return true;
+}
+
+void Chip8Core::setQuirks(QUIRK_PROFILE profile)
+{
+    m_QuirkMode = profile;
+
+    // auto waits for the next rom
+    if(profile != QUIRKS_AUTO) applyQuirks(profile);
+}
+
+void Chip8Core::applyQuirks(uint8_t profile)
+{
+    if(profile == m_State->quirks) return;
+
+    // only xo-chip has more than 4KB, the state and the per address caches follow the profile
+    if(memorySize(profile) != memorySize(m_State->quirks))
+    {
+        m_State = resizeState(m_State, profile);
+        m_DecodeCache.assign(memorySize(profile), DecodedInstruction());
+        // and so does the size of a dirty block
+        m_DirtyBlocks = ~0ULL;
+    }
+
+    m_State->quirks = profile;
+
+    // translated and compiled code has the old profile built in
+    flushBlocks();
+    flushJit();
+}
+
+QUIRK_PROFILE Chip8Core::detectQuirks(const uint8_t *data, unsigned int size, uint16_t addr)
+{
+    // only instructions the program can reach, data often looks like anything
+    CodeMap *map = new CodeMap;
+    map->analyse(data, size, addr);
+
+    QUIRK_PROFILE profile = QUIRKS_MODERN;
+    unsigned int end = std::min(unsigned(addr) + size, unsigned(MAX_MEMORY));
+
+    for(unsigned int a = addr; a < end && profile != QUIRKS_XOCHIP; a++)
+    {
+        if(!map->isCode(a)) continue;
+
+        uint16_t opcode = data[a - addr] << 8 | (a + 1 < end ? data[a + 1 - addr] : 0);
+        uint8_t kk = opcode & 0xff;
+
+        // xo-chip: 5xy2/5xy3 register ranges, F000 long I, Fn01 planes, F002 audio, Fx3A pitch, 00Dn scroll up
+        if( ((opcode & 0xf00e) == 0x5002) || opcode == 0xf000 || (opcode & 0xf0ff) == 0xf001 || opcode == 0xf002 ||
+            ((opcode & 0xf0ff) == 0xf03a) || (opcode & 0xfff0) == 0x00d0) profile = QUIRKS_XOCHIP;
+        // super-chip: 00Cn/00FB/00FC scrolling, 00FD exit, 00FE/00FF resolution, Dxy0 16x16 sprites, Fx30/Fx75/Fx85
+        else if( (opcode & 0xfff0) == 0x00c0 || (opcode >= 0x00fb && opcode <= 0x00ff) || ((opcode & 0xf00f) == 0xd000) ||
+                 ((opcode & 0xf000) == 0xf000 && (kk == 0x30 || kk == 0x75 || kk == 0x85)) ) profile = QUIRKS_SCHIP;
+    }
+
+    delete map;
+
+    return profile;
+}
+
+void Chip8Core::loadProgram(const uint8_t *data, unsigned int size, uint16_t addr)
+{
+    const unsigned int memsize = memorySize(m_State->quirks);
+
+    if(addr >= memsize) return;
+    if(size > memsize - addr) size = memsize - addr;
+
+    memcpy(m_State->mem + addr, data, size);
+    invalidateCode(addr, size);
+}
+
+uint8_t Chip8Core::nextRandom()
+{
+    // xorshift32, same generator as the lockstep lanes
+    uint32_t r = m_State->rng;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    m_State->rng = r;
+
+    return uint8_t(r);
+}
+
+void Chip8Core::saveState(MachineState *state) const
+{
+    memcpy(state, m_State, stateSize(m_State->quirks));
+}
+
+void Chip8Core::loadState(const MachineState &state)
+{
+    uint64_t cycle = m_State->cycles;
+
+    // translated code belongs to one profile, and so does the memory size
+    applyQuirks(state.quirks);
+
+    // only drop decoded and translated code where memory differs, a rewind usually touches a few bytes
+    for(unsigned int i = 0; i < memorySize(state.quirks); i += 64)
+    {
+        if(memcmp(m_State->mem + i, state.mem + i, 64)) invalidateCode(i, 64);
+    }
+
+    memcpy(m_State, &state, stateSize(state.quirks));
+
+    // the display may be anything now, make the renderer take it
+    m_DisplayGeneration++;
+
+    // a replay has to replace the state at the same point
+    if(m_InputLog) m_InputLog->writeState(cycle, *m_State);
+}
+
+bool Chip8Core::saveStateFile(std::string filename) const
+{
+    std::ofstream ofile;
+
+    ofile.open(filename.c_str(), std::ios::binary);
+
+    if(!ofile.is_open()) return false;
+
+    // header is the magic, the version and the state size, the state follows in host byte order
+    uint32_t version = STATE_FILE_VERSION;
+    uint32_t size = stateSize(m_State->quirks);
+
+    ofile.write(STATE_FILE_MAGIC, 4);
+    ofile.write((const char*)&version, sizeof(version));
+    ofile.write((const char*)&size, sizeof(size));
+    ofile.write((const char*)m_State, size);
+
+    ofile.close();
+
+    return !ofile.fail();
+}
+
+bool Chip8Core::loadStateFile(std::string filename)
+{
+    std::ifstream ifile;
+
+    ifile.open(filename.c_str(), std::ios::binary);
+
+    if(!ifile.is_open()) return false;
+
+    char magic[4];
+    uint32_t version = 0;
+    uint32_t size = 0;
+
+    ifile.read(magic, 4);
+    ifile.read((char*)&version, sizeof(version));
+    ifile.read((char*)&size, sizeof(size));
+
+    // refuse states from another version or build of the machine
+    if(!ifile || memcmp(magic, STATE_FILE_MAGIC, 4) || version != STATE_FILE_VERSION)
+    {
+        std::cout << "Error state file version mismatch:" << filename << std::endl;
+        return false;
+    }
+
+    // read into a scratch copy so a short file leaves the machine alone
+    MachineState *state = readState(ifile, size);
+    if(!state) return false;
+
+    loadState(*state);
+    free(state);
+
+    return true;
+}
+
+void Chip8Core::setCPUFrequency(unsigned int hz)
+{
+    m_CPUFrequency = hz;
+
+    // uncapped runs keep the nominal guest speed relative to the timers
+    if(hz == 0) hz = CPU_FREQUENCY;
+
+    m_InstructionsPerFrame = hz / TIMER_FREQUENCY;
+    if(m_InstructionsPerFrame == 0) m_InstructionsPerFrame = 1;
+}
+
+void Chip8Core::updateBuzzer(uint64_t cycle)
+{
+    bool on = m_State->sound > 0;
+
+    if(on == m_Buzzer) return;
+    m_Buzzer = on;
+
+    if(m_SoundEventCount < MAX_SOUND_EVENTS)
+    {
+        m_SoundEvents[m_SoundEventCount].cycle = cycle;
+        m_SoundEvents[m_SoundEventCount].on = on;
+        m_SoundEventCount++;
+    }
+}
+
+void Chip8Core::advanceGuestClock(unsigned int executed)
+{
+    // only blocks without Fx18 run across a timer tick, a tone started by Fx18 is stamped at the start
+    // of its batch and one stopped by it at the end, so it is never cut short
+    updateBuzzer(m_State->sound ? m_State->cycles : m_State->cycles + executed);
+
+    m_State->cycles += executed;
+    m_State->tickcounter += executed;
+
+    // delay and sound timers tick at 60Hz of guest time, a block that ran past the end
+    // of its batch can have crossed more than one tick
+    while(m_State->tickcounter >= m_InstructionsPerFrame)
+    {
+        m_State->tickcounter -= m_InstructionsPerFrame;
+        m_State->frames++;
+
+        if(m_State->delay > 0) m_State->delay--;
+        if(m_State->sound > 0) m_State->sound--;
+
+        // the tick that runs the sound timer out stops the tone
+        updateBuzzer(m_State->cycles - m_State->tickcounter);
+    }
+}
+
+unsigned int Chip8Core::runCycles(uint64_t count, bool exact)
+{
+    bool waspaused = m_isPaused;
+    unsigned int total = 0;
+
+    while(total < count)
+    {
+        // replayed input takes effect at the cycle it was recorded at
+        if(m_InputLog && m_InputLog->isReplaying()) applyInputEvents();
+
+        if(limitReached()) break;
+
+        // split batches at timer ticks so the timers tick after the right instruction
+        uint64_t chunk = count - total;
+        if(chunk > m_InstructionsPerFrame - m_State->tickcounter) chunk = m_InstructionsPerFrame - m_State->tickcounter;
+        if(m_CycleLimit && chunk > m_CycleLimit - m_State->cycles) chunk = m_CycleLimit - m_State->cycles;
+
+        // and at the next replayed event
+        const InputEvent *next = m_InputLog ? m_InputLog->peek() : NULL;
+        if(next && next->cycle > m_State->cycles && chunk > next->cycle - m_State->cycles) chunk = next->cycle - m_State->cycles;
+
+        // a block may finish past the tick or count, but not past a limit, a replayed event
+        // or the tick that reaches the frame limit
+        uint64_t overrun = exact ? 0 : MAX_BLOCK_INSTRUCTIONS;
+        if(m_CycleLimit && overrun > m_CycleLimit - m_State->cycles - chunk) overrun = m_CycleLimit - m_State->cycles - chunk;
+        if(next && next->cycle > m_State->cycles && overrun > next->cycle - m_State->cycles - chunk) overrun = next->cycle - m_State->cycles - chunk;
+        // a block that starts frames before the limit can still cross several ticks, so count from here to the limit
+        uint64_t tolimit = (m_FrameLimit - m_State->frames) * m_InstructionsPerFrame - m_State->tickcounter - chunk;
+        if(m_FrameLimit && overrun > tolimit) overrun = tolimit;
+
+        m_BatchOverrun = overrun;
+        unsigned int executed = executeInstructions(chunk);
+        m_BatchOverrun = 0;
+        advanceGuestClock(executed);
+        total += executed;
+
+        // stop if the cpu paused or halted
+        if(executed < chunk || (m_isPaused && !waspaused)) break;
+    }
+
+    return total;
+}
+
+uint64_t Chip8Core::run()
+{
+    uint64_t startcycles = m_State->cycles;
+
+    // no pacing and no publishing, whole timer frames until halted or a limit is hit
+    while(!m_isPaused && !limitReached()) runCycles(m_InstructionsPerFrame);
+
+    return m_State->cycles - startcycles;
+}
+
+RunResult Chip8Core::runFor(uint64_t cycles)
+{
+    RunResult result;
+    result.cycles = 0;
+    result.frameready = false;
+
+    // a halted guest stays put until the host resumes it
+    if(m_isPaused) return result;
+
+    uint64_t startframes = m_State->frames;
+
+    // runCycles() counts in 32 bits, hand it a timer frame at a time
+    // the last one can end a block past cycles
+    while(result.cycles < cycles)
+    {
+        uint64_t chunk = cycles - result.cycles;
+        if(chunk > m_InstructionsPerFrame) chunk = m_InstructionsPerFrame;
+
+        unsigned int executed = runCycles(chunk);
+        result.cycles += executed;
+
+        if(executed < chunk || m_isPaused) break;
+    }
+
+    result.frameready = m_State->frames != startframes;
+
+    // one snapshot per call, however many guest frames it ran
+    if(result.frameready) recordRewind();
+
+    return result;
+}
+
+RunResult Chip8Core::runFrame()
+{
+    return runFor(m_InstructionsPerFrame - m_State->tickcounter);
+}
+
+void Chip8Core::setSeed(uint32_t seed)
+{
+    // xorshift never leaves 0
+    m_Seed = seed ? seed : 1;
+    m_State->rng = m_Seed;
+}
+
+bool Chip8Core::startRecording(std::string filename)
+{
+    if(!m_InputLog) m_InputLog = new InputLog;
+
+    // whatever the host holds at the first batch is the first key event
+    m_State->keys = 0x0;
+
+    return m_InputLog->startRecording(filename, *m_State, m_CPUFrequency);
+}
+
+void Chip8Core::stopRecording()
+{
+    if(!m_InputLog || !m_InputLog->isRecording()) return;
+
+    m_InputLog->writeEnd(m_State->cycles);
+    m_InputLog->close();
+}
+
+bool Chip8Core::startReplay(std::string filename)
+{
+    if(!m_InputLog) m_InputLog = new InputLog;
+
+    MachineState *state = NULL;
+    unsigned int hz = 0;
+
+    bool started = m_InputLog->startReplay(filename, &state, &hz);
+    if(started)
+    {
+        loadState(*state);
+        setCPUFrequency(hz);
+
+        // keys only come from the log
+        m_LatchKeys = false;
+    }
+
+    free(state);
+
+    return started;
+}
+
+void Chip8Core::applyInputEvents()
+{
+    const InputEvent *e;
+
+    while((e = m_InputLog->peek()) && e->cycle <= m_State->cycles)
+    {
+        if(e->type == INPUT_KEYS) m_State->keys = e->value;
+        else if(e->type == INPUT_RESET)
+        {
+            resetMachine();
+            m_State->rng = e->value;
+        }
+        else if(e->type == INPUT_STATE) loadState(m_InputLog->getEventState());
+        else if(e->type == INPUT_END) m_CycleLimit = e->cycle;
+
+        m_InputLog->pop();
+    }
+
+    // a log cut short ends where it stops
+    if(!e && !m_CycleLimit) m_CycleLimit = m_State->cycles;
+}
+
+uint64_t Chip8Core::replay()
+{
+    uint64_t startcycles = m_State->cycles;
+
+    // pausing is up to the host, a halted guest ran on once the recording host resumed it
+    while(!limitReached())
+    {
+        m_isPaused = false;
+        if(!run()) break;
+    }
+
+    return m_State->cycles - startcycles;
+}
+
+uint64_t Chip8Core::hashState()
+{
+    const uint8_t *bytes = (const uint8_t*)m_State;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(unsigned int i = 0; i < stateSize(m_State->quirks); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+unsigned int Chip8Core::runState(MachineState *state, unsigned int count, const uint8_t *stops, bool *halted, uint64_t *written)
+{
+    // the handlers work on m_State, lend it the host's state and put ours back afterwards
+    MachineState *own = m_State;
+    bool paused = m_isPaused;
+    uint64_t dirty = m_DirtyBlocks;
+
+    m_State = state;
+    m_Stops = stops;
+    m_DirtyBlocks = 0;
+    // m_isPaused is atomic, only store it when it changes, this runs once per instruction for some hosts
+    if(paused) m_isPaused = false;
+
+    unsigned int executed = 0;
+
+    switch(state->quirks)
+    {
+    case QUIRKS_MODERN: executed = executeGoto<QUIRKS_MODERN, true>(count); break;
+    case QUIRKS_VIP: executed = executeGoto<QUIRKS_VIP, true>(count); break;
+    case QUIRKS_SCHIP: executed = executeGoto<QUIRKS_SCHIP, true>(count); break;
+    case QUIRKS_XOCHIP: executed = executeGoto<QUIRKS_XOCHIP, true>(count); break;
+    }
+
+    *halted = m_isPaused;
+    *written = m_DirtyBlocks;
+
+    m_State = own;
+    m_Stops = NULL;
+    m_DirtyBlocks = dirty;
+    if(*halted != paused) m_isPaused = paused;
+
+    return executed;
+}
+
+uint32_t Chip8Core::stepStates(MachineState *const *states, uint32_t lanes, uint16_t opcode, uint64_t *written)
+{
+    if(!lanes) return 0x0;
+
+    MachineState *own = m_State;
+    bool paused = m_isPaused;
+    uint64_t dirty = m_DirtyBlocks;
+
+    m_DirtyBlocks = 0;
+    if(paused) m_isPaused = false;
+
+    const TableHandler handler = s_OpHandlers[states[__builtin_ctz(lanes)]->quirks][s_OpTable[opcode]];
+    uint32_t halted = 0x0;
+
+    for(; lanes; lanes &= lanes - 1)
+    {
+        unsigned int n = __builtin_ctz(lanes);
+        m_State = states[n];
+
+        // the end of memory pauses without running anything, like the engines
+        if(m_State->pc >= memorySize(m_State->quirks) - 2)
+        {
+            halted |= uint32_t(1) << n;
+            continue;
+        }
+
+        m_State->pc += 2;
+        handler(this, opcode);
+
+        if(m_isPaused)
+        {
+            halted |= uint32_t(1) << n;
+            m_isPaused = false;
+        }
+    }
+
+    *written = m_DirtyBlocks;
+
+    m_State = own;
+    m_DirtyBlocks = dirty;
+    if(paused) m_isPaused = true;
+
+    return halted;
+}
+
+bool Chip8Core::limitReached()
+{
+    if(m_CycleLimit && m_State->cycles >= m_CycleLimit) return true;
+    if(m_FrameLimit && m_State->frames >= m_FrameLimit) return true;
+
+    return false;
+}
+
+// jit.cpp runs the same engines
+template bool Chip8Core::processInstruction<QUIRKS_MODERN>(const DecodedInstruction &inst);
+template bool Chip8Core::processInstruction<QUIRKS_VIP>(const DecodedInstruction &inst);
+template bool Chip8Core::processInstruction<QUIRKS_SCHIP>(const DecodedInstruction &inst);
+template bool Chip8Core::processInstruction<QUIRKS_XOCHIP>(const DecodedInstruction &inst);
+template unsigned int Chip8Core::executeThreaded<QUIRKS_MODERN>(unsigned int count);
+template unsigned int Chip8Core::executeThreaded<QUIRKS_VIP>(unsigned int count);
+template unsigned int Chip8Core::executeThreaded<QUIRKS_SCHIP>(unsigned int count);
+template unsigned int Chip8Core::executeThreaded<QUIRKS_XOCHIP>(unsigned int count);
@@ -0,0 +1,665 @@
+#ifndef CLASS_CHIP8CORE
+#define CLASS_CHIP8CORE
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <cstddef>
+
+// xo-chip address space, the largest of any profile
+#define MAX_MEMORY 65536
+// chip-8 and super-chip address space, addresses wrap at the end of it
+#define CHIP8_MEMORY 4096
+#define MAX_REGISTERS 16
+#define MAX_STACK 16
+
+// display buffer, super-chip hires mode shows all of it and lores mode the top left LORES_WIDTH x LORES_HEIGHT
+#define DISPLAY_WIDTH 128
+#define DISPLAY_HEIGHT 64
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+// xo-chip bitplanes, plane 0 is the only one chip-8 and super-chip programs draw to
+#define DISPLAY_PLANES 2
+
+#define FONT_ADDR 0x1af
+// super-chip 8x10 digits, below the small font
+#define BIG_FONT_ADDR 0x10f
+
+// nominal cpu speed and the 60Hz delay/sound timer rate
+#define CPU_FREQUENCY 540
+#define TIMER_FREQUENCY 60
+// the paced scheduler runs each timer frame in this many batches and renders audio after every one,
+// so a sound event waits about 4ms for its samples instead of a whole frame
+#define FRAME_SLICES 4
+
+const uint8_t sysfonts[] = {
+                            0xF0,0x90,0x90,0x90,0xF0, // 0
+                            0x20,0x60,0x20,0x20,0x70, // 1
+                            0xF0,0x10,0xF0,0x80,0xF0, // 2
+                            0xF0,0x10,0xF0,0x10,0xF0, // 3
+                            0x90,0x90,0xF0,0x10,0x10, // 4
+                            0xF0,0x80,0xF0,0x10,0xF0, // 5
+                            0xF0,0x80,0xF0,0x90,0xF0, // 6
+                            0xF0,0x10,0x20,0x40,0x40, // 7
+                            0xF0,0x90,0xF0,0x90,0xF0, // 8
+                            0xF0,0x90,0xF0,0x10,0xF0, // 9
+                            0xF0,0x90,0xF0,0x90,0x90, // a
+                            0xE0,0x90,0xE0,0x90,0xE0, // b
+                            0xF0,0x80,0x80,0x80,0xF0, // c
+                            0xE0,0x90,0x90,0x90,0xE0, // d
+                            0xF0,0x80,0xF0,0x80,0xF0, // e
+                            0xF0,0x80,0xF0,0x80,0x80  // f
+                                                    };
+
+const uint8_t bigfonts[] = {
+                            0xFF,0xFF,0xC3,0xC3,0xC3,0xC3,0xC3,0xC3,0xFF,0xFF, // 0
+                            0x18,0x78,0x78,0x18,0x18,0x18,0x18,0x18,0xFF,0xFF, // 1
+                            0xFF,0xFF,0x03,0x03,0xFF,0xFF,0xC0,0xC0,0xFF,0xFF, // 2
+                            0xFF,0xFF,0x03,0x03,0xFF,0xFF,0x03,0x03,0xFF,0xFF, // 3
+                            0xC3,0xC3,0xC3,0xC3,0xFF,0xFF,0x03,0x03,0x03,0x03, // 4
+                            0xFF,0xFF,0xC0,0xC0,0xFF,0xFF,0x03,0x03,0xFF,0xFF, // 5
+                            0xFF,0xFF,0xC0,0xC0,0xFF,0xFF,0xC3,0xC3,0xFF,0xFF, // 6
+                            0xFF,0xFF,0x03,0x03,0x06,0x0C,0x18,0x18,0x18,0x18, // 7
+                            0xFF,0xFF,0xC3,0xC3,0xFF,0xFF,0xC3,0xC3,0xFF,0xFF, // 8
+                            0xFF,0xFF,0xC3,0xC3,0xFF,0xFF,0x03,0x03,0xFF,0xFF, // 9
+                            0x7E,0xFF,0xC3,0xC3,0xC3,0xFF,0xFF,0xC3,0xC3,0xC3, // a
+                            0xFC,0xFC,0xC3,0xC3,0xFC,0xFC,0xC3,0xC3,0xFC,0xFC, // b
+                            0x3C,0xFF,0xC3,0xC0,0xC0,0xC0,0xC0,0xC3,0xFF,0x3C, // c
+                            0xFC,0xFE,0xC3,0xC3,0xC3,0xC3,0xC3,0xC3,0xFE,0xFC, // d
+                            0xFF,0xFF,0xC0,0xC0,0xFF,0xFF,0xC0,0xC0,0xFF,0xFF, // e
+                            0xFF,0xFF,0xC0,0xC0,0xFF,0xFF,0xC0,0xC0,0xC0,0xC0  // f
+                                                    };
+
+// compact, string-free decoded opcode used by the execution path
+struct DecodedInstruction
+{
+    // original program counter
+    uint16_t opcode;
+    // first nibble is operation
+    uint8_t op;
+    // the rest of the 12-bits can be a value or address
+    uint16_t nnn;
+    // the last nibble
+    uint8_t n;
+    // second nibble
+    uint8_t x;
+    // third nibble
+    uint8_t y;
+    // last byte
+    uint8_t kk;
+    // decode cache entry holds a decoded opcode
+    bool valid;
+};
+
+// decoded opcode plus the text used for disassembly output
+struct Instruction : DecodedInstruction
+{
+    // short description of instruction
+    std::string mnemonic;
+    // what the instruction affects (registers, etc)
+    std::string vars;
+    // store address of instruction
+    uint16_t addr;
+};
+
+// handler ids stored in the opcode table
+enum OPCODE_ID
+{
+    OPID_UNK, OPID_CLS, OPID_RET, OPID_JP, OPID_CALL, OPID_SE_KK, OPID_SNE_KK, OPID_SE_XY,
+    OPID_LD_KK, OPID_ADD_KK, OPID_LD_XY, OPID_OR, OPID_AND, OPID_XOR, OPID_ADD_XY, OPID_SUB,
+    OPID_SHR, OPID_SUBN, OPID_SHL, OPID_SNE_XY, OPID_LD_I, OPID_JP_V0, OPID_RND, OPID_DRW,
+    OPID_SKP, OPID_SKNP, OPID_LD_VX_DT, OPID_LD_K, OPID_LD_DT, OPID_LD_ST, OPID_ADD_I, OPID_LD_F,
+    OPID_LD_B, OPID_LD_MEM, OPID_LD_REG,
+    // super-chip and xo-chip
+    OPID_SCD, OPID_SCU, OPID_SCR, OPID_SCL, OPID_EXIT, OPID_LOW, OPID_HIGH, OPID_LD_HF,
+    OPID_PLANE, OPID_LD_LONG, OPID_COUNT
+};
+
+class Chip8Core;
+struct ThreadedOp;
+
+// threaded code handler, executes one (or a fused pair of) translated instruction
+typedef void (*ThreadedHandler)(Chip8Core *chip, const ThreadedOp *op);
+
+struct ThreadedOp
+{
+    ThreadedHandler handler;
+    // raw opcode
+    uint16_t opcode;
+    // second opcode of a fused superinstruction
+    uint16_t opcode2;
+};
+
+// basic block translated into threaded code, cached by start address
+struct ThreadedBlock
+{
+    // first address of the block
+    uint16_t start;
+    // address after the last instruction
+    uint16_t end;
+    // guest instructions covered, fused ops count as two
+    unsigned int instructions;
+    // nothing in the block sees the timers or the keys, so it can run past the end of a batch
+    bool overrun;
+    std::vector<ThreadedOp> ops;
+};
+
+struct MachineState;
+
+// x86-64 native code for a basic block, called with the state of the owning machine
+typedef void (*JitCode)(MachineState *state);
+
+// compiled basic block, cached by start address
+struct JitBlock
+{
+    // first address of the block
+    uint16_t start;
+    // address after the last compiled instruction
+    uint16_t end;
+    // guest instructions executed by one call
+    unsigned int instructions;
+    // no timer instructions, the block can run past the end of a batch
+    bool overrun;
+    JitCode code;
+};
+
+// behaviours chip-8 interpreters disagree on, each profile runs on its own instantiation of the engines
+enum QUIRK_PROFILE
+{
+    // this emulator's original behaviour: shifts read vx, Fx55/Fx65 keep I, Bnnn adds v0, sprites clip
+    QUIRKS_MODERN,
+    // cosmac vip: shifts read vy, Fx55/Fx65 advance I, logic ops reset vf
+    QUIRKS_VIP,
+    // super-chip: Bxnn adds vx, Dxy0 draws 16x16, otherwise modern
+    QUIRKS_SCHIP,
+    // xo-chip: shifts read vy, Fx55/Fx65 advance I, sprites wrap, Dxy0 draws 16x16, skips step over F000 nnnn
+    QUIRKS_XOCHIP,
+    QUIRKS_COUNT,
+    // pick the profile from the rom when it is loaded
+    QUIRKS_AUTO = QUIRKS_COUNT
+};
+
+// what a profile changes, one bit each
+enum QUIRK_FLAG
+{
+    // 8xy6/8xyE shift vy into vx instead of shifting vx
+    QUIRK_SHIFT_VY = 0x01,
+    // Fx55/Fx65 leave I past the last register
+    QUIRK_LOAD_STORE_I = 0x02,
+    // Bxnn jumps to xnn + vx instead of nnn + v0
+    QUIRK_JUMP_VX = 0x04,
+    // sprites wrap around the screen edges instead of being clipped
+    QUIRK_WRAP = 0x08,
+    // 8xy1/8xy2/8xy3 clear vf
+    QUIRK_VF_RESET = 0x10,
+    // skipping the 4 byte F000 nnnn skips all of it
+    QUIRK_LONG_SKIP = 0x20,
+    // Dxy0 draws a 16x16 sprite instead of nothing
+    QUIRK_BIG_SPRITE = 0x40
+};
+
+// constant when the profile is, so the engines compile without quirk checks
+constexpr uint8_t quirkFlags(int profile)
+{
+    return profile == QUIRKS_VIP ? (QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_VF_RESET) :
+           profile == QUIRKS_SCHIP ? (QUIRK_JUMP_VX | QUIRK_BIG_SPRITE) :
+           profile == QUIRKS_XOCHIP ? (QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_WRAP | QUIRK_LONG_SKIP | QUIRK_BIG_SPRITE) : 0;
+}
+
+// address space of a profile, only xo-chip gets more than 4KB
+constexpr unsigned int memorySize(int profile)
+{
+    return profile == QUIRKS_XOCHIP ? MAX_MEMORY : CHIP8_MEMORY;
+}
+
+// save state file header, bump the version whenever MachineState changes
+#define STATE_FILE_MAGIC "C8ST"
+#define STATE_FILE_VERSION 4
+
+// memory written since the last rewind keyframe is tracked in 64 blocks of memorySize() / 64 bytes
+#define DIRTY_BLOCKS 64
+
+// everything that makes up a running machine, plain data so a snapshot is one memcpy
+// ordered widest first so there is no padding between members, memory goes last and is only
+// allocated as far as the profile addresses it, see stateSize()
+struct MachineState
+{
+    // display, one 128x64 bitplane per xo-chip plane, a pixel's colour is its bit in each plane
+    // sprites are 8 bits wide and up to 15 lines high, or 16x16 for Dxy0 on super-chip and xo-chip
+    // each row is packed into two 64-bit words, column 0 is the most significant bit of the first,
+    // lores mode only uses the first word of the first 32 rows
+    uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][2];
+
+    // guest clock, instructions and 60Hz timer frames executed
+    uint64_t cycles;
+    uint64_t frames;
+
+    // xorshift state for Cxkk, never 0
+    uint32_t rng;
+    // instructions since the last timer tick
+    uint32_t tickcounter;
+
+    // stack, stores addresses that interpreter should be returned to when finished
+    // chip-8 allows 16 nested subroutines
+    uint16_t stack[MAX_STACK];
+
+    // register I generally used to store addresses, usually only lowest 12 bits used
+    uint16_t ireg;
+    // program counter 16-bit register (points to currently executing address)
+    uint16_t pc;
+
+    // keypad seen by the guest, latched from the host input at the start of each batch
+    uint16_t keys;
+
+    // CHIP-8 Registers
+    // registers 0x0 - 0xf
+    // register 0xf should not be used, internal flag register
+    uint8_t reg[MAX_REGISTERS];
+    // delay register, 60Hz decrement until 0.  non-zero = delay register is active
+    uint8_t delay;
+    // sound register.  60Hz decrement until 0.  non-zero = sound buzzer is active
+    uint8_t sound;
+    // entries used in stack
+    uint8_t stacksize;
+    // QUIRK_PROFILE the program runs with
+    uint8_t quirks;
+    // super-chip 128x64 mode, set by 00FF and cleared by 00FE
+    uint8_t hires;
+    // bitplanes Dxyn, 00E0 and the scrolls work on, one bit per plane, set by Fn01
+    uint8_t planes;
+    // keeps memory on a word boundary for the rewind delta coder
+    uint8_t reserved[4];
+
+    // CHIP-8 Memory
+    // chip-8 max memory (4096) 0x000-0xfff, xo-chip 64KB 0x0000-0xffff
+    // first 512 bytes (0x000-0x1ff) reserved for interpreter
+    uint8_t mem[MAX_MEMORY];
+};
+
+// bytes of a state running profile, memory past memorySize(profile) is neither allocated nor saved
+inline unsigned int stateSize(int profile)
+{
+    return offsetof(MachineState, mem) + memorySize(profile);
+}
+// zeroed state with room for the memory of profile, release it with free()
+MachineState *allocState(int profile);
+// grow or shrink a state from the memory of its own profile to that of profile, the memory both have is kept
+MachineState *resizeState(MachineState *state, int profile);
+// a state of size bytes from a stream, NULL unless all of it was read and the size fits its profile
+MachineState *readState(std::istream &in, uint32_t size);
+
+
+class RewindBuffer;
+class InputLog;
+class Profiler;
+class LatencyTracker;
+
+// opcode dispatch engines, selectable at runtime so they can be compared
+enum DISPATCH_MODE
+{
+    // original if/else chain in processInstruction()
+    DISPATCH_INTERPRETER,
+    // handler table indexed by raw opcode
+    DISPATCH_TABLE,
+    // computed goto over the same table, falls back to DISPATCH_TABLE if unsupported
+    DISPATCH_GOTO,
+    // basic blocks translated to threaded code with fused superinstructions
+    DISPATCH_THREADED,
+    // hot basic blocks compiled to x86-64, falls back to DISPATCH_THREADED if unsupported
+    DISPATCH_JIT
+};
+
+// buzzer edges kept between drains by the host, later ones are dropped
+#define MAX_SOUND_EVENTS 64
+
+// the buzzer sounds while the sound timer is non-zero, an edge is stamped with the guest cycle it happened at
+struct SoundEvent
+{
+    uint64_t cycle;
+    bool on;
+};
+
+// what one runFor() or runFrame() call did
+struct RunResult
+{
+    // instructions executed
+    uint64_t cycles;
+    // a 60Hz guest frame ended, the timers ticked and the display is ready to show
+    bool frameready;
+};
+
+// the machine on its own, no threads, no window and no SFML
+// hosts step it from their own loop with runFor() / runFrame(), Chip8 is the SFML front end on top
+class Chip8Core
+{
+private:
+
+    uint8_t nextRandom();
+    // rng seed at start and after every reset
+    uint32_t m_Seed;
+
+    void applyInputEvents();
+
+    // one bit per memorySize() / DIRTY_BLOCKS bytes of memory written since the last rewind keyframe
+    uint64_t m_DirtyBlocks;
+
+    // buzzer edges since the host last took them, for audio output
+    bool m_Buzzer;
+    SoundEvent m_SoundEvents[MAX_SOUND_EVENTS];
+    unsigned int m_SoundEventCount;
+    void updateBuzzer(uint64_t cycle);
+
+    void profileInstruction(uint16_t opcode, uint8_t id);
+    // table engine that looks at every instruction, replaces the selected engine while either needs it
+    template<int P> unsigned int executeInstrumented(unsigned int count);
+
+    // profile loadRom() runs roms with, QUIRKS_AUTO to detect it
+    QUIRK_PROFILE m_QuirkMode;
+    // switching between 4KB and 64KB profiles resizes the state and the per address caches
+    void applyQuirks(uint8_t profile);
+
+    // display kernels, they work on the planes selected by Fn01
+    void clearDisplay();
+    // a height of 0 draws a 16x16 sprite with QUIRK_BIG_SPRITE and nothing without
+    template<int P> bool drawSprite(uint8_t x, uint8_t y, uint8_t height);
+    // whole rows move, scrolling by the screen height or more clears it
+    void scrollDown(unsigned int rows);
+    void scrollUp(unsigned int rows);
+    // 128-bit row shifts, SSE2 where the host has it
+    void scrollRight(unsigned int cols);
+    void scrollLeft(unsigned int cols);
+    void setHires(bool hires);
+
+    // false while re-running instructions, they keep the keys already in m_State->keys
+    bool m_LatchKeys;
+
+    // stop after this many instructions / timer frames, 0 for no limit
+    uint64_t m_CycleLimit;
+    uint64_t m_FrameLimit;
+
+    template<int P> bool processInstruction(const DecodedInstruction &inst);
+    bool executeNextInstruction();
+
+    // dispatch engine
+    // handler id for every possible opcode, shared by all instances
+    typedef void (Chip8Core::*OpHandler)(uint16_t opcode);
+    static uint8_t s_OpTable[0x10000];
+    // handlers of each quirk profile, static thunks so dispatch is a plain call and each handler is inlined into its own
+    typedef void (*TableHandler)(Chip8Core *chip, uint16_t opcode);
+    static const TableHandler s_OpHandlers[QUIRKS_COUNT][OPID_COUNT];
+    template<OpHandler H> static void tableOp(Chip8Core *chip, uint16_t opcode);
+    static bool buildOpTable();
+    DISPATCH_MODE m_DispatchMode;
+    // the selected engine for one profile, picked once per batch
+    template<int P> unsigned int executeProfile(unsigned int count);
+    template<int P> unsigned int executeInterpreter(unsigned int count);
+    template<int P> unsigned int executeTable(unsigned int count);
+    // with STOPS the engine also returns once an instruction leaves the pc on a non-zero byte of m_Stops
+    template<int P, bool STOPS = false> unsigned int executeGoto(unsigned int count);
+    const uint8_t *m_Stops;
+    template<int P> unsigned int executeThreaded(unsigned int count);
+    // instructions a threaded or compiled block may run past the end of the current batch, set by runCycles()
+    // so it never reaches past a cycle limit, the next replayed input or the tick that reaches the frame limit
+    unsigned int m_BatchOverrun;
+    // Fx07, Fx15, Fx18 and the key instructions, a block with one of them has to end with its batch
+    static bool isTickSensitive(uint8_t id);
+
+    // threaded code translator
+    // translated blocks by start address
+    std::vector<ThreadedBlock*> m_BlockCache;
+    // number of translated blocks covering each memory byte
+    std::vector<uint16_t> m_BlockCoverage;
+    std::vector<ThreadedBlock*> m_Blocks;
+    // dropped blocks, freed once no block is executing
+    std::vector<ThreadedBlock*> m_RetiredBlocks;
+    // blocks hold the handlers of the profile they were translated for, they are flushed when it changes
+    static const ThreadedHandler s_ThreadedHandlers[QUIRKS_COUNT][OPID_COUNT];
+    template<OpHandler H> static void threadedOp(Chip8Core *chip, const ThreadedOp *op);
+    template<OpHandler A, OpHandler B> static void threadedFused(Chip8Core *chip, const ThreadedOp *op);
+    template<int P> ThreadedBlock *translateBlock(uint16_t start);
+    void invalidateBlocks(uint16_t addr, unsigned int len);
+    void flushBlocks();
+
+    // native x86-64 jit (jit.cpp)
+    // compiled blocks by start address, m_JitNoBlock marks addresses that can not be compiled
+    std::vector<JitBlock*> m_JitCache;
+    JitBlock m_JitNoBlock;
+    // number of compiled blocks covering each memory byte
+    std::vector<uint16_t> m_JitCoverage;
+    // interpreted executions of each address, compiled once hot
+    std::vector<uint8_t> m_JitHeat;
+    std::vector<JitBlock*> m_JitBlocks;
+    // executable code buffer, mapped on first compile
+    uint8_t *m_JitArena;
+    unsigned int m_JitArenaUsed;
+    void initJit();
+    JitBlock *compileJitBlock(uint16_t start);
+    void invalidateJit(uint16_t addr, unsigned int len);
+    void flushJit();
+    void freeJit();
+    template<int P> unsigned int executeJit(unsigned int count);
+
+    // opcode handlers, program counter has already been advanced
+    void opUNK(uint16_t opcode);
+    void opCLS(uint16_t opcode);
+    void opRET(uint16_t opcode);
+    void opJP(uint16_t opcode);
+    void opCALL(uint16_t opcode);
+    template<int P> void opSE_KK(uint16_t opcode);
+    template<int P> void opSNE_KK(uint16_t opcode);
+    template<int P> void opSE_XY(uint16_t opcode);
+    void opLD_KK(uint16_t opcode);
+    void opADD_KK(uint16_t opcode);
+    void opLD_XY(uint16_t opcode);
+    template<int P> void opOR(uint16_t opcode);
+    template<int P> void opAND(uint16_t opcode);
+    template<int P> void opXOR(uint16_t opcode);
+    void opADD_XY(uint16_t opcode);
+    void opSUB(uint16_t opcode);
+    template<int P> void opSHR(uint16_t opcode);
+    void opSUBN(uint16_t opcode);
+    template<int P> void opSHL(uint16_t opcode);
+    template<int P> void opSNE_XY(uint16_t opcode);
+    void opLD_I(uint16_t opcode);
+    template<int P> void opJP_V0(uint16_t opcode);
+    void opRND(uint16_t opcode);
+    template<int P> void opDRW(uint16_t opcode);
+    template<int P> void opSKP(uint16_t opcode);
+    template<int P> void opSKNP(uint16_t opcode);
+    void opLD_VX_DT(uint16_t opcode);
+    void opLD_K(uint16_t opcode);
+    void opLD_DT(uint16_t opcode);
+    void opLD_ST(uint16_t opcode);
+    void opADD_I(uint16_t opcode);
+    void opLD_F(uint16_t opcode);
+    template<int P> void opLD_B(uint16_t opcode);
+    template<int P> void opLD_MEM(uint16_t opcode);
+    template<int P> void opLD_REG(uint16_t opcode);
+    void opSCD(uint16_t opcode);
+    void opSCU(uint16_t opcode);
+    void opSCR(uint16_t opcode);
+    void opSCL(uint16_t opcode);
+    void opEXIT(uint16_t opcode);
+    void opLOW(uint16_t opcode);
+    void opHIGH(uint16_t opcode);
+    void opLD_HF(uint16_t opcode);
+    void opPLANE(uint16_t opcode);
+    void opLD_LONG(uint16_t opcode);
+    // skip the next instruction, all 4 bytes of F000 nnnn with QUIRK_LONG_SKIP
+    template<int P> void skip();
+
+    // decoding
+    // pre-decoded instruction for every memory address, filled on first execution
+    std::vector<DecodedInstruction> m_DecodeCache;
+    static void decode(uint16_t opcode, DecodedInstruction *dinst);
+    const DecodedInstruction &fetchInstruction(uint16_t addr);
+    void invalidateDecodeCache(uint16_t addr, unsigned int len);
+    // memory under addr was written, drop anything decoded or translated from it
+    void invalidateCode(uint16_t addr, unsigned int len);
+
+protected:
+
+    // what a front end driving the machine from its own threads needs
+
+    // memory, registers, stack, display and guest clock, owned by whichever thread runs the machine
+    // allocated for the memory of the current profile
+    MachineState *m_State;
+
+    // input recording or replay, NULL when neither
+    InputLog *m_InputLog;
+
+    // per frame snapshots for rewinding, NULL when rewind is off
+    RewindBuffer *m_Rewind;
+    // snapshot the machine, taken once per host frame so the cost does not grow with the guest speed
+    void recordRewind();
+    bool rewindFrame();
+    void stepBackMachine();
+
+    // guest profiler, NULL when off
+    Profiler *m_Profiler;
+    // key to screen latency measurements, NULL when off
+    LatencyTracker *m_Latency;
+
+    // bumped whenever a clear or sprite draw actually changes pixels
+    uint32_t m_DisplayGeneration;
+
+    // keyboard, keypad only has 0-9, a-f keys
+    // written by the host, latched into m_State->keys at the start of each batch
+    std::atomic<uint16_t> m_KeyState;
+
+    // set by the guest when it halts, and by the host to hold the machine
+    std::atomic<bool> m_isPaused;
+
+    // instructions per second, 0 runs uncapped (turbo)
+    unsigned int m_CPUFrequency;
+    // guest instructions per 60Hz timer tick
+    unsigned int m_InstructionsPerFrame;
+    void advanceGuestClock(unsigned int executed);
+    // translated and compiled blocks can take it a few instructions past count unless exact
+    unsigned int runCycles(uint64_t count, bool exact = false);
+    unsigned int executeInstructions(unsigned int count);
+
+    void resetMachine();
+
+public:
+    Chip8Core();
+    ~Chip8Core();
+
+    // get display, the size of the current resolution
+    unsigned int getDisplayWidth() { return m_State->hires ? DISPLAY_WIDTH : LORES_WIDTH;}
+    unsigned int getDisplayHeight() { return m_State->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;}
+    bool isHires() { return m_State->hires;}
+    // packed rows of one plane, two 64-bit words per row, see MachineState::display
+    const uint64_t *getDisplayRows(unsigned int plane = 0) { return m_State->display[plane][0];}
+    // colour index of a pixel, bit n from plane n
+    uint8_t getPixel(unsigned int x, unsigned int y)
+    {
+        uint8_t colour = 0;
+        for(int p = 0; p < DISPLAY_PLANES; p++) colour |= ((m_State->display[p][y][x >> 6] >> (63 - (x & 63))) & 0x1) << p;
+        return colour;
+    }
+    uint32_t getDisplayGeneration() { return m_DisplayGeneration;}
+
+    // get memory
+    uint16_t getProgramCounter() { return m_State->pc;}
+    uint8_t getMemAt(uint16_t addr) { return m_State->mem[addr & (memorySize(m_State->quirks) - 1)];}
+
+    // get registers
+    uint8_t *getRegisters() { return m_State->reg;}
+    uint16_t getIRegister() { return m_State->ireg;}
+    uint8_t getDelayRegister() { return m_State->delay;}
+    uint8_t getSoundRegister() { return m_State->sound;}
+
+    // get stack
+    std::vector<uint16_t> getStack() { return std::vector<uint16_t>(m_State->stack, m_State->stack + m_State->stacksize);}
+
+    // save states, only call these from the thread running the machine or while it is not running
+    // saveState() copies stateSize(getQuirks()) bytes
+    void saveState(MachineState *state) const;
+    void loadState(const MachineState &state);
+    bool saveStateFile(std::string filename) const;
+    bool loadStateFile(std::string filename);
+
+    // disassembler
+    static Instruction disassemble(uint16_t opcode);
+    static std::string getDisassembledString(Instruction *inst);
+
+    // roms are mapped and copied into memory once, false if the file is missing or does not fit
+    // the memory of its profile, the quirk profile is set for each rom here
+    bool loadRom(std::string filename, uint16_t addr = 0x200);
+    bool loadRom(const uint8_t *data, unsigned int size, uint16_t addr = 0x200);
+    void loadProgram(const uint8_t *data, unsigned int size, uint16_t addr = 0x200);
+
+    // stepping from the host loop, both stop early if the guest halts or a cycle/frame limit is reached
+    // run cycles instructions and take a rewind snapshot if a frame finished, the threaded and
+    // jit engines may finish a block a few instructions past it but never past a cycle or frame limit
+    RunResult runFor(uint64_t cycles);
+    // run to the end of the current 60Hz guest frame
+    RunResult runFrame();
+    // run on the calling thread without pacing until halted or a cycle/frame limit is reached,
+    // returns the instructions executed
+    uint64_t run();
+
+    // QUIRKS_AUTO (the default) picks the profile from the instructions a rom reaches
+    void setQuirks(QUIRK_PROFILE profile);
+    QUIRK_PROFILE getQuirks() { return QUIRK_PROFILE(m_State->quirks);}
+    static QUIRK_PROFILE detectQuirks(const uint8_t *data, unsigned int size, uint16_t addr = 0x200);
+
+    void setKeyState(uint16_t keypressed) { m_KeyState = keypressed;}
+    void setDispatchMode(DISPATCH_MODE mode) { m_DispatchMode = mode;}
+    DISPATCH_MODE getDispatchMode() { return m_DispatchMode;}
+    void setCPUFrequency(unsigned int hz);
+    unsigned int getCPUFrequency() { return m_CPUFrequency;}
+    void setCycleLimit(uint64_t cycles) { m_CycleLimit = cycles;}
+    void setFrameLimit(uint64_t frames) { m_FrameLimit = frames;}
+    uint64_t getCycleCount() { return m_State->cycles;}
+    uint64_t getFrameCount() { return m_State->frames;}
+    bool limitReached();
+    void reset();
+    // a halted guest stays paused until the host resumes it
+    void pause(bool npause) { m_isPaused = npause;}
+    bool isPaused() { return m_isPaused;}
+
+    // buzzer edges since the last clearSoundEvents(), oldest first
+    const SoundEvent *getSoundEvents() { return m_SoundEvents;}
+    unsigned int getSoundEventCount() { return m_SoundEventCount;}
+    void clearSoundEvents() { m_SoundEventCount = 0;}
+    bool isBuzzerOn() { return m_Buzzer;}
+
+    // keep per frame snapshots to rewind through, set before running
+    // runFor() takes one each call that finishes a guest frame
+    void setRewind(bool enable);
+    bool getRewind() { return m_Rewind != NULL;}
+
+    // count what the guest executes and touches, set before running
+    void setProfiling(bool enable);
+    bool getProfiling() { return m_Profiler != NULL;}
+    bool writeProfile(std::string filename);
+    // time key changes until their effect is presented, set before running
+    void setLatencyTracking(bool enable);
+
+    // deterministic runs, the rng seed is used at start and on every reset
+    void setSeed(uint32_t seed);
+    // record every input to a file, call after loading the rom and before running
+    bool startRecording(std::string filename);
+    // end the recording at the current cycle, the destructor ends one still running
+    void stopRecording();
+    // load a recorded session in place of a rom, replay() then runs it headless as fast as possible
+    bool startReplay(std::string filename);
+    uint64_t replay();
+    // fnv-1a of the whole machine state, equal for a session and its replay
+    uint64_t hashState();
+
+    // hosts that keep many machines in their own states borrow the handlers of one core, see LockstepBatch
+    // runs state for up to count instructions with the goto engine of its profile and returns the instructions run,
+    // it returns early once an instruction leaves the pc on a non-zero byte of stops, which covers the memory
+    // of the profile. *halted is set if the machine paused, *written gets a bit per dirty block it wrote to
+    unsigned int runState(MachineState *state, unsigned int count, const uint8_t *stops, bool *halted, uint64_t *written);
+    // runs opcode on states[n] for each bit n of lanes, as if each had fetched it from its pc, the handler is looked up
+    // once for all of them. The states share one profile, returns the lanes that paused
+    uint32_t stepStates(MachineState *const *states, uint32_t lanes, uint16_t opcode, uint64_t *written);
+};
+#endif // CLASS_CHIP8CORE
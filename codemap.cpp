@@ -0,0 +1,339 @@
+#include "codemap.hpp"
+
+#include <string.h>
+#include <fstream>
+#include <algorithm>
+
+static bool isSkip(uint16_t opcode)
+{
+    uint8_t op = opcode >> 12;
+
+    if(op == 0x3 || op == 0x4) return true;
+    if((op == 0x5 || op == 0x9) && (opcode & 0xf) == 0x0) return true;
+    if(op == 0xe && ((opcode & 0xff) == 0x9e || (opcode & 0xff) == 0xa1)) return true;
+
+    return false;
+}
+
+// nothing after the instruction is reached by falling through it
+static bool isJump(uint16_t opcode)
+{
+    return opcode == 0x00ee || opcode == 0x00fd || (opcode >> 12) == 0x1 || (opcode >> 12) == 0xb;
+}
+
+// returns and exits have no target to follow
+static bool isReturn(uint16_t opcode)
+{
+    return opcode == 0x00ee || opcode == 0x00fd;
+}
+
+CodeMap::CodeMap()
+{
+    m_Hash = 0;
+    m_Start = 0;
+    m_End = 0;
+    memset(m_Flags, 0, sizeof(m_Flags));
+    memset(m_Labels, 0, sizeof(m_Labels));
+}
+
+uint64_t CodeMap::hashROM(const uint8_t *rom, unsigned int size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(unsigned int i = 0; i < size; i++)
+    {
+        hash ^= rom[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+void CodeMap::analyse(const uint8_t *rom, unsigned int size, uint16_t addr)
+{
+    memset(m_Flags, 0, sizeof(m_Flags));
+    m_Blocks.clear();
+    m_Calls.clear();
+
+    m_Hash = hashROM(rom, size);
+    m_Start = addr;
+    m_End = std::min(unsigned(addr) + size, unsigned(MAX_MEMORY));
+
+    // an odd last byte is padded with 0, like the listing
+    auto opcodeAt = [&](unsigned int a) { return uint16_t(rom[a - m_Start] << 8 | (a + 1 < m_End ? rom[a + 1 - m_Start] : 0));};
+    auto inROM = [&](unsigned int a) { return a >= m_Start && a < m_End;};
+    // f000 carries its address in the next word
+    auto lengthAt = [&](unsigned int a) { return (inROM(a) && opcodeAt(a) == 0xf000) ? 4u : 2u;};
+
+    // follow every path from the entry point, each instruction is decoded once
+    std::vector<unsigned int> work;
+    work.push_back(addr);
+    m_Flags[addr] |= CODEMAP_BLOCK;
+
+    while(!work.empty())
+    {
+        unsigned int a = work.back();
+        work.pop_back();
+
+        while(inROM(a) && !(m_Flags[a] & CODEMAP_CODE))
+        {
+            uint16_t opcode = opcodeAt(a);
+            uint16_t nnn = opcode & 0xfff;
+            unsigned int next = a + lengthAt(a);
+
+            m_Flags[a] |= CODEMAP_CODE;
+            for(unsigned int b = a; b < next && b < MAX_MEMORY; b++) m_Flags[b] |= CODEMAP_CODE_BYTE;
+
+            // jumps, Bnnn is followed as if V0 was 0
+            if(isJump(opcode))
+            {
+                if(!isReturn(opcode))
+                {
+                    m_Flags[nnn] |= CODEMAP_JUMP_TARGET | CODEMAP_BLOCK;
+                    work.push_back(nnn);
+                }
+                break;
+            }
+
+            // calls return to the next instruction
+            if((opcode >> 12) == 0x2)
+            {
+                m_Flags[nnn] |= CODEMAP_CALL_TARGET | CODEMAP_BLOCK;
+                work.push_back(nnn);
+                if(next < MAX_MEMORY) m_Flags[next] |= CODEMAP_BLOCK;
+            }
+            // skips go on at either of the next two instructions, a skipped f000 steps over its address too
+            else if(isSkip(opcode))
+            {
+                unsigned int skipped = next + lengthAt(next);
+
+                if(next < MAX_MEMORY) m_Flags[next] |= CODEMAP_BLOCK;
+                if(skipped < MAX_MEMORY)
+                {
+                    m_Flags[skipped] |= CODEMAP_BLOCK;
+                    work.push_back(skipped);
+                }
+            }
+            else if((opcode >> 12) == 0xa) m_Flags[nnn] |= CODEMAP_DATA_TARGET;
+
+            a = next;
+        }
+    }
+
+    // basic blocks, from each block start up to a control transfer or the next block start
+    uint16_t blockat[MAX_MEMORY];
+    memset(blockat, 0, sizeof(blockat));
+
+    for(unsigned int a = m_Start; a < m_End; a++)
+    {
+        if((m_Flags[a] & (CODEMAP_CODE | CODEMAP_BLOCK)) != (CODEMAP_CODE | CODEMAP_BLOCK)) continue;
+
+        CodeBlock block;
+        block.start = a;
+
+        unsigned int b = a;
+        while(1)
+        {
+            uint16_t opcode = opcodeAt(b);
+            b += lengthAt(b);
+
+            if(isJump(opcode) || isSkip(opcode) || (opcode >> 12) == 0x2) break;
+            if(b >= m_End || !(m_Flags[b] & CODEMAP_CODE) || (m_Flags[b] & CODEMAP_BLOCK)) break;
+        }
+
+        block.end = b;
+        m_Blocks.push_back(block);
+        blockat[a] = m_Blocks.size();
+    }
+
+    // call graph, the blocks each subroutine reaches without following its calls
+    std::vector<unsigned int> entries;
+    entries.push_back(m_Start);
+    for(unsigned int a = m_Start; a < m_End; a++)
+    {
+        if(a != m_Start && (m_Flags[a] & CODEMAP_CALL_TARGET) && (m_Flags[a] & CODEMAP_CODE)) entries.push_back(a);
+    }
+
+    std::vector<bool> visited(m_Blocks.size());
+    for(unsigned int e = 0; e < entries.size(); e++)
+    {
+        std::vector<uint16_t> callees;
+        std::fill(visited.begin(), visited.end(), false);
+
+        work.clear();
+        work.push_back(entries[e]);
+
+        while(!work.empty())
+        {
+            unsigned int a = work.back();
+            work.pop_back();
+
+            if(a >= MAX_MEMORY || !blockat[a] || visited[blockat[a] - 1]) continue;
+            visited[blockat[a] - 1] = true;
+
+            const CodeBlock &block = m_Blocks[blockat[a] - 1];
+            // the last instruction, unless the block ends on an f000 and its address word
+            unsigned int last = block.end - 2;
+            if(block.end - block.start >= 4 && (m_Flags[block.end - 4] & CODEMAP_CODE) && opcodeAt(block.end - 4) == 0xf000) last = block.end - 4;
+            uint16_t opcode = opcodeAt(last);
+
+            if(isReturn(opcode)) continue;
+            else if(isJump(opcode)) work.push_back(opcode & 0xfff);
+            else
+            {
+                if((opcode >> 12) == 0x2) callees.push_back(opcode & 0xfff);
+                if(isSkip(opcode)) work.push_back(block.end + lengthAt(block.end));
+                work.push_back(block.end);
+            }
+        }
+
+        std::sort(callees.begin(), callees.end());
+        callees.erase(std::unique(callees.begin(), callees.end()), callees.end());
+
+        for(unsigned int c = 0; c < callees.size(); c++)
+        {
+            CallEdge edge;
+            edge.caller = entries[e];
+            edge.callee = callees[c];
+            m_Calls.push_back(edge);
+        }
+    }
+
+    numberLabels();
+}
+
+void CodeMap::numberLabels()
+{
+    unsigned int subs = 0;
+    unsigned int jumps = 0;
+    unsigned int data = 0;
+
+    memset(m_Labels, 0, sizeof(m_Labels));
+
+    // only addresses a listing line starts at, instructions take two bytes and data one
+    unsigned int a = m_Start;
+    while(a < m_End)
+    {
+        uint8_t flags = m_Flags[a];
+
+        if((flags & CODEMAP_CALL_TARGET) && (flags & CODEMAP_CODE)) m_Labels[a] = ++subs;
+        else if((flags & CODEMAP_JUMP_TARGET) && (flags & CODEMAP_CODE)) m_Labels[a] = ++jumps;
+        else if(flags & CODEMAP_DATA_TARGET) m_Labels[a] = ++data;
+
+        a += (flags & CODEMAP_CODE) ? 2 : 1;
+    }
+}
+
+std::string CodeMap::getLabel(uint16_t addr)
+{
+    addr &= MAX_MEMORY - 1;
+
+    if(!m_Labels[addr]) return std::string();
+
+    uint8_t flags = m_Flags[addr];
+    std::string name;
+
+    if((flags & CODEMAP_CALL_TARGET) && (flags & CODEMAP_CODE)) name = "sub_";
+    else if((flags & CODEMAP_JUMP_TARGET) && (flags & CODEMAP_CODE)) name = "label_";
+    else name = "data_";
+
+    return name + std::to_string(m_Labels[addr]);
+}
+
+void CodeMap::labelInstruction(Instruction *inst)
+{
+    if(inst->op != 0x1 && inst->op != 0x2 && inst->op != 0xa && inst->op != 0xb) return;
+
+    std::string label = getLabel(inst->nnn);
+    if(label.empty()) return;
+
+    if(inst->op == 0xa) inst->vars = "I, " + label;
+    else if(inst->op == 0xb) inst->vars = "V0, " + label;
+    else inst->vars = label;
+}
+
+bool CodeMap::save(std::string filename)
+{
+    std::ofstream ofile(filename.c_str(), std::ios::binary);
+
+    if(!ofile.is_open()) return false;
+
+    uint32_t version = CODEMAP_VERSION;
+    uint32_t blocks = m_Blocks.size();
+    uint32_t calls = m_Calls.size();
+
+    // header, then the flags of the rom bytes, the blocks and the call graph
+    ofile.write(CODEMAP_MAGIC, 4);
+    ofile.write((const char*)&version, sizeof(version));
+    ofile.write((const char*)&m_Hash, sizeof(m_Hash));
+    ofile.write((const char*)&m_Start, sizeof(m_Start));
+    ofile.write((const char*)&m_End, sizeof(m_End));
+    ofile.write((const char*)&m_Flags[m_Start], m_End - m_Start);
+    ofile.write((const char*)&blocks, sizeof(blocks));
+    if(blocks) ofile.write((const char*)&m_Blocks[0], blocks * sizeof(CodeBlock));
+    ofile.write((const char*)&calls, sizeof(calls));
+    if(calls) ofile.write((const char*)&m_Calls[0], calls * sizeof(CallEdge));
+
+    return bool(ofile);
+}
+
+bool CodeMap::load(std::string filename, const uint8_t *rom, unsigned int size)
+{
+    std::ifstream ifile(filename.c_str(), std::ios::binary);
+
+    if(!ifile.is_open()) return false;
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t hash = 0;
+    uint32_t start = 0;
+    uint32_t end = 0;
+
+    ifile.read(magic, 4);
+    ifile.read((char*)&version, sizeof(version));
+    ifile.read((char*)&hash, sizeof(hash));
+    ifile.read((char*)&start, sizeof(start));
+    ifile.read((char*)&end, sizeof(end));
+
+    // written by another version or for another rom, the caller analyses it again
+    if(!ifile || memcmp(magic, CODEMAP_MAGIC, 4) || version != CODEMAP_VERSION || hash != hashROM(rom, size)) return false;
+    if(start > end || end > MAX_MEMORY || unsigned(end - start) != std::min(unsigned(start) + size, unsigned(MAX_MEMORY)) - start) return false;
+
+    memset(m_Flags, 0, sizeof(m_Flags));
+    ifile.read((char*)&m_Flags[start], end - start);
+
+    uint32_t blocks = 0;
+    ifile.read((char*)&blocks, sizeof(blocks));
+    if(!ifile || blocks > MAX_MEMORY) return false;
+    m_Blocks.resize(blocks);
+    if(blocks) ifile.read((char*)&m_Blocks[0], blocks * sizeof(CodeBlock));
+
+    uint32_t calls = 0;
+    ifile.read((char*)&calls, sizeof(calls));
+    // every subroutine can call at most the 4096 2nnn targets
+    if(!ifile || calls > uint64_t(MAX_MEMORY) * 0x1000) return false;
+    m_Calls.resize(calls);
+    if(calls) ifile.read((char*)&m_Calls[0], calls * sizeof(CallEdge));
+
+    if(!ifile) return false;
+
+    m_Hash = hash;
+    m_Start = start;
+    m_End = end;
+    numberLabels();
+
+    return true;
+}
+
+bool CodeMap::loadOrAnalyse(std::string romfile, const uint8_t *rom, unsigned int size)
+{
+    std::string sidecar = romfile + CODEMAP_EXTENSION;
+
+    if(load(sidecar, rom, size)) return true;
+
+    // a read only rom directory just means analysing again next time
+    analyse(rom, size);
+    save(sidecar);
+
+    return false;
+}
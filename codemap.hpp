@@ -0,0 +1,90 @@
+#ifndef CLASS_CODEMAP
+#define CLASS_CODEMAP
+
+#include <string>
+#include <vector>
+
+#include "chip8core.hpp"
+
+// sidecar file written next to a rom, bump the version whenever the analysis or the layout changes
+#define CODEMAP_MAGIC "C8CM"
+#define CODEMAP_VERSION 2
+#define CODEMAP_EXTENSION ".c8map"
+
+// what the analysis found at an address
+enum CODEMAP_FLAG
+{
+    // an instruction reachable from the entry point starts here
+    CODEMAP_CODE = 0x01,
+    // byte belongs to a reachable instruction
+    CODEMAP_CODE_BYTE = 0x02,
+    // first instruction of a basic block
+    CODEMAP_BLOCK = 0x04,
+    // target of a 1nnn or Bnnn jump
+    CODEMAP_JUMP_TARGET = 0x08,
+    // target of a 2nnn call, a subroutine entry
+    CODEMAP_CALL_TARGET = 0x10,
+    // address loaded into I by Annn
+    CODEMAP_DATA_TARGET = 0x20
+};
+
+// straight line run of instructions, only the last one can transfer control
+struct CodeBlock
+{
+    uint32_t start;
+    // address after the last instruction, a block can run up to the end of memory
+    uint32_t end;
+};
+
+// subroutine (or the entry point) calling another
+struct CallEdge
+{
+    uint16_t caller;
+    uint16_t callee;
+};
+
+// recursive descent analysis of a rom from its entry point, following jumps, calls, skips and returns
+// to tell code from data, split the code into basic blocks and build the call graph
+class CodeMap
+{
+private:
+
+    // fnv-1a and size of the rom analysed
+    uint64_t m_Hash;
+    uint32_t m_Start;
+    uint32_t m_End;
+
+    uint8_t m_Flags[MAX_MEMORY];
+    std::vector<CodeBlock> m_Blocks;
+    std::vector<CallEdge> m_Calls;
+
+    // label number per address, by kind in address order, 0 for none
+    uint16_t m_Labels[MAX_MEMORY];
+    void numberLabels();
+
+public:
+    CodeMap();
+
+    static uint64_t hashROM(const uint8_t *rom, unsigned int size);
+
+    void analyse(const uint8_t *rom, unsigned int size, uint16_t addr = 0x200);
+
+    // sidecar file, load fails if it was written for another rom or version
+    bool save(std::string filename);
+    bool load(std::string filename, const uint8_t *rom, unsigned int size);
+
+    // load the sidecar of romfile or analyse the rom and write one, returns true if it was loaded
+    bool loadOrAnalyse(std::string romfile, const uint8_t *rom, unsigned int size);
+
+    uint8_t getFlags(uint16_t addr) { return m_Flags[addr & (MAX_MEMORY - 1)];}
+    bool isCode(uint16_t addr) { return getFlags(addr) & CODEMAP_CODE;}
+    const std::vector<CodeBlock> &getBlocks() { return m_Blocks;}
+    const std::vector<CallEdge> &getCalls() { return m_Calls;}
+
+    // sub_N for call targets, label_N for jump targets and data_N for data, empty for none
+    std::string getLabel(uint16_t addr);
+
+    // replace the target address in the operands of a jump, call or Annn with its label
+    void labelInstruction(Instruction *inst);
+};
+#endif // CLASS_CODEMAP
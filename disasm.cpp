@@ -0,0 +1,284 @@
+#include "disasm.hpp"
+#include "threadpool.hpp"
+#include "romfile.hpp"
+
+#include <string.h>
+#include <atomic>
+#include <fstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// mnemonic and operands of one opcode as they appear in a listing
+struct AsmText
+{
+    char text[32];
+    uint8_t len;
+};
+
+// every opcode is formatted at most once and shared by all threads,
+// entries are 0 until claimed, 1 while the claiming thread formats them and 2 once ready
+static AsmText s_AsmText[0x10000];
+static std::atomic<uint8_t> s_AsmState[0x10000];
+
+static void formatText(uint16_t opcode, AsmText *text)
+{
+    Instruction inst = Chip8Core::disassemble(opcode);
+
+    std::string line = inst.mnemonic;
+    if(line.size() < ASM_MNEMONIC_WIDTH) line.resize(ASM_MNEMONIC_WIDTH, ' ');
+    line += inst.vars;
+
+    text->len = std::min(line.size(), sizeof(text->text));
+    memcpy(text->text, line.data(), text->len);
+}
+
+static const AsmText &asmText(uint16_t opcode, AsmText *local)
+{
+    if(s_AsmState[opcode].load(std::memory_order_acquire) == 2) return s_AsmText[opcode];
+
+    // another thread formatting the same opcode, use a private copy instead of waiting
+    uint8_t unclaimed = 0;
+    if(!s_AsmState[opcode].compare_exchange_strong(unclaimed, 1))
+    {
+        formatText(opcode, local);
+        return *local;
+    }
+
+    formatText(opcode, &s_AsmText[opcode]);
+    s_AsmState[opcode].store(2, std::memory_order_release);
+
+    return s_AsmText[opcode];
+}
+
+static const char s_HexDigits[] = "0123456789abcdef";
+
+static void appendHex4(std::string *out, uint16_t val)
+{
+    char digits[4] = { s_HexDigits[val >> 12], s_HexDigits[(val >> 8) & 0xf], s_HexDigits[(val >> 4) & 0xf], s_HexDigits[val & 0xf] };
+    out->append(digits, 4);
+}
+
+bool readROMFile(std::string romfile, std::vector<uint8_t> *rom)
+{
+    MappedFile file;
+
+    if(!file.open(romfile)) return false;
+
+    rom->assign(file.getData(), file.getData() + file.getSize());
+
+    return true;
+}
+
+bool writeASMFile(std::string asmfile, const std::string &text)
+{
+    std::ofstream ofile(asmfile.c_str(), std::ios::binary);
+
+    if(!ofile.is_open()) return false;
+
+    ofile.write(text.data(), text.size());
+
+    return bool(ofile);
+}
+
+void formatROMASM(const uint8_t *rom, unsigned int size, bool verbose, std::string *out, CodeMap *map)
+{
+    // an odd last byte is padded with 0
+    unsigned int count = (size + 1) / 2;
+    AsmText local;
+
+    // a line is at most 4 + 2 + 4 + 2 + the text + 1
+    out->reserve(out->size() + count * 48);
+
+    if(verbose)
+    {
+        uint16_t addr = 0x200;
+
+        for(unsigned int i = 0; i < count; i++, addr += 2)
+        {
+            uint16_t opcode = rom[i*2] << 8 | (i*2 + 1 < size ? rom[i*2 + 1] : 0);
+            const AsmText &text = asmText(opcode, &local);
+
+            appendHex4(out, addr);
+            out->append("  ");
+            appendHex4(out, opcode);
+            out->append("  ");
+            out->append(text.text, text.len);
+            out->push_back('\n');
+        }
+
+        return;
+    }
+
+    CodeMap *analysed = NULL;
+    if(!map)
+    {
+        analysed = new CodeMap;
+        analysed->analyse(rom, size);
+        map = analysed;
+    }
+
+    // reachable instructions are listed as code, everything else as data bytes
+    unsigned int end = std::min(0x200 + size, unsigned(MAX_MEMORY));
+    unsigned int addr = 0x200;
+
+    while(addr < end)
+    {
+        std::string label = map->getLabel(addr);
+        if(!label.empty())
+        {
+            out->push_back('\n');
+            out->append(label);
+            out->append(":\n");
+        }
+
+        out->append("    ");
+
+        if(map->isCode(addr))
+        {
+            unsigned int i = addr - 0x200;
+            uint16_t opcode = rom[i] << 8 | (i + 1 < size ? rom[i + 1] : 0);
+            uint8_t op = opcode >> 12;
+            const AsmText &text = asmText(opcode, &local);
+
+            // jumps, calls and Annn name their target instead of the address
+            std::string target;
+            if(op == 0x1 || op == 0x2 || op == 0xa || op == 0xb) target = map->getLabel(opcode & 0xfff);
+
+            if(!target.empty())
+            {
+                out->append(text.text, ASM_MNEMONIC_WIDTH);
+                if(op == 0xa) out->append("I, ");
+                else if(op == 0xb) out->append("V0, ");
+                out->append(target);
+            }
+            else out->append(text.text, text.len);
+
+            addr += 2;
+        }
+        else
+        {
+            // up to 8 bytes a line, a line ends before code or a label
+            out->append("DB");
+            out->append(ASM_MNEMONIC_WIDTH - 2, ' ');
+
+            unsigned int bytes = 0;
+            do
+            {
+                if(bytes) out->append(", ");
+                out->push_back('$');
+                out->push_back(s_HexDigits[rom[addr - 0x200] >> 4]);
+                out->push_back(s_HexDigits[rom[addr - 0x200] & 0xf]);
+                addr++;
+                bytes++;
+            }
+            while(bytes < 8 && addr < end && !map->isCode(addr) && map->getLabel(addr).empty());
+        }
+
+        out->push_back('\n');
+    }
+
+    delete analysed;
+}
+
+bool listROMs(std::string romdir, std::vector<std::string> *roms)
+{
+    std::vector<std::string> names;
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((romdir + "\\*").c_str(), &data);
+
+    if(find == INVALID_HANDLE_VALUE) return false;
+
+    do
+    {
+        if(!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) names.push_back(data.cFileName);
+    }
+    while(FindNextFileA(find, &data));
+
+    FindClose(find);
+#else
+    DIR *dir = opendir(romdir.c_str());
+
+    if(!dir) return false;
+
+    struct dirent *entry;
+    while((entry = readdir(dir))) names.push_back(entry->d_name);
+
+    closedir(dir);
+#endif
+
+    for(unsigned int i = 0; i < names.size(); i++)
+    {
+        std::string ext = names[i].substr(std::min(names[i].size(), names[i].find_last_of('.')));
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+        if(ext == ".rom" || ext == ".ch8") roms->push_back(romdir + "/" + names[i]);
+    }
+
+    std::sort(roms->begin(), roms->end());
+
+    return true;
+}
+
+unsigned int disassembleDirectory(std::string romdir, std::string asmdir, bool verbose, unsigned int threads)
+{
+    std::vector<std::string> roms;
+
+    if(!listROMs(romdir, &roms))
+    {
+        std::cout << "Error opening rom directory:" << romdir << std::endl;
+        return 0;
+    }
+
+    // 0 written, 1 rom unreadable, 2 asm unwritable
+    std::vector<uint8_t> status(roms.size());
+    std::vector<std::string> asmfiles(roms.size());
+
+    ThreadPool pool(threads);
+    pool.parallelFor(roms.size(), [&](unsigned int i)
+    {
+        // rom name without its directory and extension
+        std::string name = roms[i].substr(romdir.size() + 1);
+        name = name.substr(0, name.find_last_of('.'));
+        asmfiles[i] = asmdir + "/" + name + ".asm";
+
+        std::vector<uint8_t> rom;
+        if(!readROMFile(roms[i], &rom))
+        {
+            status[i] = 1;
+            return;
+        }
+
+        const uint8_t *data = rom.empty() ? NULL : &rom[0];
+        std::string text;
+
+        CodeMap *map = NULL;
+        if(!verbose)
+        {
+            map = new CodeMap;
+            map->loadOrAnalyse(roms[i], data, rom.size());
+        }
+
+        formatROMASM(data, rom.size(), verbose, &text, map);
+        delete map;
+
+        status[i] = writeASMFile(asmfiles[i], text) ? 0 : 2;
+    });
+
+    unsigned int written = 0;
+    for(unsigned int i = 0; i < roms.size(); i++)
+    {
+        if(status[i] == 1) std::cout << "Error opening rom file:" << roms[i] << std::endl;
+        else if(status[i] == 2) std::cout << "Error opening file for writing:" << asmfiles[i] << std::endl;
+        else written++;
+    }
+
+    return written;
+}
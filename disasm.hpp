@@ -0,0 +1,30 @@
+#ifndef DISASSEMBLER
+#define DISASSEMBLER
+
+#include <string>
+#include <vector>
+
+#include "chip8core.hpp"
+#include "codemap.hpp"
+
+// operands start after the mnemonic padded to this width
+#define ASM_MNEMONIC_WIDTH 10
+
+// read a whole rom file
+bool readROMFile(std::string romfile, std::vector<uint8_t> *rom);
+// write text out in one go
+bool writeASMFile(std::string asmfile, const std::string &text);
+
+// assembly text of a rom loaded at 0x200, appended to out
+// verbose lines carry the address and opcode of every byte pair, the plain listing only shows reachable code
+// as instructions and the rest as data, with labels from map, which is analysed here if NULL
+void formatROMASM(const uint8_t *rom, unsigned int size, bool verbose, std::string *out, CodeMap *map = NULL);
+
+// .rom and .ch8 files in a directory, sorted by name
+bool listROMs(std::string romdir, std::vector<std::string> *roms);
+
+// disassemble every rom in romdir to asmdir/<name>.asm on a thread pool, 0 threads uses one per core
+// code maps are loaded from or written to the sidecar of each rom
+// returns the number of roms written, failures are printed once all are done
+unsigned int disassembleDirectory(std::string romdir, std::string asmdir, bool verbose, unsigned int threads = 0);
+#endif // DISASSEMBLER
@@ -0,0 +1,206 @@
+#include "inputlog.hpp"
+
+#include <string.h>
+
+InputLog::InputLog()
+{
+    m_Recording = false;
+    m_Replaying = false;
+    m_HasNext = false;
+    m_NextState = NULL;
+    m_Events = 0;
+}
+
+InputLog::~InputLog()
+{
+    close();
+    free(m_NextState);
+}
+
+void InputLog::close()
+{
+    if(m_Out.is_open()) m_Out.close();
+    if(m_In.is_open()) m_In.close();
+
+    m_Recording = false;
+    m_Replaying = false;
+    m_HasNext = false;
+}
+
+bool InputLog::startRecording(std::string filename, const MachineState &state, unsigned int hz)
+{
+    close();
+
+    m_Out.open(filename.c_str(), std::ios::binary);
+
+    if(!m_Out.is_open()) return false;
+
+    // header is the magic, the version, the state size, the cpu speed and the starting state
+    uint32_t version = INPUT_LOG_VERSION;
+    uint32_t size = stateSize(state.quirks);
+    uint32_t speed = hz;
+
+    m_Out.write(INPUT_LOG_MAGIC, 4);
+    m_Out.write((const char*)&version, sizeof(version));
+    m_Out.write((const char*)&size, sizeof(size));
+    m_Out.write((const char*)&speed, sizeof(speed));
+    m_Out.write((const char*)&state, size);
+
+    m_Recording = true;
+    m_Events = 0;
+
+    return true;
+}
+
+bool InputLog::startReplay(std::string filename, MachineState **state, unsigned int *hz)
+{
+    close();
+
+    m_In.open(filename.c_str(), std::ios::binary);
+
+    if(!m_In.is_open()) return false;
+
+    char magic[4];
+    uint32_t version = 0;
+    uint32_t size = 0;
+    uint32_t speed = 0;
+
+    m_In.read(magic, 4);
+    m_In.read((char*)&version, sizeof(version));
+    m_In.read((char*)&size, sizeof(size));
+    m_In.read((char*)&speed, sizeof(speed));
+
+    // refuse logs from another version or build of the machine
+    if(!m_In || memcmp(magic, INPUT_LOG_MAGIC, 4) || version != INPUT_LOG_VERSION)
+    {
+        std::cout << "Error input log version mismatch:" << filename << std::endl;
+        m_In.close();
+        return false;
+    }
+
+    *state = readState(m_In, size);
+    if(!*state)
+    {
+        m_In.close();
+        return false;
+    }
+
+    *hz = speed;
+
+    m_Replaying = true;
+    m_Events = 0;
+    readNext();
+
+    return true;
+}
+
+void InputLog::writeVarint(uint64_t val)
+{
+    while(val >= 0x80)
+    {
+        m_Out.put(char(uint8_t(val) | 0x80));
+        val >>= 7;
+    }
+    m_Out.put(char(val));
+}
+
+bool InputLog::readVarint(uint64_t *val)
+{
+    *val = 0;
+
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        int b = m_In.get();
+        if(b == EOF) return false;
+
+        *val |= uint64_t(b & 0x7f) << shift;
+        if(!(b & 0x80)) return true;
+    }
+
+    return false;
+}
+
+void InputLog::writeEvent(uint64_t cycle, uint8_t type)
+{
+    writeVarint(cycle);
+    m_Out.put(char(type));
+    m_Events++;
+}
+
+void InputLog::writeKeys(uint64_t cycle, uint16_t keys)
+{
+    if(!m_Recording) return;
+
+    writeEvent(cycle, INPUT_KEYS);
+    m_Out.put(char(keys & 0xff));
+    m_Out.put(char(keys >> 8));
+}
+
+void InputLog::writeReset(uint64_t cycle, uint32_t seed)
+{
+    if(!m_Recording) return;
+
+    writeEvent(cycle, INPUT_RESET);
+    writeVarint(seed);
+}
+
+void InputLog::writeState(uint64_t cycle, const MachineState &state)
+{
+    if(!m_Recording) return;
+
+    writeEvent(cycle, INPUT_STATE);
+    writeVarint(stateSize(state.quirks));
+    m_Out.write((const char*)&state, stateSize(state.quirks));
+}
+
+void InputLog::writeEnd(uint64_t cycle)
+{
+    if(!m_Recording) return;
+
+    writeEvent(cycle, INPUT_END);
+    m_Out.flush();
+}
+
+void InputLog::readNext()
+{
+    m_HasNext = false;
+
+    if(!m_Replaying) return;
+
+    uint64_t cycle;
+    if(!readVarint(&cycle)) return;
+
+    int type = m_In.get();
+    if(type == EOF) return;
+
+    m_Next.cycle = cycle;
+    m_Next.type = type;
+    m_Next.value = 0;
+
+    if(type == INPUT_KEYS)
+    {
+        int lo = m_In.get();
+        int hi = m_In.get();
+        if(hi == EOF) return;
+        m_Next.value = lo | hi << 8;
+    }
+    else if(type == INPUT_RESET)
+    {
+        uint64_t seed;
+        if(!readVarint(&seed)) return;
+        m_Next.value = seed;
+    }
+    else if(type == INPUT_STATE)
+    {
+        uint64_t size;
+        if(!readVarint(&size) || size > 0xffffffffULL) return;
+
+        free(m_NextState);
+        m_NextState = readState(m_In, size);
+        if(!m_NextState) return;
+    }
+    else if(type != INPUT_END) return;
+
+    m_HasNext = true;
+    m_Events++;
+}
@@ -0,0 +1,83 @@
+#ifndef CLASS_INPUTLOG
+#define CLASS_INPUTLOG
+
+#include <string>
+#include <fstream>
+
+#include "chip8core.hpp"
+
+// input log file header, bump the version whenever the event encoding changes
+#define INPUT_LOG_MAGIC "C8IN"
+#define INPUT_LOG_VERSION 4
+
+// everything from outside the machine that changes what it runs
+enum INPUT_EVENT
+{
+    // keypad state seen by the guest from this cycle on
+    INPUT_KEYS,
+    // machine reset, value is the rng seed after it
+    INPUT_RESET,
+    // whole machine state replaced by a rewind or a state load, stored with its size
+    INPUT_STATE,
+    // recording stopped
+    INPUT_END
+};
+
+struct InputEvent
+{
+    // guest cycle the event happened at, before the instruction at that cycle ran
+    uint64_t cycle;
+    uint8_t type;
+    uint32_t value;
+};
+
+// guest input keyed by cycle, streamed to or from a binary file
+// the file starts with the machine state and cpu speed recording began with, so a replay needs no rom,
+// then holds one event per change as a varint cycle, a type byte and a type specific payload
+class InputLog
+{
+private:
+
+    std::ofstream m_Out;
+    std::ifstream m_In;
+    bool m_Recording;
+    bool m_Replaying;
+
+    // next event of a replay, state events carry their state here
+    InputEvent m_Next;
+    bool m_HasNext;
+    MachineState *m_NextState;
+
+    uint64_t m_Events;
+
+    void writeVarint(uint64_t val);
+    bool readVarint(uint64_t *val);
+    void writeEvent(uint64_t cycle, uint8_t type);
+    void readNext();
+
+public:
+    InputLog();
+    ~InputLog();
+
+    // start a log, the header is written or read right away
+    // a replay hands back the state it starts from, free() it
+    bool startRecording(std::string filename, const MachineState &state, unsigned int hz);
+    bool startReplay(std::string filename, MachineState **state, unsigned int *hz);
+    void close();
+
+    bool isRecording() { return m_Recording;}
+    bool isReplaying() { return m_Replaying;}
+    uint64_t getEventCount() { return m_Events;}
+
+    // recording
+    void writeKeys(uint64_t cycle, uint16_t keys);
+    void writeReset(uint64_t cycle, uint32_t seed);
+    void writeState(uint64_t cycle, const MachineState &state);
+    void writeEnd(uint64_t cycle);
+
+    // replay, the next event and its state if it replaces the machine state
+    const InputEvent *peek() { return m_HasNext ? &m_Next : NULL;}
+    const MachineState &getEventState() { return *m_NextState;}
+    void pop() { readNext();}
+};
+#endif // CLASS_INPUTLOG
@@ -0,0 +1,538 @@
+#include "chip8core.hpp"
+
+// native code generation needs x86-64, the SysV calling convention and mmap
+#if defined(__x86_64__) && !defined(_WIN32)
+#define CHIP8_JIT
+#include <sys/mman.h>
+#include <string.h>
+#endif
+
+// interpreted executions of an address before its block is compiled
+#define JIT_HOT_THRESHOLD 8
+
+// longest basic block the jit will compile
+#define JIT_MAX_BLOCK_INSTRUCTIONS 32
+
+// size of the executable code buffer, flushed when full
+#define JIT_ARENA_SIZE (256*1024)
+
+// largest native block, 32 instructions at under 32 bytes each plus prologue and epilogue
+#define JIT_MAX_BLOCK_CODE 2048
+
+void Chip8Core::initJit()
+{
+    m_JitArena = NULL;
+    m_JitArenaUsed = 0;
+
+    m_JitNoBlock.start = 0;
+    m_JitNoBlock.end = 0;
+    m_JitNoBlock.instructions = 0;
+    m_JitNoBlock.overrun = false;
+    m_JitNoBlock.code = NULL;
+
+    m_JitCache.assign(memorySize(m_State->quirks), NULL);
+    m_JitCoverage.assign(memorySize(m_State->quirks), 0);
+    m_JitHeat.assign(memorySize(m_State->quirks), 0);
+}
+
+void Chip8Core::invalidateJit(uint16_t addr, unsigned int len)
+{
+    // an opcode starting one byte before the write also reads the first written byte
+    int start = int(addr) - 1;
+    int end = int(addr) + len;
+
+    if(start < 0) start = 0;
+    if(end > int(m_JitCache.size())) end = m_JitCache.size();
+
+    bool covered = false;
+
+    for(int i = start; i < end; i++)
+    {
+        if(m_JitCache[i] == &m_JitNoBlock) m_JitCache[i] = NULL;
+        m_JitHeat[i] = 0;
+
+        if(m_JitCoverage[i]) covered = true;
+    }
+    if(!covered) return;
+
+    // writes only happen on the interpreter path, so no compiled block is running
+    for(int i = 0; i < int(m_JitBlocks.size()); )
+    {
+        JitBlock *jb = m_JitBlocks[i];
+
+        if(jb->start < end && jb->end > start)
+        {
+            for(int n = jb->start; n < jb->end; n++) m_JitCoverage[n]--;
+            m_JitCache[jb->start] = NULL;
+            m_JitHeat[jb->start] = 0;
+
+            // the native code stays in the arena until the next flush
+            delete jb;
+            m_JitBlocks[i] = m_JitBlocks.back();
+            m_JitBlocks.pop_back();
+        }
+        else i++;
+    }
+}
+
+void Chip8Core::flushJit()
+{
+    for(int i = 0; i < int(m_JitBlocks.size()); i++) delete m_JitBlocks[i];
+    m_JitBlocks.clear();
+
+    // sized for the memory of the current profile
+    m_JitCache.assign(memorySize(m_State->quirks), NULL);
+    m_JitCoverage.assign(memorySize(m_State->quirks), 0);
+    m_JitHeat.assign(memorySize(m_State->quirks), 0);
+
+    m_JitArenaUsed = 0;
+}
+
+void Chip8Core::freeJit()
+{
+    flushJit();
+
+#ifdef CHIP8_JIT
+    if(m_JitArena) munmap(m_JitArena, JIT_ARENA_SIZE);
+#endif
+    m_JitArena = NULL;
+}
+
+#ifdef CHIP8_JIT
+
+namespace
+{
+
+// host register numbers
+enum
+{
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// condition codes for setcc / cmovcc
+enum
+{
+    CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7
+};
+
+// host registers guest V registers can be pinned to
+// rax and rcx are scratch, rdi holds the machine state pointer and r15 holds I
+const int JIT_VREG_POOL[] = { RDX, RSI, R8, R9, R10, R11, RBX, RBP, R12, R13, R14 };
+const int JIT_VREG_POOL_SIZE = sizeof(JIT_VREG_POOL) / sizeof(int);
+const int JIT_IREG = R15;
+const int JIT_BASE = RDI;
+
+bool isCalleeSaved(int reg)
+{
+    return reg == RBX || reg == RBP || reg >= R12;
+}
+
+// minimal x86-64 encoder for the instructions the jit emits
+class X64Emitter
+{
+public:
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t b) { code.push_back(b);}
+    void word(uint16_t w) { byte(w & 0xff); byte(w >> 8);}
+    void dword(uint32_t d) { for(int i = 0; i < 4; i++) byte( (d >> (i*8)) & 0xff);}
+
+    // rex prefix, forced for byte registers so sil/dil/bpl map to the low bytes
+    void rex(int reg, int rm, bool force)
+    {
+        uint8_t r = 0x40 | ((reg >> 3) << 2) | (rm >> 3);
+        if(force || r != 0x40) byte(r);
+    }
+
+    void modrmReg(int reg, int rm) { byte(0xc0 | ((reg & 7) << 3) | (rm & 7));}
+    void modrmBase(int reg, int32_t disp) { byte(0x80 | ((reg & 7) << 3) | (JIT_BASE & 7)); dword(disp);}
+
+    // 8-bit dst = dst op src, opc is the r/m8,r8 form (add 0x00, or 0x08, and 0x20, sub 0x28, xor 0x30, cmp 0x38, mov 0x88)
+    void alu8(uint8_t opc, int dst, int src) { rex(src, dst, true); byte(opc); modrmReg(src, dst);}
+    // 8-bit dst = dst op imm, ext is the /digit (add 0, or 1, and 4, sub 5, xor 6, cmp 7)
+    void alu8imm(int ext, int dst, uint8_t imm) { rex(0, dst, true); byte(0x80); modrmReg(ext, dst); byte(imm);}
+    void mov8imm(int dst, uint8_t imm) { rex(0, dst, true); byte(0xb0 | (dst & 7)); byte(imm);}
+    void shr8imm(int dst, uint8_t imm) { rex(0, dst, true); byte(0xc0); modrmReg(5, dst); byte(imm);}
+    void setcc(uint8_t cc, int dst) { rex(0, dst, true); byte(0x0f); byte(0x90 | cc); modrmReg(0, dst);}
+
+    // loads and stores relative to the machine pointer
+    void movzx8mem(int dst, int32_t disp) { rex(dst, JIT_BASE, false); byte(0x0f); byte(0xb6); modrmBase(dst, disp);}
+    void movzx16mem(int dst, int32_t disp) { rex(dst, JIT_BASE, false); byte(0x0f); byte(0xb7); modrmBase(dst, disp);}
+    void store8mem(int32_t disp, int src) { rex(src, JIT_BASE, true); byte(0x88); modrmBase(src, disp);}
+    void store16mem(int32_t disp, int src) { byte(0x66); rex(src, JIT_BASE, false); byte(0x89); modrmBase(src, disp);}
+    void store16memimm(int32_t disp, uint16_t imm) { byte(0x66); byte(0xc7); modrmBase(0, disp); word(imm);}
+
+    // 32-bit register ops
+    void mov32imm(int dst, uint32_t imm) { rex(0, dst, false); byte(0xb8 | (dst & 7)); dword(imm);}
+    void movzx8reg(int dst, int src) { rex(dst, src, true); byte(0x0f); byte(0xb6); modrmReg(dst, src);}
+    void add32(int dst, int src) { rex(src, dst, false); byte(0x01); modrmReg(src, dst);}
+    void alu32imm(int ext, int dst, uint32_t imm) { rex(0, dst, false); byte(0x81); modrmReg(ext, dst); dword(imm);}
+    void cmov(uint8_t cc, int dst, int src) { rex(dst, src, false); byte(0x0f); byte(0x40 | cc); modrmReg(dst, src);}
+
+    void push(int reg) { if(reg >= 8) byte(0x41); byte(0x50 | (reg & 7));}
+    void pop(int reg) { if(reg >= 8) byte(0x41); byte(0x58 | (reg & 7));}
+    void ret() { byte(0xc3);}
+};
+
+// instructions the jit compiles, everything else ends the block and runs on the interpreter
+bool isJitSupported(uint8_t id)
+{
+    switch(id)
+    {
+    case OPID_UNK: case OPID_JP: case OPID_SE_KK: case OPID_SNE_KK: case OPID_SE_XY: case OPID_SNE_XY:
+    case OPID_LD_KK: case OPID_ADD_KK: case OPID_LD_XY: case OPID_OR: case OPID_AND: case OPID_XOR:
+    case OPID_ADD_XY: case OPID_SUB: case OPID_SHR: case OPID_SUBN: case OPID_SHL:
+    case OPID_LD_I: case OPID_JP_V0: case OPID_ADD_I:
+    case OPID_LD_VX_DT: case OPID_LD_DT: case OPID_LD_ST:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isJitTerminator(uint8_t id)
+{
+    switch(id)
+    {
+    case OPID_JP: case OPID_JP_V0: case OPID_SE_KK: case OPID_SNE_KK: case OPID_SE_XY: case OPID_SNE_XY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// guest registers an instruction reads or writes under the quirk flags, as a bit mask
+uint16_t jitRegisterUse(uint8_t id, const DecodedInstruction &d, uint8_t quirks)
+{
+    switch(id)
+    {
+    case OPID_SE_KK: case OPID_SNE_KK: case OPID_LD_KK: case OPID_ADD_KK:
+    case OPID_ADD_I: case OPID_LD_VX_DT: case OPID_LD_DT: case OPID_LD_ST:
+        return 1 << d.x;
+    case OPID_SE_XY: case OPID_SNE_XY: case OPID_LD_XY:
+        return (1 << d.x) | (1 << d.y);
+    case OPID_OR: case OPID_AND: case OPID_XOR:
+        return (1 << d.x) | (1 << d.y) | ((quirks & QUIRK_VF_RESET) ? (1 << 0xf) : 0);
+    case OPID_ADD_XY: case OPID_SUB: case OPID_SUBN:
+        return (1 << d.x) | (1 << d.y) | (1 << 0xf);
+    case OPID_SHR: case OPID_SHL:
+        return (1 << d.x) | ((quirks & QUIRK_SHIFT_VY) ? (1 << d.y) : 0) | (1 << 0xf);
+    case OPID_JP_V0:
+        return (quirks & QUIRK_JUMP_VX) ? (1 << d.x) : (1 << 0x0);
+    default:
+        return 0;
+    }
+}
+
+int bitCount(uint16_t mask)
+{
+    int count = 0;
+    for(; mask; mask &= mask - 1) count++;
+    return count;
+}
+
+}
+
+JitBlock *Chip8Core::compileJitBlock(uint16_t start)
+{
+    // byte offsets of the guest registers inside the state, it moves when the memory size changes
+    const int32_t offreg = offsetof(MachineState, reg);
+    const int32_t offireg = offsetof(MachineState, ireg);
+    const int32_t offpc = offsetof(MachineState, pc);
+    const int32_t offdelay = offsetof(MachineState, delay);
+    const int32_t offsound = offsetof(MachineState, sound);
+    const unsigned int memsize = memorySize(m_State->quirks);
+
+    // the profile is fixed for the life of the block, blocks are flushed when it changes
+    const uint8_t quirks = quirkFlags(m_State->quirks);
+
+    // first pass, find the compilable run of instructions and the registers it uses
+    DecodedInstruction insts[JIT_MAX_BLOCK_INSTRUCTIONS];
+    uint8_t ids[JIT_MAX_BLOCK_INSTRUCTIONS];
+    int count = 0;
+    uint16_t used = 0;
+    bool usesireg = false;
+    bool terminated = false;
+    // no timer reads or writes, the block can run past the end of a batch
+    bool overrun = true;
+    // the block ends on a skip over an f000 and its address word
+    bool longskip = false;
+    uint16_t addr = start;
+
+    while(!terminated && count < JIT_MAX_BLOCK_INSTRUCTIONS && addr < memsize - 2)
+    {
+        DecodedInstruction d;
+        decode(m_State->mem[addr] << 8 | m_State->mem[addr+1], &d);
+        uint8_t id = s_OpTable[d.opcode];
+
+        if(!isJitSupported(id)) break;
+
+        bool skip = id == OPID_SE_KK || id == OPID_SNE_KK || id == OPID_SE_XY || id == OPID_SNE_XY;
+        // leave skips whose next word could be an F000 with its address word past the end of memory to the table engine
+        if(skip && (quirks & QUIRK_LONG_SKIP) && addr + 4u >= memsize - 2) break;
+        bool skipslong = skip && (quirks & QUIRK_LONG_SKIP) && m_State->mem[addr+2] == 0xf0 && m_State->mem[addr+3] == 0x00;
+
+        // stop before running out of host registers to pin guest registers to
+        uint16_t nused = used | jitRegisterUse(id, d, quirks);
+        if(bitCount(nused) > JIT_VREG_POOL_SIZE) break;
+
+        used = nused;
+        if(id == OPID_LD_I || id == OPID_ADD_I) usesireg = true;
+        terminated = isJitTerminator(id);
+        longskip = skipslong;
+        if(isTickSensitive(id)) overrun = false;
+
+        insts[count] = d;
+        ids[count] = id;
+        count++;
+        addr += 2;
+    }
+
+    if(count == 0) return NULL;
+
+    // pin each used guest register to a host register
+    int hostreg[MAX_REGISTERS];
+    int pinned = 0;
+    for(int i = 0; i < MAX_REGISTERS; i++)
+    {
+        hostreg[i] = -1;
+        if(used & (1 << i)) hostreg[i] = JIT_VREG_POOL[pinned++];
+    }
+
+    X64Emitter e;
+    e.code.reserve(JIT_MAX_BLOCK_CODE);
+
+    // prologue, save callee-saved host registers and load the pinned guest state
+    std::vector<int> saved;
+    for(int i = 0; i < pinned; i++) if(isCalleeSaved(JIT_VREG_POOL[i])) saved.push_back(JIT_VREG_POOL[i]);
+    if(usesireg) saved.push_back(JIT_IREG);
+    for(int i = 0; i < int(saved.size()); i++) e.push(saved[i]);
+
+    for(int i = 0; i < MAX_REGISTERS; i++) if(hostreg[i] >= 0) e.movzx8mem(hostreg[i], offreg + i);
+    if(usesireg) e.movzx16mem(JIT_IREG, offireg);
+
+    // body
+    // when the block ends on a computed jump or skip, the next program counter is left in eax
+    bool pcinrax = false;
+    uint16_t nextpc = addr;
+
+    for(int i = 0; i < count; i++)
+    {
+        const DecodedInstruction &d = insts[i];
+        int vx = hostreg[d.x];
+        int vy = hostreg[d.y];
+        int vf = hostreg[0xf];
+        // shift source
+        int vs = (quirks & QUIRK_SHIFT_VY) ? vy : vx;
+        // program counter after this instruction has been fetched
+        uint16_t pc = start + i*2 + 2;
+
+        switch(ids[i])
+        {
+        case OPID_UNK:
+            break;
+        case OPID_LD_KK:
+            e.mov8imm(vx, d.kk);
+            break;
+        case OPID_ADD_KK:
+            e.alu8imm(0, vx, d.kk);
+            break;
+        case OPID_LD_XY:
+            e.alu8(0x88, vx, vy);
+            break;
+        case OPID_OR:
+            e.alu8(0x08, vx, vy);
+            if(quirks & QUIRK_VF_RESET) e.mov8imm(vf, 0);
+            break;
+        case OPID_AND:
+            e.alu8(0x20, vx, vy);
+            if(quirks & QUIRK_VF_RESET) e.mov8imm(vf, 0);
+            break;
+        case OPID_XOR:
+            e.alu8(0x30, vx, vy);
+            if(quirks & QUIRK_VF_RESET) e.mov8imm(vf, 0);
+            break;
+        case OPID_ADD_XY:
+            // carry flag written before the result, same as the interpreter
+            e.alu8(0x88, RAX, vx);
+            e.alu8(0x00, RAX, vy);
+            e.setcc(CC_B, vf);
+            e.alu8(0x88, vx, RAX);
+            break;
+        case OPID_SUB:
+            e.alu8(0x88, RAX, vx);
+            e.alu8(0x38, RAX, vy);
+            e.setcc(CC_A, vf);
+            e.alu8(0x88, RAX, vx);
+            e.alu8(0x28, RAX, vy);
+            e.alu8(0x88, vx, RAX);
+            break;
+        case OPID_SUBN:
+            e.alu8(0x88, RAX, vy);
+            e.alu8(0x38, RAX, vx);
+            e.setcc(CC_A, vf);
+            e.alu8(0x88, RAX, vy);
+            e.alu8(0x28, RAX, vx);
+            e.alu8(0x88, vx, RAX);
+            break;
+        case OPID_SHR:
+            e.alu8(0x88, RAX, vs);
+            e.alu8imm(4, RAX, 0x1);
+            e.alu8(0x88, vf, RAX);
+            e.alu8(0x88, RAX, vs);
+            e.shr8imm(RAX, 1);
+            e.alu8(0x88, vx, RAX);
+            break;
+        case OPID_SHL:
+            e.alu8(0x88, RAX, vs);
+            e.shr8imm(RAX, 7);
+            e.alu8(0x88, vf, RAX);
+            e.alu8(0x88, RAX, vs);
+            e.alu8(0x00, RAX, RAX);
+            e.alu8(0x88, vx, RAX);
+            break;
+        case OPID_LD_I:
+            e.mov32imm(JIT_IREG, d.nnn);
+            break;
+        case OPID_ADD_I:
+            // I += Vx, kept 16 bits wide like m_State->ireg
+            e.movzx8reg(RAX, vx);
+            e.add32(JIT_IREG, RAX);
+            e.alu32imm(4, JIT_IREG, 0xffff);
+            break;
+        case OPID_LD_VX_DT:
+            e.movzx8mem(vx, offdelay);
+            break;
+        case OPID_LD_DT:
+            e.store8mem(offdelay, vx);
+            break;
+        case OPID_LD_ST:
+            e.store8mem(offsound, vx);
+            break;
+        case OPID_JP:
+            nextpc = d.nnn;
+            break;
+        case OPID_JP_V0:
+            e.movzx8reg(RAX, hostreg[(quirks & QUIRK_JUMP_VX) ? d.x : 0x0]);
+            e.alu32imm(0, RAX, d.nnn);
+            pcinrax = true;
+            break;
+        case OPID_SE_KK:
+        case OPID_SNE_KK:
+        case OPID_SE_XY:
+        case OPID_SNE_XY:
+            e.mov32imm(RAX, pc);
+            e.mov32imm(RCX, longskip ? pc + 4 : pc + 2);
+            if(ids[i] == OPID_SE_KK || ids[i] == OPID_SNE_KK) e.alu8imm(7, vx, d.kk);
+            else e.alu8(0x38, vx, vy);
+            e.cmov( (ids[i] == OPID_SE_KK || ids[i] == OPID_SE_XY) ? CC_E : CC_NE, RAX, RCX);
+            pcinrax = true;
+            break;
+        }
+    }
+
+    // epilogue, write the guest state back and set the program counter
+    for(int i = 0; i < MAX_REGISTERS; i++) if(hostreg[i] >= 0) e.store8mem(offreg + i, hostreg[i]);
+    if(usesireg) e.store16mem(offireg, JIT_IREG);
+
+    if(pcinrax) e.store16mem(offpc, RAX);
+    else e.store16memimm(offpc, nextpc);
+
+    for(int i = int(saved.size()) - 1; i >= 0; i--) e.pop(saved[i]);
+    e.ret();
+
+    // map the code buffer on first use, flush everything when it fills up
+    if(!m_JitArena)
+    {
+        void *arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(arena == MAP_FAILED) return NULL;
+        m_JitArena = (uint8_t*)arena;
+    }
+    if(m_JitArenaUsed + e.code.size() > JIT_ARENA_SIZE) flushJit();
+
+    // keep the buffer writable only while copying code in
+    if(mprotect(m_JitArena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE) != 0) return NULL;
+    uint8_t *dst = m_JitArena + m_JitArenaUsed;
+    memcpy(dst, &e.code[0], e.code.size());
+    m_JitArenaUsed += (e.code.size() + 15) & ~15;
+    mprotect(m_JitArena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC);
+
+    JitBlock *jb = new JitBlock;
+    jb->start = start;
+    // cover the skipped f000 so rewriting it recompiles the block
+    jb->end = longskip ? addr + 2 : addr;
+    jb->instructions = count;
+    jb->overrun = overrun;
+    jb->code = (JitCode)dst;
+
+    for(int i = jb->start; i < jb->end; i++) m_JitCoverage[i]++;
+    m_JitCache[start] = jb;
+    m_JitBlocks.push_back(jb);
+
+    return jb;
+}
+
+template<int P> unsigned int Chip8Core::executeJit(unsigned int count)
+{
+    bool waspaused = m_isPaused;
+    unsigned int executed = 0;
+
+    while(executed < count)
+    {
+        // if program counter reached the end of memory, pause without running the last word
+        if(m_State->pc >= memorySize(P) - 2)
+        {
+            m_isPaused = true;
+            break;
+        }
+
+        JitBlock *jb = m_JitCache[m_State->pc];
+
+        if(!jb && m_JitHeat[m_State->pc] >= JIT_HOT_THRESHOLD)
+        {
+            jb = compileJitBlock(m_State->pc);
+            if(!jb) jb = &m_JitNoBlock;
+            m_JitCache[m_State->pc] = jb;
+        }
+
+        // blocks touching the timers only run when they fit in the batch, so they see the timers
+        // tick after the right number of instructions, the rest may run past it and the
+        // guest clock catches up after them
+        if(jb && jb->code && jb->instructions <= count - executed + (jb->overrun ? m_BatchOverrun : 0))
+        {
+            jb->code(m_State);
+            executed += jb->instructions;
+            continue;
+        }
+
+        // cold code, Dxyn, Fx0A, memory writes and anything else the jit leaves out
+        if(m_JitHeat[m_State->pc] < JIT_HOT_THRESHOLD) m_JitHeat[m_State->pc]++;
+        if(!processInstruction<P>( fetchInstruction(m_State->pc) )) break;
+        executed++;
+
+        // stop the batch if the instruction paused the cpu
+        if(m_isPaused && !waspaused) break;
+    }
+
+    return executed;
+}
+
+#else
+
+JitBlock *Chip8Core::compileJitBlock(uint16_t start)
+{
+    return NULL;
+}
+
+template<int P> unsigned int Chip8Core::executeJit(unsigned int count)
+{
+    return executeThreaded<P>(count);
+}
+
+#endif
+
+// one engine per quirk profile
+template unsigned int Chip8Core::executeJit<QUIRKS_MODERN>(unsigned int count);
+template unsigned int Chip8Core::executeJit<QUIRKS_VIP>(unsigned int count);
+template unsigned int Chip8Core::executeJit<QUIRKS_SCHIP>(unsigned int count);
+template unsigned int Chip8Core::executeJit<QUIRKS_XOCHIP>(unsigned int count);
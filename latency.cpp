@@ -0,0 +1,115 @@
+#include "latency.hpp"
+
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <algorithm>
+
+LatencyTracker::LatencyTracker()
+{
+    m_Start = std::chrono::steady_clock::now();
+    m_Stage = LATENCY_IDLE;
+    m_KeyTime = 0;
+    m_ObservedTime = 0;
+    m_DrawnTime = 0;
+    m_ObservedGeneration = 0;
+    m_DrawnGeneration = 0;
+    m_Count = 0;
+    m_Dropped = 0;
+}
+
+void LatencyTracker::keyChanged()
+{
+    int64_t now = elapsed();
+    int stage = m_Stage;
+
+    // the guest ignored the last change or never showed it, give up on it
+    if(stage != LATENCY_IDLE && now - m_KeyTime > LATENCY_TIMEOUT && advance(stage, LATENCY_IDLE))
+    {
+        m_Dropped++;
+        stage = LATENCY_IDLE;
+    }
+
+    // one change at a time, the ones in between are not measured
+    if(stage != LATENCY_IDLE) return;
+
+    m_KeyTime = now;
+    advance(LATENCY_IDLE, LATENCY_KEY);
+}
+
+void LatencyTracker::observed(uint32_t generation)
+{
+    if(!isWaiting()) return;
+
+    m_ObservedTime = elapsed();
+    m_ObservedGeneration = generation;
+    advance(LATENCY_LATCHED, LATENCY_OBSERVED);
+}
+
+void LatencyTracker::displayChanged(uint32_t generation)
+{
+    if(m_Stage.load(std::memory_order_relaxed) != LATENCY_OBSERVED || generation == m_ObservedGeneration) return;
+
+    m_DrawnTime = elapsed();
+    m_DrawnGeneration = generation;
+    advance(LATENCY_OBSERVED, LATENCY_DRAWN);
+}
+
+void LatencyTracker::presented(uint32_t generation)
+{
+    // the presented frame has to be the changed one or newer
+    if(m_Stage != LATENCY_DRAWN || int32_t(generation - m_DrawnGeneration) < 0) return;
+
+    int64_t keytime = m_KeyTime;
+
+    LatencySample &sample = m_Samples[m_Count % LATENCY_MAX_SAMPLES];
+    sample.observed = m_ObservedTime - keytime;
+    sample.drawn = m_DrawnTime - keytime;
+    sample.presented = elapsed() - keytime;
+    m_Count++;
+
+    advance(LATENCY_DRAWN, LATENCY_IDLE);
+}
+
+void LatencyTracker::printReport(std::ostream &out)
+{
+    unsigned int count = m_Count < LATENCY_MAX_SAMPLES ? m_Count : LATENCY_MAX_SAMPLES;
+
+    out << "Input latency, " << count << " key changes measured, " << m_Dropped << " never shown\n";
+    if(!count) return;
+
+    const char *names[] = { "key to guest read", "guest read to draw", "draw to present", "key to present" };
+    const int percentiles[] = { 50, 90, 99, 100 };
+
+    out << std::left << std::setw(22) << "" << std::right;
+    for(int p = 0; p < 4; p++) out << std::setw(9) << (percentiles[p] == 100 ? std::string("max") : "p" + std::to_string(percentiles[p]));
+    out << "   ms\n";
+
+    std::vector<int64_t> times(count);
+    out << std::fixed << std::setprecision(2);
+
+    for(int stage = 0; stage < 4; stage++)
+    {
+        for(unsigned int i = 0; i < count; i++)
+        {
+            const LatencySample &s = m_Samples[i];
+
+            if(stage == 0) times[i] = s.observed;
+            else if(stage == 1) times[i] = s.drawn - s.observed;
+            else if(stage == 2) times[i] = s.presented - s.drawn;
+            else times[i] = s.presented;
+        }
+        std::sort(times.begin(), times.end());
+
+        out << std::left << std::setw(22) << names[stage] << std::right;
+        for(int p = 0; p < 4; p++)
+        {
+            // nearest rank
+            unsigned int rank = (percentiles[p] * count + 99) / 100;
+            out << std::setw(9) << times[rank ? rank - 1 : 0] / 1000.0;
+        }
+        out << "\n";
+    }
+
+    out.unsetf(std::ios::floatfield);
+}
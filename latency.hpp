@@ -0,0 +1,80 @@
+#ifndef CLASS_LATENCY
+#define CLASS_LATENCY
+
+#include <atomic>
+#include <iostream>
+#include <chrono>
+#include <stdint.h>
+
+// completed measurements kept, the oldest are overwritten
+#define LATENCY_MAX_SAMPLES 4096
+// a key change the guest has not shown on screen by now is dropped, in microseconds
+#define LATENCY_TIMEOUT 1000000
+
+// how far the key change being measured has got
+enum LATENCY_STAGE
+{
+    // nothing being measured, the next key change starts a measurement
+    LATENCY_IDLE,
+    // render thread saw a key change
+    LATENCY_KEY,
+    // cpu latched the new keys, the guest has not read them yet
+    LATENCY_LATCHED,
+    // guest ran Ex9E, ExA1 or Fx0A with the new keys
+    LATENCY_OBSERVED,
+    // display changed after that
+    LATENCY_DRAWN
+};
+
+// times one key change at a time from the render thread sampling it to the frame showing its effect
+// being presented, the stage is handed between the render and cpu threads without locking
+class LatencyTracker
+{
+private:
+
+    struct LatencySample
+    {
+        // microseconds after the key change
+        int64_t observed;
+        int64_t drawn;
+        int64_t presented;
+    };
+
+    // microseconds since the tracker was created
+    std::chrono::steady_clock::time_point m_Start;
+    int64_t elapsed() { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_Start).count();}
+    std::atomic<int> m_Stage;
+
+    // stage timestamps of the measurement in flight
+    std::atomic<int64_t> m_KeyTime;
+    std::atomic<int64_t> m_ObservedTime;
+    std::atomic<int64_t> m_DrawnTime;
+    // display generation when the guest read the keys and when it next changed
+    std::atomic<uint32_t> m_ObservedGeneration;
+    std::atomic<uint32_t> m_DrawnGeneration;
+
+    // written by the render thread only
+    LatencySample m_Samples[LATENCY_MAX_SAMPLES];
+    uint64_t m_Count;
+    uint64_t m_Dropped;
+
+    bool advance(int from, int to) { return m_Stage.compare_exchange_strong(from, to);}
+
+public:
+    LatencyTracker();
+
+    // render thread
+    void keyChanged();
+    void presented(uint32_t generation);
+
+    // cpu thread
+    void latched() { advance(LATENCY_KEY, LATENCY_LATCHED);}
+    // instructions only need checking while this is true
+    bool isWaiting() { return m_Stage.load(std::memory_order_relaxed) == LATENCY_LATCHED;}
+    void observed(uint32_t generation);
+    void displayChanged(uint32_t generation);
+
+    // percentiles of every stage, call once both threads are done
+    void printReport(std::ostream &out);
+};
+#endif // CLASS_LATENCY
@@ -0,0 +1,699 @@
+#include "lockstep.hpp"
+#include "romfile.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+// avx2 paths are compiled per function, the rest of the build does not need -mavx2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LOCKSTEP_AVX2
+#include <immintrin.h>
+#endif
+
+// opcode field extraction, same as the chip8.cpp dispatch handlers
+#define OP_NNN(opcode) ((opcode) & 0x0fff)
+#define OP_N(opcode) ((opcode) & 0x000f)
+#define OP_X(opcode) (((opcode) & 0x0f00) >> 8)
+#define OP_Y(opcode) (((opcode) & 0x00f0) >> 4)
+#define OP_KK(opcode) ((opcode) & 0x00ff)
+
+static_assert(LOCKSTEP_LANES == 32, "lane masks are 32-bit");
+
+// lanes share Chip8Core's 4KB memory layout, a dirty block is this many bytes of it
+#define LOCKSTEP_BLOCK_SIZE (CHIP8_MEMORY / DIRTY_BLOCKS)
+
+// v0-vf bits of the registers one instruction can read or write, enough to run it on a lane alone
+static uint16_t instructionRegisters(uint16_t opcode)
+{
+    // Fx55 and Fx65 go through v0 to vx
+    if((opcode & 0xf0ff) == 0xf055 || (opcode & 0xf0ff) == 0xf065) return (2 << OP_X(opcode)) - 1;
+
+    // anything else names at most vx and vy, and Bnnn adds v0 and flags go to vf
+    return 1 << OP_X(opcode) | 1 << OP_Y(opcode) | 0x8001;
+}
+
+LockstepBatch::LockstepBatch()
+{
+    m_Core = new Chip8Core;
+
+    // both profiles the batch runs address 4KB
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++) m_Lanes[lane] = allocState(QUIRKS_MODERN);
+
+    m_QuirkMode = QUIRKS_AUTO;
+    m_Profile = QUIRKS_MODERN;
+
+    m_UseAVX2 = false;
+    setAVX2(true);
+
+    setCPUFrequency(CPU_FREQUENCY);
+
+    // lanes get different random streams unless seeded
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++) setSeed(lane, (lane + 1) * 0x9e3779b9);
+
+    for(int i = 0; i < CHIP8_MEMORY; i++) m_Stops[i] = 0;
+
+    reset();
+}
+
+LockstepBatch::~LockstepBatch()
+{
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++) free(m_Lanes[lane]);
+
+    delete m_Core;
+}
+
+void LockstepBatch::reset()
+{
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        MachineState *state = m_Lanes[lane];
+
+        // the rng keeps its seed, everything else starts from zero like a reset core
+        uint32_t seed = state->rng;
+        memset(state, 0, stateSize(m_Profile));
+        state->rng = seed;
+        state->quirks = m_Profile;
+        state->planes = 0x1;
+
+        // initial instructions, clear screen and jump to 0x200
+        state->mem[0x00] = 0x00;
+        state->mem[0x01] = 0xe0;
+        state->mem[0x02] = 0x12;
+        state->mem[0x03] = 0x00;
+
+        for(int i = 0; i < 80; i++) state->mem[FONT_ADDR + i] = sysfonts[i];
+        for(int i = 0; i < 160; i++) state->mem[BIG_FONT_ADDR + i] = bigfonts[i];
+
+        for(int i = 0; i < MAX_REGISTERS; i++) m_Reg[i][lane] = 0x0;
+        m_IReg[lane] = 0x0;
+        m_DelayReg[lane] = 0x0;
+        m_SoundReg[lane] = 0x0;
+        m_PCounter[lane] = 0x0;
+        m_Keys[0][lane] = 0x0;
+        m_Keys[1][lane] = 0x0;
+        m_HaltCycle[lane] = 0;
+        m_HaltFrame[lane] = 0;
+    }
+
+    m_Written = 0x0;
+
+    m_Halted = 0x0;
+    m_Halting = 0x0;
+    m_ChunkHalted = 0x0;
+    m_TickCounter = 0;
+    m_CycleCount = 0;
+    m_FrameCount = 0;
+    m_GroupInstructions = 0;
+    m_LaneInstructions = 0;
+}
+
+bool LockstepBatch::loadRom(std::string filename, uint16_t addr)
+{
+    MappedFile file;
+
+    if(!file.open(filename)) return false;
+
+    // a rom that needs vip or xo-chip behaviour can not run here, auto must not quietly run it as modern
+    if(m_QuirkMode == QUIRKS_AUTO)
+    {
+        m_Profile = Chip8Core::detectQuirks(file.getData(), file.getSize(), addr);
+        if(!supportsQuirks(QUIRK_PROFILE(m_Profile))) return false;
+
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++) m_Lanes[lane]->quirks = m_Profile;
+    }
+
+    if(addr >= CHIP8_MEMORY || file.getSize() > unsigned(CHIP8_MEMORY - addr)) return false;
+
+    loadProgram(file.getData(), file.getSize(), addr);
+
+    return true;
+}
+
+void LockstepBatch::loadProgram(const uint8_t *data, unsigned int size, uint16_t addr)
+{
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        for(unsigned int i = 0; i < size && addr + i < CHIP8_MEMORY; i++) m_Lanes[lane]->mem[addr + i] = data[i];
+    }
+}
+
+bool LockstepBatch::setQuirks(QUIRK_PROFILE profile)
+{
+    if(profile != QUIRKS_AUTO && !supportsQuirks(profile)) return false;
+
+    m_QuirkMode = profile;
+
+    // auto waits for the next rom
+    if(profile != QUIRKS_AUTO)
+    {
+        m_Profile = profile;
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++) m_Lanes[lane]->quirks = m_Profile;
+    }
+
+    return true;
+}
+
+void LockstepBatch::setCPUFrequency(unsigned int hz)
+{
+    // same guest clock as Chip8Core::setCPUFrequency(), there is no pacing here
+    if(hz == 0) hz = CPU_FREQUENCY;
+
+    m_InstructionsPerFrame = hz / TIMER_FREQUENCY;
+    if(m_InstructionsPerFrame == 0) m_InstructionsPerFrame = 1;
+}
+
+void LockstepBatch::setAVX2(bool enable)
+{
+#ifdef LOCKSTEP_AVX2
+    m_UseAVX2 = enable && __builtin_cpu_supports("avx2");
+#else
+    m_UseAVX2 = false;
+#endif
+}
+
+uint64_t LockstepBatch::runCycles(uint64_t count)
+{
+    uint64_t start = m_CycleCount;
+
+    while(m_CycleCount - start < count && !allHalted())
+    {
+        // chunks never cross a timer tick
+        uint64_t chunk = m_InstructionsPerFrame - m_TickCounter;
+        if(chunk > count - (m_CycleCount - start)) chunk = count - (m_CycleCount - start);
+
+        runChunk(chunk);
+    }
+
+    return m_CycleCount - start;
+}
+
+uint64_t LockstepBatch::runFrames(uint64_t frames)
+{
+    uint64_t start = m_CycleCount;
+    uint64_t target = m_FrameCount + frames;
+
+    while(m_FrameCount < target && !allHalted()) runChunk(m_InstructionsPerFrame - m_TickCounter);
+
+    return m_CycleCount - start;
+}
+
+void LockstepBatch::runChunk(unsigned int count)
+{
+    // instructions each lane has left in the chunk
+    unsigned int left[LOCKSTEP_LANES];
+    // lanes with instructions left, all but the running group wait at their pc in m_Stops
+    uint32_t waiting = ~m_Halted;
+
+    m_ChunkHalted = 0x0;
+
+    // without avx2 a group is no faster than its lanes, each runs its chunk through the core in one go
+    if(!m_UseAVX2)
+    {
+        for(uint32_t l = waiting; l; l &= l - 1)
+        {
+            unsigned int lane = __builtin_ctz(l);
+            unsigned int executed = runLane(lane, count);
+
+            if(m_Halting) retireHalted(m_Halting, executed);
+            m_Halting = 0x0;
+        }
+        waiting = 0x0;
+    }
+
+    for(uint32_t l = waiting; l; l &= l - 1)
+    {
+        unsigned int lane = __builtin_ctz(l);
+
+        left[lane] = count;
+        m_Stops[m_PCounter[lane] & (CHIP8_MEMORY - 1)]++;
+    }
+
+    while(waiting)
+    {
+        // lanes furthest back in the program go first, lanes that branched ahead wait there for them
+        unsigned int lead = lowestLane(waiting);
+        uint16_t pc = m_PCounter[lead];
+
+        // running off the end of memory halts the lane, the instruction is not counted
+        if(pc >= CHIP8_MEMORY - 2)
+        {
+            m_Stops[pc & (CHIP8_MEMORY - 1)]--;
+            waiting &= ~(uint32_t(1) << lead);
+            retireHalted(uint32_t(1) << lead, count - left[lead]);
+            continue;
+        }
+
+        uint16_t opcode = fetch(lead, pc);
+        uint32_t group = matchLanes(pc, opcode, waiting);
+
+        waiting &= ~group;
+        m_Stops[pc] -= __builtin_popcount(group);
+
+        // lanes that joined from different paths can have run different numbers of instructions
+        unsigned int budget = count;
+        for(uint32_t l = group; l; l &= l - 1) budget = std::min(budget, left[__builtin_ctz(l)]);
+
+        unsigned int steps = 0;
+
+        // a lane on its own runs through the core until it gets to where other lanes wait
+        if(!(group & (group - 1))) steps = runLane(lead, budget);
+        else
+        {
+            // the group runs until it splits, gets to waiting lanes or a lane is out of instructions
+            while(steps < budget)
+            {
+                if(executeGroup(group, opcode)) m_GroupInstructions += __builtin_popcount(group);
+                else stepLanes(group, opcode);
+                steps++;
+
+                // lanes that halted leave the group after their last instruction
+                if(m_Halting) break;
+
+                pc = m_PCounter[lead];
+                if(pc >= CHIP8_MEMORY - 2 || m_Stops[pc]) break;
+
+                opcode = fetch(lead, pc);
+                if(matchLanes(pc, opcode, group) != group) break;
+            }
+        }
+
+        for(uint32_t l = m_Halting; l; l &= l - 1)
+        {
+            unsigned int lane = __builtin_ctz(l);
+            retireHalted(uint32_t(1) << lane, count - left[lane] + steps);
+        }
+        group &= ~m_Halting;
+        m_Halting = 0x0;
+
+        // the rest wait for the next group to pick them up
+        for(uint32_t l = group; l; l &= l - 1)
+        {
+            unsigned int lane = __builtin_ctz(l);
+
+            left[lane] -= steps;
+            if(left[lane])
+            {
+                waiting |= uint32_t(1) << lane;
+                m_Stops[m_PCounter[lane] & (CHIP8_MEMORY - 1)]++;
+            }
+        }
+    }
+
+    m_CycleCount += count;
+    m_TickCounter += count;
+
+    if(m_TickCounter >= m_InstructionsPerFrame)
+    {
+        // lanes that halted on the last instruction of the frame still see the timers tick,
+        // like Chip8Core::advanceGuestClock()
+        uint32_t ticking = ~m_Halted;
+        for(uint32_t l = m_ChunkHalted; l; l &= l - 1)
+        {
+            if(m_HaltCycle[__builtin_ctz(l)] == m_CycleCount) ticking |= l & -l;
+        }
+
+        m_TickCounter = 0;
+        m_FrameCount++;
+        tickTimers(ticking);
+
+        for(uint32_t l = ticking & m_ChunkHalted; l; l &= l - 1) m_HaltFrame[__builtin_ctz(l)] = m_FrameCount;
+    }
+}
+
+void LockstepBatch::spillLane(unsigned int lane, uint16_t regs)
+{
+    MachineState *state = m_Lanes[lane];
+
+    for(; regs; regs &= regs - 1) state->reg[__builtin_ctz(regs)] = m_Reg[__builtin_ctz(regs)][lane];
+    state->ireg = m_IReg[lane];
+    state->delay = m_DelayReg[lane];
+    state->sound = m_SoundReg[lane];
+    state->pc = m_PCounter[lane];
+}
+
+void LockstepBatch::reloadLane(unsigned int lane, uint16_t regs)
+{
+    const MachineState *state = m_Lanes[lane];
+
+    for(; regs; regs &= regs - 1) m_Reg[__builtin_ctz(regs)][lane] = state->reg[__builtin_ctz(regs)];
+    m_IReg[lane] = state->ireg;
+    m_DelayReg[lane] = state->delay;
+    m_SoundReg[lane] = state->sound;
+    m_PCounter[lane] = state->pc;
+}
+
+unsigned int LockstepBatch::runLane(unsigned int lane, unsigned int count)
+{
+    bool halted;
+    uint64_t written;
+
+    spillLane(lane, 0xffff);
+    unsigned int executed = m_Core->runState(m_Lanes[lane], count, m_Stops, &halted, &written);
+    reloadLane(lane, 0xffff);
+
+    m_LaneInstructions += executed;
+    m_Written |= written;
+    if(halted) m_Halting |= uint32_t(1) << lane;
+
+    return executed;
+}
+
+void LockstepBatch::stepLanes(uint32_t lanes, uint16_t opcode)
+{
+    uint16_t regs = instructionRegisters(opcode);
+    uint64_t written;
+
+    for(uint32_t l = lanes; l; l &= l - 1) spillLane(__builtin_ctz(l), regs);
+    m_Halting |= m_Core->stepStates(m_Lanes, lanes, opcode, &written);
+    for(uint32_t l = lanes; l; l &= l - 1) reloadLane(__builtin_ctz(l), regs);
+
+    m_LaneInstructions += __builtin_popcount(lanes);
+    m_Written |= written;
+}
+
+void LockstepBatch::retireHalted(uint32_t lanes, unsigned int executed)
+{
+    m_Halted |= lanes;
+    m_ChunkHalted |= lanes;
+
+    for(; lanes; lanes &= lanes - 1)
+    {
+        unsigned int lane = __builtin_ctz(lanes);
+
+        // executed counts instructions of the current chunk
+        m_HaltCycle[lane] = m_CycleCount + executed;
+        m_HaltFrame[lane] = m_FrameCount;
+    }
+}
+
+void LockstepBatch::tickTimers(uint32_t lanes)
+{
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+    {
+        if(!(lanes >> lane & 0x1)) continue;
+
+        if(m_DelayReg[lane] > 0) m_DelayReg[lane]--;
+        if(m_SoundReg[lane] > 0) m_SoundReg[lane]--;
+    }
+}
+
+unsigned int LockstepBatch::lowestLane(uint32_t lanes)
+{
+    if(m_UseAVX2) return lowestLaneAVX2(lanes);
+
+    unsigned int lowest = __builtin_ctz(lanes);
+    for(uint32_t l = lanes & (lanes - 1); l; l &= l - 1)
+    {
+        unsigned int lane = __builtin_ctz(l);
+        if(m_PCounter[lane] < m_PCounter[lowest]) lowest = lane;
+    }
+
+    return lowest;
+}
+
+uint32_t LockstepBatch::matchLanes(uint16_t pc, uint16_t opcode, uint32_t lanes)
+{
+    uint32_t match = 0x0;
+
+    if(m_UseAVX2) match = matchLanesAVX2(pc, lanes);
+    else
+    {
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+        {
+            if(m_PCounter[lane] == pc) match |= uint32_t(1) << lane;
+        }
+        match &= lanes;
+    }
+
+    // every lane has its own memory, if any lane wrote near here the opcode has to match as well
+    if(!(m_Written >> (pc / LOCKSTEP_BLOCK_SIZE) & 0x1)) return match;
+
+    uint32_t check = match;
+    while(check)
+    {
+        unsigned int lane = __builtin_ctz(check);
+        check &= check - 1;
+
+        if(fetch(lane, pc) != opcode) match &= ~(uint32_t(1) << lane);
+    }
+
+    return match;
+}
+
+bool LockstepBatch::executeGroup(uint32_t lanes, uint16_t opcode)
+{
+    if(m_UseAVX2) return executeGroupAVX2(lanes, opcode);
+
+    // without avx2 every lane runs the opcode on its own
+    return false;
+}
+
+bool LockstepBatch::drawLanes(uint32_t lanes, uint16_t opcode)
+{
+    uint8_t x = OP_X(opcode);
+    uint8_t y = OP_Y(opcode);
+    uint8_t height = OP_N(opcode);
+
+    // Dxy0, wrapping and anything but lores on the first plane go through the core
+    if(!height || (quirkFlags(m_Profile) & QUIRK_WRAP)) return false;
+    for(uint32_t l = lanes; l; l &= l - 1)
+    {
+        const MachineState *state = m_Lanes[__builtin_ctz(l)];
+        if(state->hires || state->planes != 0x1) return false;
+    }
+
+    // the lores case of Chip8Core::drawSprite(), registers straight from the vectors
+    for(; lanes; lanes &= lanes - 1)
+    {
+        unsigned int lane = __builtin_ctz(lanes);
+        MachineState *state = m_Lanes[lane];
+        uint8_t px = m_Reg[x][lane];
+        uint8_t py = m_Reg[y][lane];
+        uint64_t collision = 0x0;
+
+        // sprites starting off screen are not drawn, rows past the bottom are clipped
+        if(px < LORES_WIDTH && py < LORES_HEIGHT)
+        {
+            unsigned int rows = std::min(unsigned(height), unsigned(LORES_HEIGHT - py));
+
+            for(unsigned int ny = 0; ny < rows; ny++)
+            {
+                uint64_t bits = (uint64_t(state->mem[(m_IReg[lane] + ny) & (CHIP8_MEMORY - 1)]) << 56) >> px;
+                uint64_t &row = state->display[0][py + ny][0];
+
+                collision |= row & bits;
+                row ^= bits;
+            }
+        }
+
+        m_Reg[0xf][lane] = collision != 0;
+        m_PCounter[lane] += 2;
+    }
+
+    return true;
+}
+
+#ifdef LOCKSTEP_AVX2
+
+// one register of every lane
+#define LOAD_LANES(ptr) _mm256_loadu_si256((const __m256i*)(ptr))
+#define STORE_LANES(ptr, v) _mm256_storeu_si256((__m256i*)(ptr), v)
+// write v to the lanes in mask, keep the others
+#define BLEND_LANES(ptr, v, mask) STORE_LANES(ptr, _mm256_blendv_epi8(LOAD_LANES(ptr), v, mask))
+// lane bit mask to a 16-bit element mask for lanes 0-15 (shift 0) or 16-31 (shift 16)
+#define LANE_MASK16(lanes, shift) _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16(int16_t((lanes) >> (shift))), bits16), bits16)
+// unsigned a > b per byte
+#define GT_LANES(a, b) _mm256_cmpgt_epi8(_mm256_xor_si256(a, _mm256_set1_epi8(-128)), _mm256_xor_si256(b, _mm256_set1_epi8(-128)))
+
+__attribute__((target("avx2")))
+uint32_t LockstepBatch::matchLanesAVX2(uint16_t pc, uint32_t lanes)
+{
+    __m256i p = _mm256_set1_epi16(pc);
+    __m256i lo = _mm256_cmpeq_epi16(LOAD_LANES(&m_PCounter[0]), p);
+    __m256i hi = _mm256_cmpeq_epi16(LOAD_LANES(&m_PCounter[16]), p);
+
+    // pack the 16-bit compares to bytes, packs works per 128-bit half so put the halves back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), _MM_SHUFFLE(3,1,2,0));
+
+    return uint32_t(_mm256_movemask_epi8(packed)) & lanes;
+}
+
+__attribute__((target("avx2")))
+unsigned int LockstepBatch::lowestLaneAVX2(uint32_t lanes)
+{
+    const __m256i bits16 = _mm256_setr_epi16(0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80, 0x100, 0x200, 0x400, 0x800,
+                                             0x1000, 0x2000, 0x4000, int16_t(0x8000));
+
+    // lanes outside the set read as 0xffff, past any program counter
+    __m256i lo = _mm256_or_si256(LOAD_LANES(&m_PCounter[0]), _mm256_andnot_si256(LANE_MASK16(lanes, 0), _mm256_set1_epi16(-1)));
+    __m256i hi = _mm256_or_si256(LOAD_LANES(&m_PCounter[16]), _mm256_andnot_si256(LANE_MASK16(lanes, 16), _mm256_set1_epi16(-1)));
+
+    __m256i low = _mm256_min_epu16(lo, hi);
+    __m128i pcs = _mm_min_epu16(_mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1));
+    uint16_t pc = _mm_cvtsi128_si32(_mm_minpos_epu16(pcs));
+
+    return __builtin_ctz(matchLanesAVX2(pc, lanes));
+}
+
+__attribute__((target("avx2")))
+bool LockstepBatch::executeGroupAVX2(uint32_t lanes, uint16_t opcode)
+{
+    uint8_t x = OP_X(opcode);
+    uint8_t y = OP_Y(opcode);
+    uint8_t kk = OP_KK(opcode);
+
+    // lane bit mask to a byte mask, byte n is 0xff if bit n is set
+    __m256i mask = _mm256_shuffle_epi8(_mm256_set1_epi32(lanes),
+                                       _mm256_setr_epi8(0,0,0,0,0,0,0,0, 1,1,1,1,1,1,1,1, 2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3));
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201LL);
+    mask = _mm256_cmpeq_epi8(_mm256_and_si256(mask, bits), bits);
+
+    const __m256i bits16 = _mm256_setr_epi16(0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80, 0x100, 0x200, 0x400, 0x800,
+                                             0x1000, 0x2000, 0x4000, int16_t(0x8000));
+
+    const __m256i one = _mm256_set1_epi8(1);
+    __m256i vx = LOAD_LANES(m_Reg[x]);
+    __m256i vy = LOAD_LANES(m_Reg[y]);
+    __m256i flag;
+
+    // lanes whose skip condition holds
+    uint32_t skip = 0x0;
+
+    switch(opcode >> 12)
+    {
+    case 0x1:
+        BLEND_LANES(&m_PCounter[0], _mm256_set1_epi16(OP_NNN(opcode)), LANE_MASK16(lanes, 0));
+        BLEND_LANES(&m_PCounter[16], _mm256_set1_epi16(OP_NNN(opcode)), LANE_MASK16(lanes, 16));
+        return true;
+    case 0x3:
+        skip = _mm256_movemask_epi8(_mm256_cmpeq_epi8(vx, _mm256_set1_epi8(kk)));
+        break;
+    case 0x4:
+        skip = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(vx, _mm256_set1_epi8(kk)));
+        break;
+    case 0x5:
+        skip = _mm256_movemask_epi8(_mm256_cmpeq_epi8(vx, vy));
+        break;
+    case 0x6:
+        BLEND_LANES(m_Reg[x], _mm256_set1_epi8(kk), mask);
+        break;
+    case 0x7:
+        BLEND_LANES(m_Reg[x], _mm256_add_epi8(vx, _mm256_set1_epi8(kk)), mask);
+        break;
+    case 0x8:
+        // flag is written before vx like processInstruction(), so x or y being vf reads the new flag
+        switch(OP_N(opcode))
+        {
+        case 0x0: BLEND_LANES(m_Reg[x], vy, mask); break;
+        case 0x1: BLEND_LANES(m_Reg[x], _mm256_or_si256(vx, vy), mask); break;
+        case 0x2: BLEND_LANES(m_Reg[x], _mm256_and_si256(vx, vy), mask); break;
+        case 0x3: BLEND_LANES(m_Reg[x], _mm256_xor_si256(vx, vy), mask); break;
+        case 0x4:
+        {
+            // carry if vy > 255 - vx
+            __m256i result = _mm256_add_epi8(vx, vy);
+            flag = _mm256_and_si256(GT_LANES(vy, _mm256_xor_si256(vx, _mm256_set1_epi8(-1))), one);
+            BLEND_LANES(m_Reg[0xf], flag, mask);
+            BLEND_LANES(m_Reg[x], result, mask);
+            break;
+        }
+        case 0x5:
+            flag = _mm256_and_si256(GT_LANES(vx, vy), one);
+            BLEND_LANES(m_Reg[0xf], flag, mask);
+            vx = LOAD_LANES(m_Reg[x]);
+            vy = LOAD_LANES(m_Reg[y]);
+            BLEND_LANES(m_Reg[x], _mm256_sub_epi8(vx, vy), mask);
+            break;
+        case 0x6:
+            flag = _mm256_and_si256(vx, one);
+            BLEND_LANES(m_Reg[0xf], flag, mask);
+            vx = LOAD_LANES(m_Reg[x]);
+            // no 8-bit shifts, shift 16-bit and drop the bit shifted in from the next byte
+            BLEND_LANES(m_Reg[x], _mm256_and_si256(_mm256_srli_epi16(vx, 1), _mm256_set1_epi8(0x7f)), mask);
+            break;
+        case 0x7:
+            flag = _mm256_and_si256(GT_LANES(vy, vx), one);
+            BLEND_LANES(m_Reg[0xf], flag, mask);
+            vx = LOAD_LANES(m_Reg[x]);
+            vy = LOAD_LANES(m_Reg[y]);
+            BLEND_LANES(m_Reg[x], _mm256_sub_epi8(vy, vx), mask);
+            break;
+        case 0xe:
+            flag = _mm256_and_si256(_mm256_srli_epi16(vx, 7), one);
+            BLEND_LANES(m_Reg[0xf], flag, mask);
+            vx = LOAD_LANES(m_Reg[x]);
+            BLEND_LANES(m_Reg[x], _mm256_add_epi8(vx, vx), mask);
+            break;
+        default:
+            break;
+        }
+        break;
+    case 0x9:
+        if(OP_N(opcode) == 0x0) skip = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(vx, vy));
+        break;
+    case 0xd:
+        return drawLanes(lanes, opcode);
+    case 0xe:
+    {
+        // the core shifts the keypad by vx, lanes with a vx past the last key run through it
+        if(_mm256_movemask_epi8(_mm256_and_si256(GT_LANES(vx, _mm256_set1_epi8(0xf)), mask))) return false;
+
+        // 1 << (vx & 7) tested against the low or the high byte of the keys, bit 3 of vx picks the byte
+        const __m256i keybits = _mm256_setr_epi8(1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128,
+                                                 1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128);
+        __m256i bit = _mm256_shuffle_epi8(keybits, vx);
+        __m256i keys = _mm256_blendv_epi8(LOAD_LANES(m_Keys[0]), LOAD_LANES(m_Keys[1]), _mm256_slli_epi16(vx, 4));
+        uint32_t pressed = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(keys, bit), bit));
+
+        if(kk == 0x9e) skip = pressed;
+        else if(kk == 0xa1) skip = ~pressed;
+        else return false;
+        break;
+    }
+    case 0xa:
+        BLEND_LANES(&m_IReg[0], _mm256_set1_epi16(OP_NNN(opcode)), LANE_MASK16(lanes, 0));
+        BLEND_LANES(&m_IReg[16], _mm256_set1_epi16(OP_NNN(opcode)), LANE_MASK16(lanes, 16));
+        break;
+    case 0xf:
+        if(kk == 0x07) BLEND_LANES(m_Reg[x], LOAD_LANES(m_DelayReg), mask);
+        else if(kk == 0x15) BLEND_LANES(m_DelayReg, vx, mask);
+        else if(kk == 0x18) BLEND_LANES(m_SoundReg, vx, mask);
+        else return false;
+        break;
+    default:
+        // memory, stack and display opcodes run per lane
+        return false;
+    }
+
+    // advance the program counters, skipping lanes move one more instruction
+    for(int half = 0; half < LOCKSTEP_LANES; half += 16)
+    {
+        __m256i pc = LOAD_LANES(&m_PCounter[half]);
+        __m256i skipped = LANE_MASK16(skip, half);
+
+        // the skip mask is -1, subtracting it twice adds 2
+        __m256i next = _mm256_sub_epi16(_mm256_add_epi16(pc, _mm256_set1_epi16(2)), _mm256_add_epi16(skipped, skipped));
+        STORE_LANES(&m_PCounter[half], _mm256_blendv_epi8(pc, next, LANE_MASK16(lanes, half)));
+    }
+
+    return true;
+}
+
+#else
+
+uint32_t LockstepBatch::matchLanesAVX2(uint16_t pc, uint32_t lanes)
+{
+    return 0x0;
+}
+
+unsigned int LockstepBatch::lowestLaneAVX2(uint32_t lanes)
+{
+    return 0;
+}
+
+bool LockstepBatch::executeGroupAVX2(uint32_t lanes, uint16_t opcode)
+{
+    return false;
+}
+
+#endif // LOCKSTEP_AVX2
@@ -0,0 +1,139 @@
+#ifndef CLASS_LOCKSTEP
+#define CLASS_LOCKSTEP
+
+#include <string>
+
+#include "chip8core.hpp"
+
+// machines in a lockstep batch, one AVX2 register of 8-bit lanes
+#define LOCKSTEP_LANES 32
+
+// many copies of one rom in structure-of-arrays form, for search and training workloads
+// lanes at the same program counter with the same opcode run it together (with AVX2 when the
+// host has it), a group that diverges splits and the lanes furthest back in the program run first,
+// so lanes that took different branches meet again and regroup wherever their paths join
+// opcodes the groups do not run themselves, and lanes on their own, go through the Chip8Core handlers,
+// so the semantics are those of the core for the QUIRKS_MODERN and QUIRKS_SCHIP profiles
+class LockstepBatch
+{
+private:
+
+    // memory, stack, display, keys and rng of each lane, the registers below are the live ones
+    MachineState *m_Lanes[LOCKSTEP_LANES];
+    // the handlers lanes run through when they are not in a group
+    Chip8Core *m_Core;
+    QUIRK_PROFILE m_QuirkMode;
+    uint8_t m_Profile;
+
+    // registers, indexed [register][lane] so a register of all lanes is one vector
+    uint8_t m_Reg[MAX_REGISTERS][LOCKSTEP_LANES];
+    uint16_t m_IReg[LOCKSTEP_LANES];
+    uint8_t m_DelayReg[LOCKSTEP_LANES];
+    uint8_t m_SoundReg[LOCKSTEP_LANES];
+    uint16_t m_PCounter[LOCKSTEP_LANES];
+    // copy of each lane's keypad, low byte then high byte, for the group key skips
+    uint8_t m_Keys[2][LOCKSTEP_LANES];
+
+    // dirty blocks a lane wrote since the rom was loaded, lanes can hold different opcodes there
+    uint64_t m_Written;
+    // lanes waiting at each address while another group runs, a group stops when it gets to one
+    uint8_t m_Stops[CHIP8_MEMORY];
+
+    // one bit per lane, halted lanes are skipped
+    uint32_t m_Halted;
+    // lanes that halted in the instruction just run, the instruction still counts
+    uint32_t m_Halting;
+    // lanes that halted in the current chunk
+    uint32_t m_ChunkHalted;
+    // instructions and timer frames a lane ran before it halted
+    uint64_t m_HaltCycle[LOCKSTEP_LANES];
+    uint64_t m_HaltFrame[LOCKSTEP_LANES];
+
+    // guest clock, every running lane executes the same number of instructions between timer ticks
+    unsigned int m_InstructionsPerFrame;
+    unsigned int m_TickCounter;
+    uint64_t m_CycleCount;
+    uint64_t m_FrameCount;
+
+    // instructions run by a group of lanes at once and by single lanes
+    uint64_t m_GroupInstructions;
+    uint64_t m_LaneInstructions;
+
+    // host supports avx2
+    bool m_UseAVX2;
+
+    uint16_t fetch(unsigned int lane, uint16_t addr) { return m_Lanes[lane]->mem[addr] << 8 | m_Lanes[lane]->mem[addr + 1];}
+    // a lane's registers to and from its MachineState around running it through m_Core,
+    // regs has a bit for each of v0-vf to copy, I, the pc and the timers always are
+    void spillLane(unsigned int lane, uint16_t regs);
+    void reloadLane(unsigned int lane, uint16_t regs);
+    // runs up to count instructions of a lane on its own, stopping where other lanes wait, returns the instructions run
+    unsigned int runLane(unsigned int lane, unsigned int count);
+    // one instruction the group can not run as a vector, through the core handler for each lane
+    void stepLanes(uint32_t lanes, uint16_t opcode);
+    uint32_t matchLanes(uint16_t pc, uint16_t opcode, uint32_t lanes);
+    unsigned int lowestLane(uint32_t lanes);
+    void runChunk(unsigned int count);
+    void retireHalted(uint32_t lanes, unsigned int executed);
+    void tickTimers(uint32_t lanes);
+    bool executeGroup(uint32_t lanes, uint16_t opcode);
+    // Dxyn of a group in lores on the first plane, false for the core to draw it
+    bool drawLanes(uint32_t lanes, uint16_t opcode);
+    bool executeGroupAVX2(uint32_t lanes, uint16_t opcode);
+    uint32_t matchLanesAVX2(uint16_t pc, uint32_t lanes);
+    unsigned int lowestLaneAVX2(uint32_t lanes);
+
+public:
+    LockstepBatch();
+    ~LockstepBatch();
+
+    // every lane starts from the same memory image, the rom is loaded into all of them
+    void reset();
+    // false if the file is missing, does not fit or needs a profile the batch does not run
+    bool loadRom(std::string filename, uint16_t addr = 0x200);
+    void loadProgram(const uint8_t *data, unsigned int size, uint16_t addr = 0x200);
+
+    // group instructions follow the modern profile, super-chip only differs in instructions lanes run on their own
+    static bool supportsQuirks(QUIRK_PROFILE profile) { return profile == QUIRKS_MODERN || profile == QUIRKS_SCHIP;}
+    // QUIRKS_AUTO (the default) picks the profile from the rom, false for a profile the batch does not run
+    bool setQuirks(QUIRK_PROFILE profile);
+    // the profile lanes run, or the one detected for the last rom even if it could not be run
+    QUIRK_PROFILE getQuirks() { return QUIRK_PROFILE(m_Profile);}
+
+    void setCPUFrequency(unsigned int hz);
+    void setAVX2(bool enable);
+    bool getAVX2() { return m_UseAVX2;}
+
+    // per lane input and rng seed
+    void setKeyState(unsigned int lane, uint16_t keypressed)
+    {
+        m_Lanes[lane]->keys = keypressed;
+        m_Keys[0][lane] = keypressed & 0xff;
+        m_Keys[1][lane] = keypressed >> 8;
+    }
+    void setSeed(unsigned int lane, uint32_t seed) { m_Lanes[lane]->rng = seed ? seed : 1;}
+
+    // run every lane for count instructions or frames or until all halted, returns the instructions run per lane
+    uint64_t runCycles(uint64_t count);
+    uint64_t runFrames(uint64_t frames);
+
+    uint32_t getHaltedLanes() { return m_Halted;}
+    bool allHalted() { return m_Halted == 0xffffffff;}
+    uint64_t getCycleCount(unsigned int lane) { return (m_Halted >> lane & 0x1) ? m_HaltCycle[lane] : m_CycleCount;}
+    uint64_t getFrameCount(unsigned int lane) { return (m_Halted >> lane & 0x1) ? m_HaltFrame[lane] : m_FrameCount;}
+    uint64_t getGroupInstructions() { return m_GroupInstructions;}
+    uint64_t getLaneInstructions() { return m_LaneInstructions;}
+
+    // lane state
+    uint16_t getProgramCounter(unsigned int lane) { return m_PCounter[lane];}
+    uint8_t getRegister(unsigned int lane, unsigned int reg) { return m_Reg[reg][lane];}
+    uint16_t getIRegister(unsigned int lane) { return m_IReg[lane];}
+    uint8_t getDelayRegister(unsigned int lane) { return m_DelayReg[lane];}
+    uint8_t getSoundRegister(unsigned int lane) { return m_SoundReg[lane];}
+    uint8_t getMemAt(unsigned int lane, uint16_t addr) { return m_Lanes[lane]->mem[addr & (CHIP8_MEMORY - 1)];}
+    bool isHires(unsigned int lane) { return m_Lanes[lane]->hires;}
+    // packed rows of the lane's display, see MachineState::display
+    const uint64_t *getDisplayRows(unsigned int lane) { return m_Lanes[lane]->display[0][0];}
+    bool getPixel(unsigned int lane, unsigned int x, unsigned int y) { return (m_Lanes[lane]->display[0][y][x >> 6] >> (63 - (x & 63))) & 0x1;}
+};
+#endif // CLASS_LOCKSTEP
@@ -1,18 +1,393 @@
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
+#include <fstream>
 
 #include "chip8.hpp"
+#include "batch.hpp"
+#include "lockstep.hpp"
+#include "disasm.hpp"
 
+void printUsage(const char *exe)
+{
+    std::cout << "Usage: " << exe << " [options]\n";
+    std::cout << "  --rom FILE            rom to run (default pong.rom)\n";
+    std::cout << "  --headless            run without a render window\n";
+    std::cout << "  --cycles N            stop after N instructions\n";
+    std::cout << "  --frames N            stop after N guest frames (60Hz timer ticks)\n";
+    std::cout << "  --hz N|unlimited      cpu speed, unlimited runs as fast as the host allows (default 540)\n";
+    std::cout << "  --engine NAME         interpreter, table, goto, threaded or jit (default goto)\n";
+    std::cout << "  --quirks NAME         auto, modern, vip, schip or xochip instruction behaviour (default auto, from the rom)\n";
+    std::cout << "  --pacing MODE         vsync, onchange or a fixed present rate in Hz (default vsync)\n";
+    std::cout << "  --seed N              rng seed, fixed seeds make runs repeatable (batch default 1)\n";
+    std::cout << "  --record FILE         record every input to FILE for a bit exact replay\n";
+    std::cout << "  --replay FILE         replay a recorded session headless as fast as possible\n";
+    std::cout << "  --rewind              keep the last 60 seconds to rewind through with backspace (default on unless --hz unlimited)\n";
+    std::cout << "  --no-rewind           do not keep anything to rewind through\n";
+    std::cout << "  --mute                do not play the buzzer\n";
+    std::cout << "  --state FILE          resume from a save state written with F5\n";
+    std::cout << "  --profile FILE        count executions and memory accesses, write a report to FILE on exit\n";
+    std::cout << "  --latency             time key presses until they show on screen, print percentiles on exit\n";
+    std::cout << "  --asm FILE            disassemble the rom to FILE before running\n";
+    std::cout << "  --asm-verbose FILE    disassemble the rom with addresses and opcodes to FILE\n";
+    std::cout << "  --asm-dir DIR         disassemble every .rom and .ch8 in DIR to DIR/<name>.asm and exit\n";
+    std::cout << "  --asm-dir-verbose DIR same with addresses and opcodes\n";
+    std::cout << "  --batch FILE          run every rom listed in FILE headless and print their final state\n";
+    std::cout << "  --pack FILE           pack every rom listed in --batch into archive FILE and exit\n";
+    std::cout << "  --archive FILE        run every rom in archive FILE headless like --batch\n";
+    std::cout << "  --lockstep            run copies of --rom with different rng seeds in one simd lockstep batch\n";
+    std::cout << "  --threads N           batch worker threads (default one per core)\n";
+    std::cout << "  --out FILE            write batch results to FILE instead of the console, or --asm-dir output to directory FILE\n";
+    std::cout << "  --help                show this message\n";
+}
+
+bool parseNumber(const char *str, uint64_t *val)
+{
+    char *end = NULL;
+    unsigned long long n = strtoull(str, &end, 10);
 
+    if(end == str || *end != '\0') return false;
+
+    *val = n;
+    return true;
+}
 
 int main(int argc, char *argv[])
 {
-    Chip8 chip8;
-    chip8.disassembleRomToASM("pong.rom", "pong.asm");
-    chip8.disassembleRomToASM("pong.rom", "pong_verbose.asm", true);
-    chip8.loadRom("pong.rom");
-    //chip8.disableRender();
-    chip8.start();
+    std::string romfile = "pong.rom";
+    std::string asmfile;
+    std::string verboseasmfile;
+    std::string asmdir;
+    bool asmdirverbose = false;
+    std::string statefile;
+    bool headless = false;
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    unsigned int hz = CPU_FREQUENCY;
+    DISPATCH_MODE engine = DISPATCH_GOTO;
+    QUIRK_PROFILE quirks = QUIRKS_AUTO;
+    PACING_MODE pacing = PACING_VSYNC;
+    unsigned int pacinghz = TIMER_FREQUENCY;
+    std::string batchfile;
+    std::string packfile;
+    std::string archivefile;
+    std::string outfile;
+    uint64_t threads = 0;
+    bool lockstep = false;
+    // on by default except at unlimited speed
+    int rewind = -1;
+    uint64_t seed = 0;
+    bool hasseed = false;
+    std::string recordfile;
+    std::string replayfile;
+    std::string profilefile;
+    bool latency = false;
+    bool mute = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        // every option except the flags takes a value
+        bool hasvalue = (i + 1 < argc);
+
+        if(arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else if(arg == "--headless") headless = true;
+        else if(arg == "--lockstep") lockstep = true;
+        else if(arg == "--rewind") rewind = 1;
+        else if(arg == "--no-rewind") rewind = 0;
+        else if(arg == "--latency") latency = true;
+        else if(arg == "--mute") mute = true;
+        else if(arg == "--rom" && hasvalue) romfile = argv[++i];
+        else if(arg == "--state" && hasvalue) statefile = argv[++i];
+        else if(arg == "--record" && hasvalue) recordfile = argv[++i];
+        else if(arg == "--replay" && hasvalue) replayfile = argv[++i];
+        else if(arg == "--profile" && hasvalue) profilefile = argv[++i];
+        else if(arg == "--seed" && hasvalue && parseNumber(argv[i+1], &seed))
+        {
+            hasseed = true;
+            i++;
+        }
+        else if(arg == "--asm" && hasvalue) asmfile = argv[++i];
+        else if(arg == "--asm-verbose" && hasvalue) verboseasmfile = argv[++i];
+        else if(arg == "--asm-dir" && hasvalue) asmdir = argv[++i];
+        else if(arg == "--asm-dir-verbose" && hasvalue)
+        {
+            asmdir = argv[++i];
+            asmdirverbose = true;
+        }
+        else if(arg == "--batch" && hasvalue) batchfile = argv[++i];
+        else if(arg == "--pack" && hasvalue) packfile = argv[++i];
+        else if(arg == "--archive" && hasvalue) archivefile = argv[++i];
+        else if(arg == "--out" && hasvalue) outfile = argv[++i];
+        else if(arg == "--threads" && hasvalue && parseNumber(argv[i+1], &threads)) i++;
+        else if(arg == "--cycles" && hasvalue && parseNumber(argv[i+1], &cycles)) i++;
+        else if(arg == "--frames" && hasvalue && parseNumber(argv[i+1], &frames)) i++;
+        else if(arg == "--hz" && hasvalue)
+        {
+            uint64_t val;
+            std::string hzarg = argv[++i];
+
+            if(hzarg == "unlimited") hz = 0;
+            else if(parseNumber(hzarg.c_str(), &val) && val > 0) hz = val;
+            else
+            {
+                std::cout << "Invalid --hz value: " << hzarg << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--engine" && hasvalue)
+        {
+            std::string name = argv[++i];
+
+            if(name == "interpreter") engine = DISPATCH_INTERPRETER;
+            else if(name == "table") engine = DISPATCH_TABLE;
+            else if(name == "goto") engine = DISPATCH_GOTO;
+            else if(name == "threaded") engine = DISPATCH_THREADED;
+            else if(name == "jit") engine = DISPATCH_JIT;
+            else
+            {
+                std::cout << "Unknown engine: " << name << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--quirks" && hasvalue)
+        {
+            std::string name = argv[++i];
+
+            if(name == "auto") quirks = QUIRKS_AUTO;
+            else if(name == "modern") quirks = QUIRKS_MODERN;
+            else if(name == "vip") quirks = QUIRKS_VIP;
+            else if(name == "schip") quirks = QUIRKS_SCHIP;
+            else if(name == "xochip") quirks = QUIRKS_XOCHIP;
+            else
+            {
+                std::cout << "Unknown quirks: " << name << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--pacing" && hasvalue)
+        {
+            uint64_t val;
+            std::string mode = argv[++i];
+
+            if(mode == "vsync") pacing = PACING_VSYNC;
+            else if(mode == "onchange") pacing = PACING_ON_CHANGE;
+            else if(parseNumber(mode.c_str(), &val) && val > 0)
+            {
+                pacing = PACING_FIXED;
+                pacinghz = val;
+            }
+            else
+            {
+                std::cout << "Invalid --pacing value: " << mode << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cout << "Invalid argument: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(!asmdir.empty())
+    {
+        sf::Clock runclock;
+        unsigned int written = disassembleDirectory(asmdir, outfile.empty() ? asmdir : outfile, asmdirverbose, threads);
+
+        std::cout << "Disassembled " << written << " roms in " << runclock.getElapsedTime().asSeconds() << "s" << std::endl;
+
+        return 0;
+    }
+
+    if(!packfile.empty())
+    {
+        std::vector<std::string> roms;
+
+        if(batchfile.empty() || !readRomList(batchfile, &roms))
+        {
+            std::cout << "Error reading rom list:" << batchfile << std::endl;
+            return 1;
+        }
+
+        if(!RomArchive::pack(packfile, roms)) return 1;
+
+        std::cout << "Packed " << roms.size() << " roms into " << packfile << std::endl;
+
+        return 0;
+    }
+
+    if(!batchfile.empty() || !archivefile.empty() || lockstep)
+    {
+        BatchOptions options;
+        options.engine = engine;
+        options.quirks = quirks;
+        options.hz = hz;
+        options.cycles = cycles;
+        options.frames = frames;
+        options.threads = threads;
+        options.seed = hasseed ? seed : BATCH_DEFAULT_SEED;
+
+        std::vector<std::string> roms;
+        std::vector<BatchResult> results;
+        sf::Clock runclock;
+
+        if(lockstep)
+        {
+            roms.push_back(romfile);
+
+            // group instructions only follow the modern and super-chip profiles
+            if(quirks != QUIRKS_AUTO && !LockstepBatch::supportsQuirks(quirks))
+            {
+                std::cout << "Lockstep only runs the modern and schip quirks" << std::endl;
+                return 1;
+            }
+
+            if(!runLockstep(romfile, options, &results))
+            {
+                std::cout << "Error loading rom file:" << romfile << std::endl;
+                return 1;
+            }
+        }
+        else if(!archivefile.empty())
+        {
+            RomArchive archive;
+
+            if(!archive.open(archivefile))
+            {
+                std::cout << "Error loading rom archive:" << archivefile << std::endl;
+                return 1;
+            }
+
+            runBatch(archive, options, &results);
+        }
+        else
+        {
+            if(!readRomList(batchfile, &roms))
+            {
+                std::cout << "Error reading rom list:" << batchfile << std::endl;
+                return 1;
+            }
+
+            runBatch(roms, options, &results);
+        }
+
+        double elapsed = runclock.getElapsedTime().asSeconds();
+
+        uint64_t total = 0;
+        for(unsigned int i = 0; i < results.size(); i++) total += results[i].cycles;
+
+        if(outfile.empty()) printBatchResults(results, std::cout);
+        else
+        {
+            std::ofstream ofile(outfile.c_str());
+
+            if(!ofile.is_open())
+            {
+                std::cout << "Error opening file for writing:" << outfile << std::endl;
+                return 1;
+            }
+            printBatchResults(results, ofile);
+        }
+
+        std::cout << "Ran " << results.size() << " machines, " << total << " instructions in " << elapsed << "s";
+        if(elapsed > 0) std::cout << ", " << uint64_t(total / elapsed) << " instructions/sec";
+        std::cout << std::endl;
+
+        return 0;
+    }
+
+    // the machine's caches cover the whole 64K address space, keep it off the stack
+    Chip8 *chip8 = new Chip8;
+
+    if(!replayfile.empty())
+    {
+        chip8->disableRender();
+        chip8->setDispatchMode(engine);
+
+        if(!chip8->startReplay(replayfile))
+        {
+            std::cout << "Error loading input log:" << replayfile << std::endl;
+            delete chip8;
+            return 1;
+        }
+
+        sf::Clock runclock;
+        uint64_t total = chip8->replay();
+        double elapsed = runclock.getElapsedTime().asSeconds();
+
+        std::cout << "Replayed " << total << " instructions in " << elapsed << "s";
+        if(elapsed > 0) std::cout << ", " << uint64_t(total / elapsed) << " instructions/sec";
+        std::cout << ", state hash " << std::hex << chip8->hashState() << std::dec << std::endl;
+
+        delete chip8;
+        return 0;
+    }
+
+    if(hasseed) chip8->setSeed(seed);
+
+    if(!asmfile.empty()) chip8->disassembleRomToASM(romfile, asmfile);
+    if(!verboseasmfile.empty()) chip8->disassembleRomToASM(romfile, verboseasmfile, true);
+
+    chip8->setQuirks(quirks);
+
+    if(!chip8->loadRom(romfile))
+    {
+        std::cout << "Error loading rom file:" << romfile << std::endl;
+        delete chip8;
+        return 1;
+    }
+
+    // a state replaces the whole machine, the rom still has to match it
+    if(!statefile.empty() && !chip8->loadStateFile(statefile))
+    {
+        std::cout << "Error loading state file:" << statefile << std::endl;
+        delete chip8;
+        return 1;
+    }
+
+    chip8->setDispatchMode(engine);
+    chip8->setCPUFrequency(hz);
+    chip8->setCycleLimit(cycles);
+    chip8->setFrameLimit(frames);
+    chip8->setFramePacing(pacing, pacinghz);
+    if(headless) chip8->disableRender();
+    else
+    {
+        if(rewind > 0 || (rewind < 0 && hz)) chip8->setRewind(true);
+        if(mute) chip8->disableAudio();
+        // labels in the debug overlay
+        chip8->loadCodeMap(romfile);
+    }
+
+    if(!recordfile.empty() && !chip8->startRecording(recordfile))
+    {
+        std::cout << "Error opening file for writing:" << recordfile << std::endl;
+        delete chip8;
+        return 1;
+    }
+
+    if(!profilefile.empty()) chip8->setProfiling(true);
+    if(latency) chip8->setLatencyTracking(true);
+
+    chip8->start();
+
+    if(!profilefile.empty())
+    {
+        if(!chip8->writeProfile(profilefile))
+        {
+            std::cout << "Error opening file for writing:" << profilefile << std::endl;
+            delete chip8;
+            return 1;
+        }
+        std::cout << "Wrote profile to " << profilefile << ".\n";
+    }
 
+    delete chip8;
     return 0;
 }
@@ -0,0 +1,152 @@
+#include "profiler.hpp"
+
+#include <string.h>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+// opcode classes in OPCODE_ID order
+static const char *s_OpNames[OPID_COUNT] = {
+    "???? UNK", "00E0 CLS", "00EE RET", "1nnn JP", "2nnn CALL", "3xkk SE", "4xkk SNE", "5xy0 SE",
+    "6xkk LD", "7xkk ADD", "8xy0 LD", "8xy1 OR", "8xy2 AND", "8xy3 XOR", "8xy4 ADD", "8xy5 SUB",
+    "8xy6 SHR", "8xy7 SUBN", "8xyE SHL", "9xy0 SNE", "Annn LD I", "Bnnn JP V0", "Cxkk RND", "Dxyn DRW",
+    "Ex9E SKP", "ExA1 SKNP", "Fx07 LD DT", "Fx0A LD K", "Fx15 LD DT", "Fx18 LD ST", "Fx1E ADD I", "Fx29 LD F",
+    "Fx33 LD B", "Fx55 LD [I]", "Fx65 LD Vx", "00Cn SCD", "00Dn SCU", "00FB SCR", "00FC SCL", "00FD EXIT",
+    "00FE LOW", "00FF HIGH", "Fx30 LD HF", "Fn01 PLANE", "F000 LD I"
+};
+
+// bit length, a cheap log2 for the heatmap
+static unsigned int bitLength(uint64_t val)
+{
+    return val ? 64 - __builtin_clzll(val) : 0;
+}
+
+// indices of the count largest values, highest first, ties go to the lower index
+static std::vector<unsigned int> topEntries(const uint64_t *vals, unsigned int size, unsigned int count)
+{
+    std::vector<unsigned int> idx;
+
+    for(unsigned int i = 0; i < size; i++)
+    {
+        if(vals[i]) idx.push_back(i);
+    }
+
+    count = std::min(count, (unsigned int)idx.size());
+    std::partial_sort(idx.begin(), idx.begin() + count, idx.end(), [vals](unsigned int a, unsigned int b)
+    {
+        return vals[a] > vals[b] || (vals[a] == vals[b] && a < b);
+    });
+    idx.resize(count);
+
+    return idx;
+}
+
+Profiler::Profiler()
+{
+    clear();
+}
+
+void Profiler::clear()
+{
+    memset(m_Ops, 0, sizeof(m_Ops));
+    memset(m_Exec, 0, sizeof(m_Exec));
+    memset(m_Reads, 0, sizeof(m_Reads));
+    memset(m_Writes, 0, sizeof(m_Writes));
+    memset(m_Calls, 0, sizeof(m_Calls));
+    memset(m_MaxDepth, 0, sizeof(m_MaxDepth));
+    memset(m_Depths, 0, sizeof(m_Depths));
+    m_Instructions = 0;
+}
+
+void Profiler::getHeatmap(uint8_t *heat, unsigned int len)
+{
+    // scale each channel to its own busiest address
+    unsigned int maxexec = 1;
+    unsigned int maxread = 1;
+    unsigned int maxwrite = 1;
+
+    for(unsigned int i = 0; i < len; i++)
+    {
+        maxexec = std::max(maxexec, bitLength(m_Exec[i]));
+        maxread = std::max(maxread, bitLength(m_Reads[i]));
+        maxwrite = std::max(maxwrite, bitLength(m_Writes[i]));
+    }
+
+    for(unsigned int i = 0; i < len; i++)
+    {
+        heat[i*3] = bitLength(m_Exec[i]) * 255 / maxexec;
+        heat[i*3+1] = bitLength(m_Reads[i]) * 255 / maxread;
+        heat[i*3+2] = bitLength(m_Writes[i]) * 255 / maxwrite;
+    }
+}
+
+void Profiler::getHottest(uint32_t *addrs, unsigned int count)
+{
+    std::vector<unsigned int> hot = topEntries(m_Exec, MAX_MEMORY, count);
+
+    for(unsigned int i = 0; i < count; i++) addrs[i] = i < hot.size() ? hot[i] : MAX_MEMORY;
+}
+
+bool Profiler::writeReport(std::string filename, Chip8Core *chip)
+{
+    std::ofstream ofile(filename.c_str());
+
+    if(!ofile.is_open()) return false;
+
+    double total = m_Instructions ? double(m_Instructions) : 1.0;
+
+    ofile << "Instructions: " << m_Instructions << "\n";
+    ofile << std::fixed << std::setprecision(2);
+
+    // opcode classes, busiest first
+    ofile << "\nOpcode classes\n";
+    std::vector<unsigned int> ops = topEntries(m_Ops, OPID_COUNT, OPID_COUNT);
+    for(unsigned int i = 0; i < ops.size(); i++)
+    {
+        ofile << "  " << std::left << std::setw(14) << s_OpNames[ops[i]] << std::right;
+        ofile << std::setw(14) << m_Ops[ops[i]] << std::setw(8) << m_Ops[ops[i]] * 100.0 / total << "%\n";
+    }
+
+    // hottest instructions, disassembled
+    ofile << "\nHot addresses\n";
+    std::vector<unsigned int> hot = topEntries(m_Exec, MAX_MEMORY, PROFILE_REPORT_LINES);
+    for(unsigned int i = 0; i < hot.size(); i++)
+    {
+        Instruction inst = chip->disassemble(chip->getMemAt(hot[i]) << 8 | chip->getMemAt((hot[i] + 1) & (MAX_MEMORY - 1)));
+        inst.addr = hot[i];
+
+        ofile << "  " << std::setw(14) << m_Exec[hot[i]] << std::setw(8) << m_Exec[hot[i]] * 100.0 / total << "%  ";
+        ofile << chip->getDisassembledString(&inst) << "\n";
+    }
+
+    // subroutines by calls, with how deep the stack got
+    ofile << "\nCalls                       max depth\n";
+    std::vector<unsigned int> calls = topEntries(m_Calls, MAX_MEMORY, PROFILE_REPORT_LINES);
+    for(unsigned int i = 0; i < calls.size(); i++)
+    {
+        ofile << "  " << std::hex << std::setfill('0') << std::setw(4) << calls[i] << std::dec << std::setfill(' ');
+        ofile << std::setw(20) << m_Calls[calls[i]] << std::setw(12) << int(m_MaxDepth[calls[i]]) << "\n";
+    }
+
+    ofile << "\nCalls by stack depth\n";
+    for(int i = 1; i <= MAX_STACK; i++)
+    {
+        if(m_Depths[i]) ofile << "  " << std::setw(4) << i << std::setw(20) << m_Depths[i] << "\n";
+    }
+
+    // busiest data bytes
+    const char *names[] = { "\nMemory reads\n", "\nMemory writes\n" };
+    const uint64_t *counts[] = { m_Reads, m_Writes };
+    for(int n = 0; n < 2; n++)
+    {
+        ofile << names[n];
+        std::vector<unsigned int> bytes = topEntries(counts[n], MAX_MEMORY, PROFILE_REPORT_LINES);
+        for(unsigned int i = 0; i < bytes.size(); i++)
+        {
+            ofile << "  " << std::hex << std::setfill('0') << std::setw(4) << bytes[i] << std::dec << std::setfill(' ');
+            ofile << std::setw(20) << counts[n][bytes[i]] << "\n";
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef CLASS_PROFILER
+#define CLASS_PROFILER
+
+#include <string>
+
+#include "chip8core.hpp"
+
+// lines in each table of the report
+#define PROFILE_REPORT_LINES 24
+
+// guest level counters, filled by the instrumented engine while profiling
+// everything is indexed by guest address or opcode id, nothing is allocated while counting
+class Profiler
+{
+private:
+
+    // executions per opcode class
+    uint64_t m_Ops[OPID_COUNT];
+    // executions per program counter
+    uint64_t m_Exec[MAX_MEMORY];
+    // data reads and writes per memory byte, Dxyn, Fx55, Fx65 and Fx33
+    uint64_t m_Reads[MAX_MEMORY];
+    uint64_t m_Writes[MAX_MEMORY];
+    // calls per 2nnn target and the deepest stack a call to it was made with
+    uint64_t m_Calls[MAX_MEMORY];
+    uint8_t m_MaxDepth[MAX_MEMORY];
+    // calls made at each stack depth
+    uint64_t m_Depths[MAX_STACK + 1];
+    uint64_t m_Instructions;
+
+public:
+    Profiler();
+
+    void clear();
+
+    void countInstruction(uint16_t addr, uint8_t id)
+    {
+        m_Exec[addr]++;
+        m_Ops[id]++;
+        m_Instructions++;
+    }
+    void countReads(uint16_t addr, unsigned int len)
+    {
+        for(unsigned int i = 0; i < len; i++) m_Reads[(addr + i) & (MAX_MEMORY - 1)]++;
+    }
+    void countWrites(uint16_t addr, unsigned int len)
+    {
+        for(unsigned int i = 0; i < len; i++) m_Writes[(addr + i) & (MAX_MEMORY - 1)]++;
+    }
+    // depth is the stack size after the call
+    void countCall(uint16_t target, uint8_t depth)
+    {
+        m_Calls[target]++;
+        if(depth > m_MaxDepth[target]) m_MaxDepth[target] = depth;
+        m_Depths[depth]++;
+    }
+
+    uint64_t getInstructionCount() { return m_Instructions;}
+
+    // log scaled executions, reads and writes of the first len addresses, 3 bytes per address
+    void getHeatmap(uint8_t *heat, unsigned int len);
+    // most executed addresses, highest first, unused slots are set to MAX_MEMORY
+    void getHottest(uint32_t *addrs, unsigned int count);
+
+    // text report, instructions are disassembled from the machine's current memory
+    bool writeReport(std::string filename, Chip8Core *chip);
+};
+#endif // CLASS_PROFILER
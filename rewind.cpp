@@ -0,0 +1,310 @@
+#include "rewind.hpp"
+
+#include <cstddef>
+#include <string.h>
+
+// the delta coder works on whole 64-bit words
+static_assert(offsetof(MachineState, mem) % 8 == 0 && CHIP8_MEMORY % (DIRTY_BLOCKS * 8) == 0, "MachineState must be made of whole words");
+
+// keyframes are stored as a delta against an all zero state, as large as the largest profile
+static const MachineState s_ZeroState = MachineState();
+
+static unsigned int writeVarint(uint8_t *out, uint32_t val)
+{
+    unsigned int len = 0;
+
+    while(val >= 0x80)
+    {
+        out[len++] = uint8_t(val) | 0x80;
+        val >>= 7;
+    }
+    out[len++] = uint8_t(val);
+
+    return len;
+}
+
+static uint32_t readVarint(const uint8_t *in, uint32_t *pos)
+{
+    uint32_t val = 0;
+    int shift = 0;
+
+    while(in[*pos] & 0x80)
+    {
+        val |= uint32_t(in[(*pos)++] & 0x7f) << shift;
+        shift += 7;
+    }
+    val |= uint32_t(in[(*pos)++]) << shift;
+
+    return val;
+}
+
+// state words are read and written with memcpy, the state is not made of uint64_t
+static inline uint64_t loadWord(const uint8_t *p, uint32_t i)
+{
+    uint64_t w;
+    memcpy(&w, p + i * 8, 8);
+    return w;
+}
+
+// delta coder state, changed words are collected until the next unchanged one
+struct DeltaWriter
+{
+    uint8_t *out;
+    uint32_t pos;
+    // unchanged words before the pending changed run
+    uint32_t same;
+    uint32_t litstart;
+    uint32_t litlen;
+};
+
+static void flushLiteral(DeltaWriter *w, const uint8_t *a, const uint8_t *b)
+{
+    w->pos += writeVarint(w->out + w->pos, w->same);
+    w->pos += writeVarint(w->out + w->pos, w->litlen);
+    for(uint32_t n = w->litstart; n < w->litstart + w->litlen; n++)
+    {
+        uint64_t x = loadWord(a, n) ^ loadWord(b, n);
+        memcpy(w->out + w->pos, &x, 8);
+        w->pos += 8;
+    }
+    w->same = 0;
+    w->litlen = 0;
+}
+
+static void encodeRange(DeltaWriter *w, const uint8_t *a, const uint8_t *b, uint32_t start, uint32_t end)
+{
+    for(uint32_t i = start; i < end; i++)
+    {
+        if(loadWord(a, i) != loadWord(b, i))
+        {
+            if(!w->litlen) w->litstart = i;
+            w->litlen++;
+        }
+        else if(w->litlen)
+        {
+            flushLiteral(w, a, b);
+            w->same = 1;
+        }
+        else w->same++;
+    }
+}
+
+// xor of cur and ref as (unchanged words, changed words, xor of the changed words) runs,
+// trailing unchanged words are left out, both have the memory size of cur's profile
+// memory blocks without a dirty bit are known to match ref and are skipped unread
+static uint32_t encodeDelta(const MachineState &cur, const MachineState &ref, uint64_t dirty, uint8_t *out)
+{
+    const uint8_t *a = (const uint8_t*)&cur;
+    const uint8_t *b = (const uint8_t*)&ref;
+    const uint32_t memstart = offsetof(MachineState, mem) / 8;
+    const uint32_t blockwords = memorySize(cur.quirks) / DIRTY_BLOCKS / 8;
+
+    DeltaWriter w;
+    w.out = out;
+    w.pos = 0;
+    w.same = 0;
+    w.litstart = 0;
+    w.litlen = 0;
+
+    encodeRange(&w, a, b, 0, memstart);
+
+    // DIRTY_BLOCKS blocks of memory, the last thing in the state
+    uint32_t block = 0;
+    while(dirty)
+    {
+        // clean blocks in between count as unchanged
+        uint32_t next = __builtin_ctzll(dirty);
+        if(w.litlen && next != block) flushLiteral(&w, a, b);
+        w.same += (next - block) * blockwords;
+
+        encodeRange(&w, a, b, memstart + next * blockwords, memstart + (next + 1) * blockwords);
+
+        block = next + 1;
+        dirty &= dirty - 1;
+    }
+    if(w.litlen) flushLiteral(&w, a, b);
+
+    return w.pos;
+}
+
+// apply an encoded delta to state in place
+static void decodeDelta(const uint8_t *in, uint32_t size, MachineState *state)
+{
+    uint8_t *a = (uint8_t*)state;
+    uint32_t pos = 0;
+    uint32_t i = 0;
+
+    while(pos < size)
+    {
+        i += readVarint(in, &pos);
+        uint32_t len = readVarint(in, &pos);
+
+        for(uint32_t n = 0; n < len; n++)
+        {
+            uint64_t x;
+            memcpy(&x, in + pos, 8);
+            x ^= loadWord(a, i + n);
+            memcpy(a + (i + n) * 8, &x, 8);
+            pos += 8;
+        }
+        i += len;
+    }
+}
+
+RewindBuffer::RewindBuffer()
+{
+    m_Data = new uint8_t[REWIND_BUFFER_SIZE];
+    m_Keyframe = allocState(QUIRKS_MODERN);
+    m_Restored = allocState(QUIRKS_MODERN);
+
+    clear();
+}
+
+RewindBuffer::~RewindBuffer()
+{
+    delete [] m_Data;
+    free(m_Keyframe);
+    free(m_Restored);
+}
+
+void RewindBuffer::clear()
+{
+    m_First = 0;
+    m_Count = 0;
+    m_WritePos = 0;
+    m_KeySeq = 0;
+    m_SinceKeyframe = 0;
+}
+
+uint32_t RewindBuffer::allocate(uint32_t size)
+{
+    while(1)
+    {
+        if(m_Count == 0) return 0;
+
+        uint32_t oldest = entry(m_First).offset;
+
+        if(m_Count < REWIND_FRAMES)
+        {
+            // free space is after the newest entry and before the oldest, or between them once wrapped
+            if(m_WritePos > oldest)
+            {
+                if(m_WritePos + size <= REWIND_BUFFER_SIZE) return m_WritePos;
+                if(size <= oldest) return 0;
+            }
+            else if(m_WritePos + size <= oldest) return m_WritePos;
+        }
+
+        dropOldest();
+    }
+}
+
+void RewindBuffer::dropOldest()
+{
+    // deltas are useless without their keyframe, drop them with it
+    do
+    {
+        m_First++;
+        m_Count--;
+    }
+    while(m_Count && !entry(m_First).keyframe);
+}
+
+void RewindBuffer::record(const MachineState &state, uint64_t *dirty)
+{
+    // nothing ran since the newest snapshot, a paused or rewound machine
+    if(m_Count && entry(m_First + m_Count - 1).cycles == state.cycles) return;
+
+    // a profile with another memory size can not be a delta against the keyframe
+    bool keyframe = m_Count == 0 || m_KeySeq < m_First || m_SinceKeyframe >= REWIND_KEYFRAME_INTERVAL ||
+                    memorySize(state.quirks) != memorySize(m_Keyframe->quirks);
+    uint32_t size = 0;
+    uint32_t offset = 0;
+
+    m_Scratch.resize(stateSize(state.quirks) * 2);
+
+    if(!keyframe)
+    {
+        size = encodeDelta(state, *m_Keyframe, *dirty, &m_Scratch[0]);
+        offset = allocate(size);
+
+        // making room dropped the keyframe this delta is against
+        if(m_KeySeq < m_First) keyframe = true;
+    }
+
+    if(keyframe)
+    {
+        size = encodeDelta(state, s_ZeroState, ~0ULL, &m_Scratch[0]);
+        offset = allocate(size);
+
+        m_Keyframe = resizeState(m_Keyframe, state.quirks);
+        memcpy(m_Keyframe, &state, stateSize(state.quirks));
+        m_KeySeq = m_First + m_Count;
+        m_SinceKeyframe = 0;
+        *dirty = 0;
+    }
+
+    memcpy(m_Data + offset, &m_Scratch[0], size);
+
+    RewindEntry &e = entry(m_First + m_Count);
+    e.cycles = state.cycles;
+    e.offset = offset;
+    e.size = size;
+    e.keyframe = keyframe;
+    e.quirks = state.quirks;
+
+    m_Count++;
+    m_WritePos = offset + size;
+    m_SinceKeyframe++;
+}
+
+const MachineState *RewindBuffer::restore(uint64_t cycle)
+{
+    // newest snapshot at or before cycle
+    uint64_t seq = m_First + m_Count;
+    while(seq > m_First && entry(seq - 1).cycles > cycle) seq--;
+
+    if(seq == m_First) return NULL;
+    seq--;
+
+    // the oldest entry is always a keyframe
+    uint64_t key = seq;
+    while(!entry(key).keyframe) key--;
+
+    // deltas have the memory size of their keyframe
+    uint8_t quirks = entry(key).quirks;
+    m_Keyframe = resizeState(m_Keyframe, quirks);
+    m_Restored = resizeState(m_Restored, quirks);
+
+    memcpy(m_Keyframe, &s_ZeroState, stateSize(quirks));
+    decodeDelta(m_Data + entry(key).offset, entry(key).size, m_Keyframe);
+    m_KeySeq = key;
+    m_SinceKeyframe = seq - key + 1;
+
+    memcpy(m_Restored, m_Keyframe, stateSize(quirks));
+    if(seq != key) decodeDelta(m_Data + entry(seq).offset, entry(seq).size, m_Restored);
+
+    // recording carries on from here
+    m_Count = seq - m_First + 1;
+    m_WritePos = entry(seq).offset + entry(seq).size;
+
+    return m_Restored;
+}
+
+uint32_t RewindBuffer::getBytesUsed()
+{
+    if(m_Count == 0) return 0;
+
+    uint32_t oldest = entry(m_First).offset;
+
+    if(m_WritePos > oldest) return m_WritePos - oldest;
+
+    // wrapped, count up to the end of the last entry before the wrap
+    uint32_t used = m_WritePos;
+    for(uint64_t seq = m_First; seq < m_First + m_Count; seq++)
+    {
+        if(entry(seq).offset >= oldest) used += entry(seq).size;
+    }
+
+    return used;
+}
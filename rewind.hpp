@@ -0,0 +1,74 @@
+#ifndef CLASS_REWIND
+#define CLASS_REWIND
+
+#include "chip8core.hpp"
+
+#include <vector>
+
+// snapshots kept, 60 seconds of host frames
+#define REWIND_FRAMES (60 * TIMER_FREQUENCY)
+// bytes of compressed snapshots kept, the oldest are dropped when either limit is hit
+#define REWIND_BUFFER_SIZE (2 * 1024 * 1024)
+// a full snapshot every second, the frames in between are deltas against it
+#define REWIND_KEYFRAME_INTERVAL TIMER_FREQUENCY
+
+// ring of machine states for rewinding, one per frame the host shows
+// every snapshot is stored as the xor against the last keyframe, run length coded a 64-bit word
+// at a time so unchanged words cost nothing, memory blocks not written since the keyframe are not even read
+class RewindBuffer
+{
+private:
+
+    struct RewindEntry
+    {
+        // guest cycle the snapshot was taken at
+        uint64_t cycles;
+        // encoded snapshot in m_Data
+        uint32_t offset;
+        uint32_t size;
+        bool keyframe;
+        // profile of the snapshot, deltas are only made against a keyframe with the same memory size
+        uint8_t quirks;
+    };
+
+    // entries are indexed by sequence number modulo REWIND_FRAMES
+    RewindEntry m_Entries[REWIND_FRAMES];
+    uint64_t m_First;
+    unsigned int m_Count;
+
+    // encoded snapshots, in the same order as the entries with a gap at the end when they wrap
+    uint8_t *m_Data;
+    uint32_t m_WritePos;
+
+    // decoded copy of the keyframe new deltas are made against, sized for its profile
+    MachineState *m_Keyframe;
+    uint64_t m_KeySeq;
+    unsigned int m_SinceKeyframe;
+    // snapshot handed out by restore()
+    MachineState *m_Restored;
+
+    // worst case encoding of one snapshot
+    std::vector<uint8_t> m_Scratch;
+
+    RewindEntry &entry(uint64_t seq) { return m_Entries[seq % REWIND_FRAMES];}
+    uint32_t allocate(uint32_t size);
+    void dropOldest();
+
+public:
+    RewindBuffer();
+    ~RewindBuffer();
+
+    void clear();
+
+    // add a snapshot unless the newest one is of the same cycle, dirty has a bit per DIRTY_BLOCK_SIZE bytes of memory written since the last keyframe
+    // and is cleared when this snapshot becomes the new keyframe
+    void record(const MachineState &state, uint64_t *dirty);
+
+    // restore the newest snapshot taken at or before cycle and drop the ones after it
+    // returns NULL if nothing that old is left, the state stays valid until the next call
+    const MachineState *restore(uint64_t cycle);
+
+    unsigned int getFrameCount() { return m_Count;}
+    uint32_t getBytesUsed();
+};
+#endif // CLASS_REWIND
@@ -0,0 +1,315 @@
+#include "romfile.hpp"
+
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <map>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static uint64_t fnv1a(const uint8_t *data, unsigned int size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(unsigned int i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+MappedFile::MappedFile()
+{
+    m_Data = NULL;
+    m_Size = 0;
+
+#ifdef _WIN32
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(std::string filename)
+{
+    close();
+
+#ifdef _WIN32
+    m_File = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if(m_File == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(m_File, &size) || size.QuadPart > 0xffffffffLL)
+    {
+        close();
+        return false;
+    }
+
+    m_Size = unsigned(size.QuadPart);
+    if(!m_Size) return true;
+
+    m_Mapping = CreateFileMappingA(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(m_Mapping) m_Data = (const uint8_t*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+
+    if(fd < 0) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode) || uint64_t(st.st_size) > 0xffffffffULL)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    m_Size = unsigned(st.st_size);
+    if(!m_Size)
+    {
+        ::close(fd);
+        return true;
+    }
+
+    // the mapping stays valid once the descriptor is closed
+    void *data = mmap(NULL, m_Size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if(data != MAP_FAILED) m_Data = (const uint8_t*)data;
+#endif
+
+    if(!m_Data)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if(m_Data) UnmapViewOfFile(m_Data);
+    if(m_Mapping) CloseHandle(m_Mapping);
+    if(m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = NULL;
+#else
+    if(m_Data) munmap((void*)m_Data, m_Size);
+#endif
+
+    m_Data = NULL;
+    m_Size = 0;
+}
+
+RomArchive::RomArchive()
+{
+    m_Entries = NULL;
+    m_Index = NULL;
+    m_Count = 0;
+}
+
+bool RomArchive::open(std::string filename)
+{
+    close();
+
+    if(!m_File.open(filename)) return false;
+
+    const uint8_t *data = m_File.getData();
+    uint64_t size = m_File.getSize();
+    RomArchiveHeader header;
+
+    if(size < sizeof(header))
+    {
+        close();
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    // the toc and every name and rom it points at have to be inside the file
+    uint64_t tocsize = sizeof(header) + uint64_t(header.count) * (sizeof(RomArchiveEntry) + sizeof(uint32_t));
+    bool valid = !memcmp(header.magic, ROM_ARCHIVE_MAGIC, 4) && header.version == ROM_ARCHIVE_VERSION && tocsize <= size;
+
+    const RomArchiveEntry *entries = (const RomArchiveEntry*)(data + sizeof(header));
+    const uint32_t *index = (const uint32_t*)(entries + header.count);
+
+    for(unsigned int i = 0; valid && i < header.count; i++)
+    {
+        const RomArchiveEntry &entry = entries[i];
+
+        valid = index[i] < header.count;
+        valid = valid && uint64_t(entry.offset) + entry.size <= size;
+        valid = valid && uint64_t(entry.nameoffset) + entry.namesize <= size;
+    }
+
+    if(!valid)
+    {
+        std::cout << "Error rom archive version mismatch or truncated:" << filename << std::endl;
+        close();
+        return false;
+    }
+
+    m_Entries = entries;
+    m_Index = index;
+    m_Count = header.count;
+
+    return true;
+}
+
+void RomArchive::close()
+{
+    m_File.close();
+
+    m_Entries = NULL;
+    m_Index = NULL;
+    m_Count = 0;
+}
+
+uint64_t RomArchive::hashName(const std::string &name)
+{
+    return fnv1a((const uint8_t*)name.data(), name.size());
+}
+
+std::string RomArchive::getName(unsigned int index) const
+{
+    const RomArchiveEntry &entry = m_Entries[index];
+
+    return std::string((const char*)m_File.getData() + entry.nameoffset, entry.namesize);
+}
+
+int RomArchive::find(const std::string &name) const
+{
+    uint64_t hash = hashName(name);
+
+    // first index with this hash, then compare names past any collisions
+    unsigned int lo = 0;
+    unsigned int hi = m_Count;
+    while(lo < hi)
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if(m_Entries[m_Index[mid]].namehash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for(; lo < m_Count && m_Entries[m_Index[lo]].namehash == hash; lo++)
+    {
+        const RomArchiveEntry &entry = m_Entries[m_Index[lo]];
+
+        if(entry.namesize == name.size() && !memcmp(m_File.getData() + entry.nameoffset, name.data(), name.size())) return m_Index[lo];
+    }
+
+    return -1;
+}
+
+bool RomArchive::pack(std::string archivefile, const std::vector<std::string> &roms)
+{
+    std::vector<RomArchiveEntry> entries(roms.size());
+    std::vector<uint32_t> index(roms.size());
+    std::string names;
+    std::vector<uint8_t> blob;
+
+    // first offset of each distinct rom in blob by hash and size
+    std::multimap<uint64_t, uint32_t> stored;
+
+    for(unsigned int i = 0; i < roms.size(); i++)
+    {
+        MappedFile file;
+
+        if(!file.open(roms[i]))
+        {
+            std::cout << "Error opening rom file:" << roms[i] << std::endl;
+            return false;
+        }
+
+        const uint8_t *data = file.getData();
+        unsigned int size = file.getSize();
+        RomArchiveEntry &entry = entries[i];
+
+        entry.namehash = hashName(roms[i]);
+        entry.romhash = fnv1a(data, size);
+        entry.offset = 0;
+        entry.size = size;
+        entry.nameoffset = names.size();
+        entry.namesize = roms[i].size();
+        names += roms[i];
+
+        bool found = false;
+        auto range = stored.equal_range(entry.romhash);
+        for(auto it = range.first; it != range.second && !found; ++it)
+        {
+            const RomArchiveEntry &other = entries[it->second];
+
+            if(other.size == size && (!size || !memcmp(&blob[other.offset], data, size)))
+            {
+                entry.offset = other.offset;
+                found = true;
+            }
+        }
+
+        if(!found)
+        {
+            entry.offset = blob.size();
+            blob.insert(blob.end(), data, data + size);
+            stored.insert(std::make_pair(entry.romhash, i));
+        }
+
+        index[i] = i;
+    }
+
+    std::stable_sort(index.begin(), index.end(), [&](uint32_t a, uint32_t b) { return entries[a].namehash < entries[b].namehash;});
+
+    // offsets so far are relative to the names and the blob, make them relative to the file
+    uint64_t namestart = sizeof(RomArchiveHeader) + uint64_t(roms.size()) * (sizeof(RomArchiveEntry) + sizeof(uint32_t));
+    uint64_t blobstart = namestart + names.size();
+
+    if(blobstart + blob.size() > 0xffffffffULL)
+    {
+        std::cout << "Error rom archive over 4GB:" << archivefile << std::endl;
+        return false;
+    }
+
+    for(unsigned int i = 0; i < entries.size(); i++)
+    {
+        entries[i].nameoffset += namestart;
+        entries[i].offset += blobstart;
+    }
+
+    RomArchiveHeader header;
+    memcpy(header.magic, ROM_ARCHIVE_MAGIC, 4);
+    header.version = ROM_ARCHIVE_VERSION;
+    header.count = roms.size();
+    header.reserved = 0;
+
+    std::ofstream ofile(archivefile.c_str(), std::ios::binary);
+
+    if(!ofile.is_open())
+    {
+        std::cout << "Error opening file for writing:" << archivefile << std::endl;
+        return false;
+    }
+
+    ofile.write((const char*)&header, sizeof(header));
+    if(!entries.empty()) ofile.write((const char*)&entries[0], entries.size() * sizeof(RomArchiveEntry));
+    if(!index.empty()) ofile.write((const char*)&index[0], index.size() * sizeof(uint32_t));
+    ofile.write(names.data(), names.size());
+    if(!blob.empty()) ofile.write((const char*)&blob[0], blob.size());
+
+    return bool(ofile);
+}
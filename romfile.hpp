@@ -0,0 +1,97 @@
+#ifndef CLASS_ROMFILE
+#define CLASS_ROMFILE
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// archive of many roms in one file, bump the version whenever the layout changes
+#define ROM_ARCHIVE_MAGIC "C8PK"
+#define ROM_ARCHIVE_VERSION 1
+#define ROM_ARCHIVE_EXTENSION ".c8pak"
+
+// read only view of a whole file mapped into memory, nothing is read until it is touched
+class MappedFile
+{
+private:
+
+    const uint8_t *m_Data;
+    unsigned int m_Size;
+
+#ifdef _WIN32
+    void *m_File;
+    void *m_Mapping;
+#endif
+
+    // not copyable, the mapping belongs to one object
+    MappedFile(const MappedFile&);
+    MappedFile &operator=(const MappedFile&);
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // files of 4GB or more are refused
+    bool open(std::string filename);
+    void close();
+
+    // NULL for an empty file
+    const uint8_t *getData() const { return m_Data;}
+    unsigned int getSize() const { return m_Size;}
+};
+
+// header, then the table of contents in pack order, then the toc indices sorted by name hash,
+// then the names and then the rom data, roms with the same contents are stored once
+struct RomArchiveHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct RomArchiveEntry
+{
+    // fnv-1a of the name and of the rom
+    uint64_t namehash;
+    uint64_t romhash;
+    // byte offsets from the start of the archive
+    uint32_t offset;
+    uint32_t size;
+    uint32_t nameoffset;
+    uint32_t namesize;
+};
+
+// mapped rom archive, roms are used in place without any reads or copies
+class RomArchive
+{
+private:
+
+    MappedFile m_File;
+
+    const RomArchiveEntry *m_Entries;
+    const uint32_t *m_Index;
+    unsigned int m_Count;
+
+public:
+    RomArchive();
+
+    // the whole table of contents is checked against the file size once here
+    bool open(std::string filename);
+    void close();
+
+    static uint64_t hashName(const std::string &name);
+
+    // write every rom in roms to archivefile, names are stored as given
+    static bool pack(std::string archivefile, const std::vector<std::string> &roms);
+
+    unsigned int getCount() const { return m_Count;}
+    std::string getName(unsigned int index) const;
+    const uint8_t *getData(unsigned int index) const { return m_File.getData() + m_Entries[index].offset;}
+    unsigned int getSize(unsigned int index) const { return m_Entries[index].size;}
+    uint64_t getHash(unsigned int index) const { return m_Entries[index].romhash;}
+
+    // toc index of the rom with this name, -1 if it is not in the archive
+    int find(const std::string &name) const;
+};
+#endif // CLASS_ROMFILE
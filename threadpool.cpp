@@ -0,0 +1,111 @@
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(unsigned int threads)
+{
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    if(threads == 0) threads = 1;
+
+    m_Pending = 0;
+    m_Generation = 0;
+    m_Quit = false;
+
+    for(unsigned int i = 0; i < threads; i++) m_Queues.push_back(new WorkerQueue);
+    for(unsigned int i = 0; i < threads; i++) m_Workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Quit = true;
+        m_Wake.notify_all();
+    }
+
+    for(unsigned int i = 0; i < m_Workers.size(); i++) m_Workers[i].join();
+    for(unsigned int i = 0; i < m_Queues.size(); i++) delete m_Queues[i];
+}
+
+void ThreadPool::parallelFor(unsigned int count, std::function<void(unsigned int)> job)
+{
+    if(count == 0) return;
+
+    m_Job = job;
+    m_Pending = count;
+
+    // give each worker a contiguous share, stealing evens out jobs that run long
+    unsigned int threads = m_Queues.size();
+    for(unsigned int i = 0; i < threads; i++)
+    {
+        std::lock_guard<std::mutex> lock(m_Queues[i]->lock);
+        for(unsigned int n = i * count / threads; n < (i + 1) * count / threads; n++) m_Queues[i]->jobs.push_back(n);
+    }
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Generation++;
+    m_Wake.notify_all();
+
+    while(m_Pending) m_Done.wait(lock);
+}
+
+void ThreadPool::workerLoop(unsigned int id)
+{
+    unsigned int seen = 0;
+
+    while(1)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            while(!m_Quit && m_Generation == seen) m_Wake.wait(lock);
+
+            if(m_Quit) return;
+            seen = m_Generation;
+        }
+
+        unsigned int index;
+        while(popJob(id, &index) || stealJob(id, &index))
+        {
+            m_Job(index);
+
+            // last job done, wake the caller
+            if(--m_Pending == 0)
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Done.notify_all();
+            }
+        }
+    }
+}
+
+bool ThreadPool::popJob(unsigned int id, unsigned int *index)
+{
+    WorkerQueue *queue = m_Queues[id];
+    std::lock_guard<std::mutex> lock(queue->lock);
+
+    if(queue->jobs.empty()) return false;
+
+    *index = queue->jobs.front();
+    queue->jobs.pop_front();
+
+    return true;
+}
+
+bool ThreadPool::stealJob(unsigned int id, unsigned int *index)
+{
+    unsigned int threads = m_Queues.size();
+
+    // take from the back of the other queues, away from where their owners work
+    for(unsigned int i = 1; i < threads; i++)
+    {
+        WorkerQueue *queue = m_Queues[(id + i) % threads];
+        std::lock_guard<std::mutex> lock(queue->lock);
+
+        if(queue->jobs.empty()) continue;
+
+        *index = queue->jobs.back();
+        queue->jobs.pop_back();
+
+        return true;
+    }
+
+    return false;
+}
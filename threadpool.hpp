@@ -0,0 +1,53 @@
+#ifndef CLASS_THREADPOOL
+#define CLASS_THREADPOOL
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// fixed set of worker threads for the headless batch tools
+// every worker has its own job queue, a worker that runs out steals from the others
+class ThreadPool
+{
+private:
+
+    struct WorkerQueue
+    {
+        std::mutex lock;
+        std::deque<unsigned int> jobs;
+    };
+
+    std::vector<std::thread> m_Workers;
+    std::vector<WorkerQueue*> m_Queues;
+
+    // job run for every index of the current parallelFor()
+    std::function<void(unsigned int)> m_Job;
+    // jobs of the current parallelFor() not finished yet
+    std::atomic<unsigned int> m_Pending;
+
+    // workers sleep on m_Wake until the generation changes, the caller sleeps on m_Done
+    std::mutex m_Mutex;
+    std::condition_variable m_Wake;
+    std::condition_variable m_Done;
+    unsigned int m_Generation;
+    bool m_Quit;
+
+    void workerLoop(unsigned int id);
+    bool popJob(unsigned int id, unsigned int *index);
+    bool stealJob(unsigned int id, unsigned int *index);
+
+public:
+    // 0 threads uses one per core
+    ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+
+    unsigned int getThreadCount() { return m_Workers.size();}
+
+    // run job(index) for every index in [0, count) and wait for all of them
+    void parallelFor(unsigned int count, std::function<void(unsigned int)> job);
+};
+#endif // CLASS_THREADPOOL